@@ -0,0 +1,564 @@
+/*
+ * Binary cache of a parsed structure kept next to the input file.  The image
+ * holds a header, the roots of all models, the chain, residue and atom tables
+ * of each model and the disulfide bonds.  The tables refer to each other by
+ * index so only the pointers of the roots are stored as offsets into the
+ * image, loading is a single private mmap(2) plus a fix-up of the roots.
+ * The header records the format version, the node layout of this build, a
+ * hash over the bytes of the input file and the options the structure was
+ * read with; a cache not matching any of these is stale and ignored.  The
+ * messages printed while the input file was read (gaps, occupancies,
+ * header notes, ...) are kept at the end of the image and printed again
+ * when the cache is loaded.
+ *
+ */
+
+
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "pdb.h"
+#include "cache.h"
+#include "util/util.h"
+
+
+#define CACHE_SUFFIX ".mpc"
+#define CACHE_MAGIC "molprep structure cache"
+#define CACHE_VERSION 9
+#define CACHE_BYTE_ORDER 0x01020304U
+#define CACHE_HASH_BUF (1024 * 1024)
+
+#define CACHE_ALIGN(n) ( ((n) + 7) & ~(uint64_t) 7)
+
+/* pointers are offsets from the start of the image, 0 is NULL */
+#define CACHE_REF(off) ( (void *) (uintptr_t) (off) )
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+
+typedef struct _cache_header {
+  char magic[sizeof(CACHE_MAGIC)];
+  uint32_t version;
+  uint32_t byte_order;
+  uint16_t layout[5];		/* node sizes of the writing build */
+  uint16_t flags;		/* options changing the parse */
+  char ss_name[PDB_RES_NAME_LEN];
+  int32_t model_no;
+  int32_t nssb;
+  uint64_t src_size;
+  uint64_t src_hash;
+  uint64_t nmodels, nssptrs, nssbonds;
+  uint64_t nlog;		/* length of the reader messages */
+  uint64_t size;		/* size of the complete image */
+} cache_header;
+
+enum {CACHE_REMH = 1, CACHE_RSSB = 2, CACHE_FIXED = 4, CACHE_WARNOCC = 8};
+
+
+
+/*
+ * cache_hash: hash the raw bytes of a file, 8 bytes at a time with FNV-1a
+ *
+ * in:  file name, pointer to file size
+ * out: hash, 0 if the file cannot be read
+ *
+ */
+
+static uint64_t cache_hash(const char *filename, uint64_t *size)
+{
+  size_t i, n;
+
+  uint64_t hash = FNV_OFFSET, word;
+
+  unsigned char *buf;
+
+  FILE *stream;
+
+
+  *size = 0;
+
+  if (!(stream = fopen(filename, "rb")) ) {
+    return 0;
+  }
+
+  buf = allocate(CACHE_HASH_BUF);
+
+  /* all but the last block are a multiple of the word size */
+  while ( (n = fread(buf, 1, CACHE_HASH_BUF, stream)) > 0) {
+    for (i = 0; i + sizeof(word) <= n; i += sizeof(word)) {
+      memcpy(&word, buf + i, sizeof(word));
+      hash = (hash ^ word) * FNV_PRIME;
+    }
+
+    for (; i < n; i++) {
+      hash = (hash ^ buf[i]) * FNV_PRIME;
+    }
+
+    *size += n;
+  }
+
+  if (ferror(stream) ) {
+    hash = 0;
+  }
+
+  free(buf);
+  fclose(stream);
+
+  return hash;
+}
+
+
+/*
+ * cache_name: derive the cache file name from the input file name
+ *
+ * in:  input file name
+ * out: allocated cache file name
+ *
+ */
+
+static char *cache_name(const char *filename)
+{
+  char *name;
+
+
+  name = allocate(strlen(filename) + sizeof(CACHE_SUFFIX));
+  strcpy(name, filename);
+  strcat(name, CACHE_SUFFIX);
+
+  return name;
+}
+
+
+/*
+ * cache_setup: fill the parts of the header describing build, options and
+ *              input file
+ *
+ * in:  header, name for CYS residues in disulfide bond, chosen model number
+ *
+ */
+
+static void cache_setup(cache_header *hdr, const char *ss_name, int model_no)
+{
+  memset(hdr, 0, sizeof(*hdr));
+
+  memcpy(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  hdr->version = CACHE_VERSION;
+  hdr->byte_order = CACHE_BYTE_ORDER;
+
+  hdr->layout[0] = sizeof(pdb_root);
+  hdr->layout[1] = sizeof(pdb_chain);
+  hdr->layout[2] = sizeof(pdb_residue);
+  hdr->layout[3] = sizeof(pdb_atom);
+  hdr->layout[4] = sizeof(pdb_ssbond);
+
+  hdr->flags = (options.remh ? CACHE_REMH : 0) |
+    (options.rssb ? CACHE_RSSB : 0) | (options.warnocc ? CACHE_WARNOCC : 0);
+
+#ifdef PDB_FIXED_COORDS
+  hdr->flags |= CACHE_FIXED;	/* coordinate representation of the build */
+#endif
+  strncpy(hdr->ss_name, ss_name, PDB_RES_NAME_LEN-1);
+  hdr->model_no = model_no;
+}
+
+
+/*
+ * cache_model_size: bytes taken by the tables of a model in the image
+ *
+ * in:  model
+ * out: size
+ *
+ */
+
+static uint64_t cache_model_size(const pdb_root *model)
+{
+  uint64_t natoms = model->atoms.used;
+
+
+  return CACHE_ALIGN(model->nchains * sizeof(pdb_chain)) +
+    CACHE_ALIGN(model->nres * sizeof(pdb_residue)) +
+    3 * CACHE_ALIGN(natoms * sizeof(pdb_coord)) +
+    CACHE_ALIGN(natoms * sizeof(pdb_occ)) +
+    CACHE_ALIGN(natoms * sizeof(pdb_bfac)) +
+    CACHE_ALIGN(natoms * sizeof(pdb_atom));
+}
+
+
+/*
+ * cache_put: copy a table into the image
+ *
+ * in:  image, offset of the next free byte, table, size in bytes
+ * out: offset of the table, 0 for an empty table
+ *
+ */
+
+static uint64_t cache_put(char *image, uint64_t *off, const void *src,
+			  uint64_t size)
+{
+  uint64_t start = *off;
+
+
+  if (size == 0) {
+    return 0;
+  }
+
+  memcpy(image + start, src, size);
+  *off += CACHE_ALIGN(size);
+
+  return start;
+}
+
+
+/*
+ * cache_write: store a freshly read structure next to the input file;
+ *              failure is not an error as the cache is only an optimization
+ *
+ * in:  pdb root structure, input file name, name for CYS residues in
+ *      disulfide bond, chosen model number, counter for S-S bonds, messages
+ *      printed while reading
+ *
+ */
+
+void cache_write(const pdb_root *pdb, const char *filename, const char *ss_name,
+		 int model_no, int nssb, const char *log)
+{
+  uint64_t off_root, off, off_ssptr, off_ss, off_log, natoms;
+  uint64_t iroot = 0, issptr = 0, iss = 0;
+
+  bool ok;
+
+  char *name, *image;
+
+  FILE *stream;
+
+  cache_header hdr;
+
+  const pdb_root *model;
+  pdb_ssbond **ssbonds;
+
+  pdb_root *r;
+  pdb_ssbond **ssp;
+
+
+  cache_setup(&hdr, ss_name, model_no);
+  hdr.nssb = nssb;
+  hdr.nlog = strlen(log);
+
+  if (!(hdr.src_hash = cache_hash(filename, &hdr.src_size)) ) {
+    return;
+  }
+
+  off_root = CACHE_ALIGN(sizeof(hdr));
+  off = 0;
+
+  for (model = pdb; model; model = model->next_model) {
+    hdr.nmodels++;
+    off += cache_model_size(model);
+
+    if (model->ssbonds) {
+      for (ssbonds = model->ssbonds; *ssbonds; ssbonds++) {
+	hdr.nssbonds++;
+	hdr.nssptrs++;
+      }
+
+      hdr.nssptrs++;
+    }
+  }
+
+  off += off_root + CACHE_ALIGN(hdr.nmodels * sizeof(pdb_root));
+  off_ssptr = off;
+  off_ss = off_ssptr + CACHE_ALIGN(hdr.nssptrs * sizeof(pdb_ssbond *));
+  off_log = off_ss + CACHE_ALIGN(hdr.nssbonds * sizeof(pdb_ssbond));
+  hdr.size = off_log + CACHE_ALIGN(hdr.nlog);
+
+  if (hdr.size > SIZE_MAX) {
+    return;
+  }
+
+  image = allocate(hdr.size);
+  memset(image, 0, hdr.size);
+  memcpy(image, &hdr, sizeof(hdr));
+
+  off = off_root + CACHE_ALIGN(hdr.nmodels * sizeof(pdb_root));
+
+  for (model = pdb; model; model = model->next_model, iroot++) {
+    r = (pdb_root *) (image + off_root) + iroot;
+    memcpy(r, model, sizeof(*r));
+
+    /* only the used parts of the tables are stored */
+    natoms = model->atoms.used;
+    r->max_chains = model->nchains;
+    r->max_res = model->nres;
+    r->atoms.size = model->atoms.used;
+
+    r->shadows = NULL;		/* left by pdb_select_altloc */
+    r->cache = NULL;
+    r->cache_size = 0;
+    r->next_model = model->next_model ?
+      CACHE_REF(off_root + (iroot + 1) * sizeof(pdb_root)) : NULL;
+
+    r->chains = CACHE_REF(cache_put(image, &off, model->chains,
+				    model->nchains * sizeof(pdb_chain)) );
+    r->residues = CACHE_REF(cache_put(image, &off, model->residues,
+				      model->nres * sizeof(pdb_residue)) );
+    r->atoms.x = CACHE_REF(cache_put(image, &off, model->atoms.x,
+				     natoms * sizeof(pdb_coord)) );
+    r->atoms.y = CACHE_REF(cache_put(image, &off, model->atoms.y,
+				     natoms * sizeof(pdb_coord)) );
+    r->atoms.z = CACHE_REF(cache_put(image, &off, model->atoms.z,
+				     natoms * sizeof(pdb_coord)) );
+    r->atoms.occupancy = CACHE_REF(cache_put(image, &off,
+					     model->atoms.occupancy,
+					     natoms * sizeof(pdb_occ)) );
+    r->atoms.tempFactor = CACHE_REF(cache_put(image, &off,
+					      model->atoms.tempFactor,
+					      natoms * sizeof(pdb_bfac)) );
+    r->atoms.info = CACHE_REF(cache_put(image, &off, model->atoms.info,
+					natoms * sizeof(pdb_atom)) );
+
+    r->ssbonds = NULL;
+
+    if (model->ssbonds) {
+      r->ssbonds = CACHE_REF(off_ssptr + issptr * sizeof(pdb_ssbond *));
+
+      for (ssbonds = model->ssbonds; *ssbonds; ssbonds++) {
+	ssp = (pdb_ssbond **) (image + off_ssptr) + issptr++;
+	*ssp = CACHE_REF(off_ss + iss * sizeof(pdb_ssbond));
+	memcpy((pdb_ssbond *) (image + off_ss) + iss++, *ssbonds,
+	       sizeof(pdb_ssbond));
+      }
+
+      issptr++;			/* terminating NULL */
+    }
+  }
+
+  memcpy(image + off_log, log, hdr.nlog);
+
+  name = cache_name(filename);
+
+  if ( (stream = fopen(name, "wb")) ) {
+    ok = fwrite(image, hdr.size, 1, stream) == 1;
+
+    if (fclose(stream) != 0 || !ok) {
+      remove(name);
+    }
+  }
+
+  free(name);
+  free(image);
+}
+
+
+/*
+ * cache_fix: turn an offset into a pointer, tables reaching outside the
+ *            image mean the cache is corrupt
+ *
+ * in:  pointer to stored offset, number of entries, entry size, image,
+ *      image size
+ * out: false if out of range
+ *
+ */
+
+static bool cache_fix(void **ptr, uint64_t n, size_t len, char *image,
+		      uint64_t size)
+{
+  uintptr_t off = (uintptr_t) *ptr;
+
+
+  if (off == 0) {
+    return true;
+  }
+
+  if (off >= size || n > (size - off) / len) {
+    return false;
+  }
+
+  *ptr = image + off;
+
+  return true;
+}
+
+#define FIX(p, n) cache_fix((void **) &(p), (n), sizeof(*(p)), image, hdr.size)
+
+
+/*
+ * cache_check_model: check that the tables of a model only refer to
+ *                    entries which exist
+ *
+ * in:  model
+ * out: false if the cache is corrupt
+ *
+ */
+
+static bool cache_check_model(const pdb_root *model)
+{
+  unsigned int i, last = 0;
+
+  const pdb_chain *chain;
+  const pdb_residue *residue;
+
+
+  if (model->atoms.used != model->atoms.size ||
+      (model->nchains && !model->chains) || (model->nres && !model->residues) ||
+      (model->atoms.used && !(model->atoms.x && model->atoms.y &&
+			      model->atoms.z && model->atoms.occupancy &&
+			      model->atoms.tempFactor && model->atoms.info)) ) {
+    return false;
+  }
+
+  for (i = 0; i < model->nchains; i++) {
+    chain = &model->chains[i];
+
+    if (chain->begin != last || chain->end < chain->begin ||
+	chain->end > model->nres) {
+      return false;
+    }
+
+    last = chain->end;
+  }
+
+  if (last != model->nres) {
+    return false;
+  }
+
+  for (i = 0, last = 0; i < model->nres; i++) {
+    residue = &model->residues[i];
+
+    if (residue->chain >= model->nchains || residue->begin < last ||
+	residue->end < residue->begin || residue->limit < residue->end ||
+	residue->limit > model->atoms.used) {
+      return false;
+    }
+
+    last = residue->limit;
+  }
+
+  return true;
+}
+
+
+/*
+ * cache_read: load a structure from the cache of an input file and print
+ *             the messages of the original read
+ *
+ * in:  input file name, name for CYS residues in disulfide bond, chosen
+ *      model number, counter for S-S bonds
+ * out: pdb root structure or NULL if there is no valid cache
+ *
+ */
+
+pdb_root *cache_read(const char *filename, const char *ss_name, int model_no,
+		     int *nssb)
+{
+  int fd;
+  uint64_t i, src_size, off_log;
+
+  bool ok = true;
+
+  char *name, *image;
+
+  cache_header hdr, want;
+
+  pdb_root *pdb, *roots, *r;
+  pdb_ssbond **ssptrs;
+
+  struct stat st;
+
+
+  name = cache_name(filename);
+  fd = open(name, O_RDONLY);
+
+  if (fd < 0) {
+    free(name);
+    return NULL;
+  }
+
+  cache_setup(&want, ss_name, model_no);
+
+  /* cheap checks first, the hash requires reading the whole input file */
+  if (fstat(fd, &st) < 0 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      memcmp(hdr.magic, want.magic, sizeof(hdr.magic)) ||
+      hdr.version != want.version || hdr.byte_order != want.byte_order ||
+      memcmp(hdr.layout, want.layout, sizeof(hdr.layout)) ||
+      hdr.flags != want.flags || hdr.model_no != want.model_no ||
+      !STRNEQ(hdr.ss_name, want.ss_name, PDB_RES_NAME_LEN) ||
+      hdr.size != (uint64_t) st.st_size || hdr.nmodels == 0 ||
+      hdr.nmodels > hdr.size / sizeof(pdb_root) ||
+      hdr.nssptrs > hdr.size / sizeof(pdb_ssbond *) ||
+      hdr.nssbonds > hdr.size / sizeof(pdb_ssbond) ||
+      hdr.nlog > hdr.size || CACHE_ALIGN(hdr.nlog) > hdr.size ||
+      hdr.src_hash != cache_hash(filename, &src_size) ||
+      hdr.src_size != src_size) {
+    close(fd);
+    free(name);
+    return NULL;
+  }
+
+  image = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (image == MAP_FAILED) {
+    free(name);
+    return NULL;
+  }
+
+  off_log = hdr.size - CACHE_ALIGN(hdr.nlog);
+  roots = (pdb_root *) (image + CACHE_ALIGN(sizeof(hdr)) );
+  ssptrs = (pdb_ssbond **) (image + off_log -
+			    CACHE_ALIGN(hdr.nssbonds * sizeof(pdb_ssbond)) -
+			    CACHE_ALIGN(hdr.nssptrs * sizeof(pdb_ssbond *)) );
+
+  /* the tables hold indices, only the roots need fixing */
+  for (i = 0; ok && i < hdr.nmodels; i++) {
+    r = &roots[i];
+
+    ok = FIX(r->next_model, 1) && FIX(r->ssbonds, 1) &&
+      FIX(r->chains, r->nchains) && FIX(r->residues, r->nres) &&
+      FIX(r->atoms.x, r->atoms.used) && FIX(r->atoms.y, r->atoms.used) &&
+      FIX(r->atoms.z, r->atoms.used) &&
+      FIX(r->atoms.occupancy, r->atoms.used) &&
+      FIX(r->atoms.tempFactor, r->atoms.used) &&
+      FIX(r->atoms.info, r->atoms.used) && cache_check_model(r);
+
+    /* tables within the mapping are copied before they are resized */
+    r->cache = image;
+    r->cache_size = hdr.size;
+  }
+
+  for (i = 0; ok && i < hdr.nssptrs; i++) {
+    ok = FIX(ssptrs[i], 1);
+  }
+
+  if (!ok) {
+    munmap(image, hdr.size);
+    free(name);
+    return NULL;
+  }
+
+  pdb = roots;
+  *nssb = hdr.nssb;
+
+  prnote("structure read from cache %s\n", name);
+  fwrite(image + off_log, 1, hdr.nlog, prout() );
+
+  free(name);
+
+  return pdb;
+}
+
+#undef FIX
+
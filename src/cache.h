@@ -0,0 +1,15 @@
+/*
+ * Header file for the binary structure cache.
+ *
+ */
+
+
+#ifndef _CACHE_H
+#define _CACHE_H      1
+
+pdb_root *cache_read(const char *filename, const char *ss_name, int model_no,
+		     int *nssb);
+void cache_write(const pdb_root *pdb, const char *filename, const char *ss_name,
+		 int model_no, int nssb, const char *log);
+
+#endif
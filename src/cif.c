@@ -0,0 +1,1096 @@
+/*
+ * Read a file in macromolecular Crystallographic Information File format
+ * (mmCIF/PDBx, see http://mmcif.wwpdb.org/) into the same structures the PDB
+ * reader fills.  The file is tokenised in a single streaming pass.  The item
+ * names of a loop header are resolved once into a column map for the
+ * categories of interest so that rows are converted without any name lookups.
+ *
+ * _atom_site replaces ATOM/HETATM (author numbering is preferred over label
+ * numbering as the PDB format does), disulfides in _struct_conn replace
+ * SSBOND and _cell/_symmetry replace CRYST1.  Only the first data block is
+ * read.
+ *
+ */
+
+
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "common.h"
+#include "pdb.h"
+#include "cif.h"
+#include "util/util.h"
+#include "util/zio.h"
+
+
+#define CIF_LINE_LEN 1024	/* initial size, grown for longer lines */
+#define CIF_NAME_LEN 80
+#define CIF_SPGRP_LEN 12
+
+#define CIF_NULL(val) (!(val) || \
+		       ( ((val)[0] == '?' || (val)[0] == '.') && !(val)[1]) )
+
+/* fixed-point storage rounds from the decimal value, not from a float */
+#ifdef PDB_FIXED_COORDS
+#define CIF_REAL(val) strtod((val), NULL)
+#else
+#define CIF_REAL(val) strtof((val), NULL)
+#endif
+
+
+typedef enum {
+  CIF_EOF, CIF_DATA, CIF_LOOP, CIF_TAG, CIF_VALUE
+} cif_token;
+
+typedef struct _cif_input {
+  void *stream;
+  const char *filename;
+  char *line;
+  size_t size;
+  char *pos;			/* next unread character, NULL: need line */
+  int line_cnt;
+  char *text;			/* current ;-delimited text field */
+  size_t text_size;
+  cif_token pushback;		/* token returned again by next call */
+  char *pushback_tok;
+} cif_input;
+
+typedef struct _cif_reader cif_reader;
+
+typedef struct _cif_category {
+  const char *name;
+  const char *const *items;
+  unsigned int nitems;
+  void (*row)(cif_reader *r, char **val);
+} cif_category;
+
+typedef struct _cif_table {	/* a loop or the items of one category */
+  char name[CIF_NAME_LEN];
+  const cif_category *cat;	/* NULL if of no interest */
+  bool loop;			/* else single items, one row */
+  unsigned int ncols;
+  int *map;			/* category item -> column */
+  char **val;			/* category item -> value of current row */
+  size_t *offset;		/* column -> value offset in buf */
+  char *buf;
+  size_t buf_size, buf_used;
+  unsigned int nvals;
+  unsigned int max_cols;
+} cif_table;
+
+struct _cif_reader {
+  const char *filename;
+  pdb_builder *builder;
+  pdb_root *pdb;
+  int model_no;
+  int curr_model;
+  unsigned int nmodels;
+  bool chain_warned;
+  char asym[CIF_NAME_LEN];
+  bool cell_found;
+  float cell[6];
+  int z;
+  char spgrp[CIF_SPGRP_LEN];
+};
+
+
+
+/*
+ * cif_getline: read the next complete line of any length
+ *
+ * in:  input
+ * out: false on end of file
+ *
+ */
+
+static bool cif_getline(cif_input *in)
+{
+  size_t len = 0;
+
+
+  for (;;) {
+    if (!fzgets(in->stream, in->line + len, (int) (in->size - len)) ) {
+      if (len == 0) {
+	return false;
+      }
+
+      break;
+    }
+
+    len += strlen(in->line + len);
+
+    if (in->line[len-1] == '\n' || len < in->size - 1) {
+      break;
+    }
+
+    in->size *= 2;
+    in->line = reallocate(in->line, in->size);
+  }
+
+  in->line_cnt++;
+  in->pos = in->line;
+
+  return true;
+}
+
+
+/*
+ * cif_text: collect a ;-delimited text field, the opening line has just been
+ *           read
+ *
+ * in:  input, pointer to token
+ * out: value token
+ *
+ */
+
+static cif_token cif_text(cif_input *in, char **tok)
+{
+  size_t len, used = 0;
+
+  char *p = in->line + 1;
+  int start = in->line_cnt;
+
+
+  for (;;) {
+    len = strlen(p);
+
+    if (used + len + 1 > in->text_size) {
+      in->text_size = 2 * (used + len + 1);
+      in->text = reallocate(in->text, in->text_size);
+    }
+
+    memcpy(in->text + used, p, len + 1);
+    used += len;
+
+    if (!cif_getline(in) ) {
+      prerror(2, "%s: unterminated text field starting in line %d.\n",
+	      in->filename, start);
+    }
+
+    if (in->line[0] == ';') {
+      break;
+    }
+
+    p = in->line;
+  }
+
+  /* the final newline belongs to the delimiter */
+  if (used > 0 && in->text[used-1] == '\n') {
+    in->text[--used] = '\0';
+  }
+
+  in->pos = in->line + 1;
+  *tok = in->text;
+
+  return CIF_VALUE;
+}
+
+
+/*
+ * cif_next: split the input into tokens, values are \0-terminated in place
+ *           and stay valid until the next call
+ *
+ * in:  input, pointer to token
+ * out: token type
+ *
+ */
+
+static cif_token cif_next(cif_input *in, char **tok)
+{
+  char quote;
+  char *p, *q;
+
+  cif_token type;
+
+
+  if (in->pushback != CIF_EOF) {
+    type = in->pushback;
+    *tok = in->pushback_tok;
+    in->pushback = CIF_EOF;
+
+    return type;
+  }
+
+  for (;;) {
+    if (!in->pos) {
+      if (!cif_getline(in) ) {
+	return CIF_EOF;
+      }
+
+      if (in->line[0] == ';') {
+	return cif_text(in, tok);
+      }
+    }
+
+    p = in->pos + strspn(in->pos, " \t\r\n");
+
+    if (*p == '\0' || *p == '#') {
+      in->pos = NULL;
+      continue;
+    }
+
+    break;
+  }
+
+  if (*p == '\'' || *p == '"') {
+    quote = *p++;
+
+    /* a quote only closes if followed by white-space */
+    for (q = p; (q = strchr(q, quote)) &&
+	   q[1] && !isspace((unsigned char) q[1]); q++)
+      ;
+
+    if (!q) {
+      prerror(2, "%s: unterminated quoted string in line %d.\n",
+	      in->filename, in->line_cnt);
+    }
+
+    *q = '\0';
+    in->pos = q + 1;
+    *tok = p;
+
+    return CIF_VALUE;
+  }
+
+  q = p + strcspn(p, " \t\r\n");
+
+  if (*q) {
+    *q++ = '\0';
+  }
+
+  in->pos = q;
+  *tok = p;
+
+  if (*p == '_') {
+    return CIF_TAG;
+  } else if (!strncasecmp(p, "loop_", 5) ) {
+    return CIF_LOOP;
+  } else if (!strncasecmp(p, "data_", 5) || !strncasecmp(p, "save_", 5) ||
+	     !strncasecmp(p, "global_", 7) ) {
+    return CIF_DATA;
+  }
+
+  return CIF_VALUE;
+}
+
+
+/*
+ * cif_strip: copy a value with surrounding white-space removed
+ *
+ * in:  destination, size of destination, value
+ * out: destination
+ *
+ */
+
+static char *cif_strip(char *dest, size_t size, const char *val)
+{
+  size_t len;
+
+
+  val += strspn(val, " \t\r\n");
+  len = strlen(val);
+
+  while (len > 0 && isspace((unsigned char) val[len-1]) ) {
+    len--;
+  }
+
+  if (len > size - 1) {
+    len = size - 1;
+  }
+
+  memcpy(dest, val, len);
+  dest[len] = '\0';
+
+  return dest;
+}
+
+
+/*
+ * cif_format_atom: format an atom name for the PDB columns 13-16, names
+ *                  starting with a two letter element symbol start in
+ *                  column 13
+ *
+ * in:  destination, atom name, element symbol
+ * out: false if the name is too long
+ *
+ */
+
+static bool cif_format_atom(char *dest, const char *name, const char *element)
+{
+  size_t len;
+
+
+  len = strlen(name);
+
+  if (len > PDB_ATOM_NAME_LEN-1) {
+    return false;
+  }
+
+  if (len == PDB_ATOM_NAME_LEN-1 ||
+      (element[0] != ' ' && !strncasecmp(name, element, 2) ) ) {
+    sprintf(dest, "%-4s", name);
+  } else {
+    sprintf(dest, " %-3s", name);
+  }
+
+  return true;
+}
+
+
+
+/* the order of items must match the enums */
+
+enum {
+  AS_GROUP, AS_ID, AS_TYPE_SYMBOL, AS_AUTH_ATOM, AS_LABEL_ATOM, AS_ALT,
+  AS_AUTH_COMP, AS_LABEL_COMP, AS_AUTH_ASYM, AS_LABEL_ASYM, AS_AUTH_SEQ,
+  AS_LABEL_SEQ, AS_INS_CODE, AS_X, AS_Y, AS_Z, AS_OCC, AS_B, AS_CHARGE,
+  AS_MODEL
+};
+
+static const char *const atom_site_items[] = {
+  "group_PDB", "id", "type_symbol", "auth_atom_id", "label_atom_id",
+  "label_alt_id", "auth_comp_id", "label_comp_id", "auth_asym_id",
+  "label_asym_id", "auth_seq_id", "label_seq_id", "pdbx_PDB_ins_code",
+  "Cartn_x", "Cartn_y", "Cartn_z", "occupancy", "B_iso_or_equiv",
+  "pdbx_formal_charge", "pdbx_PDB_model_num"
+};
+
+enum {
+  SC_TYPE, SC_AUTH_ASYM1, SC_LABEL_ASYM1, SC_AUTH_SEQ1, SC_LABEL_SEQ1,
+  SC_INS_CODE1, SC_SYMMETRY1, SC_AUTH_ASYM2, SC_LABEL_ASYM2, SC_AUTH_SEQ2,
+  SC_LABEL_SEQ2, SC_INS_CODE2, SC_SYMMETRY2, SC_DIST
+};
+
+static const char *const struct_conn_items[] = {
+  "conn_type_id", "ptnr1_auth_asym_id", "ptnr1_label_asym_id",
+  "ptnr1_auth_seq_id", "ptnr1_label_seq_id", "pdbx_ptnr1_PDB_ins_code",
+  "ptnr1_symmetry", "ptnr2_auth_asym_id", "ptnr2_label_asym_id",
+  "ptnr2_auth_seq_id", "ptnr2_label_seq_id", "pdbx_ptnr2_PDB_ins_code",
+  "ptnr2_symmetry", "pdbx_dist_value"
+};
+
+static const char *const cell_items[] = {
+  "length_a", "length_b", "length_c", "angle_alpha", "angle_beta",
+  "angle_gamma", "Z_PDB"
+};
+
+static const char *const symmetry_items[] = {"space_group_name_H-M"};
+static const char *const entry_items[] = {"id"};
+static const char *const struct_items[] = {"title"};
+static const char *const exptl_items[] = {"method"};
+static const char *const refine_items[] = {"ls_d_res_high"};
+
+
+/*
+ * cif_atom_site: convert one _atom_site row into an atom record
+ *
+ * in:  reader, values of the category items
+ *
+ */
+
+static void cif_atom_site(cif_reader *r, char **val)
+{
+  int model;
+  size_t len;
+
+  const char *name, *asym, *id;
+
+  pdb_atom_rec rec;
+
+
+  model = CIF_NULL(val[AS_MODEL]) ? 1 : atoi(val[AS_MODEL]);
+
+  if (r->nmodels == 0 || model != r->curr_model) {
+    r->curr_model = model;
+    r->nmodels++;
+
+    /* every row has a model number, 0 cannot mean "no MODEL records" as
+       in PDB files */
+    if (r->model_no <= 0) {
+      r->model_no = model;
+    }
+
+    if (r->model_no == PDB_ALL_MODELS) {
+      pdb_builder_new_model(r->builder, model);
+      r->asym[0] = '\0';
+    }
+  }
+
+  if (r->model_no != PDB_ALL_MODELS && model != r->model_no) {
+    return;
+  }
+
+  rec.rectype = !CIF_NULL(val[AS_GROUP]) &&
+    toupper((unsigned char) val[AS_GROUP][0]) == 'H' ? 'H' : 'A';
+
+  id = CIF_NULL(val[AS_ID]) ? "" : val[AS_ID];
+  len = strlen(id);
+  sprintf(rec.serial, "%5s", len > PDB_SERIAL_LEN-1 ?
+	  id + len - (PDB_SERIAL_LEN-1) : id);
+
+  if (CIF_NULL(val[AS_TYPE_SYMBOL]) ) {
+    strcpy(rec.element, "  ");
+  } else {
+    sprintf(rec.element, "%2.2s", val[AS_TYPE_SYMBOL]);
+    rec.element[0] = toupper((unsigned char) rec.element[0]);
+    rec.element[1] = toupper((unsigned char) rec.element[1]);
+  }
+
+  name = CIF_NULL(val[AS_AUTH_ATOM]) ? val[AS_LABEL_ATOM] : val[AS_AUTH_ATOM];
+
+  if (CIF_NULL(name) || !cif_format_atom(rec.name, name, rec.element) ) {
+    prerror(2, "%s: atom name %s of atom %s cannot be converted.\n",
+	    r->filename, name ? name : "?", id);
+  }
+
+  rec.altLoc = CIF_NULL(val[AS_ALT]) ? ' ' : val[AS_ALT][0];
+
+  name = CIF_NULL(val[AS_AUTH_COMP]) ? val[AS_LABEL_COMP] : val[AS_AUTH_COMP];
+
+  if (CIF_NULL(name) || !pdb_format_residue(rec.resName, name) ) {
+    prerror(2, "%s: residue name %s of atom %s cannot be converted.\n",
+	    r->filename, name ? name : "?", id);
+  }
+
+  asym = CIF_NULL(val[AS_AUTH_ASYM]) ? val[AS_LABEL_ASYM] : val[AS_AUTH_ASYM];
+
+  if (CIF_NULL(asym) ) {
+    asym = " ";
+  }
+
+  /* chain identifiers may be longer than the single PDB character */
+  if (strcmp(asym, r->asym) ) {
+    strncpy(r->asym, asym, CIF_NAME_LEN-1);
+    r->asym[CIF_NAME_LEN-1] = '\0';
+    pdb_builder_break_chain(r->builder);
+
+    if (asym[1] && !r->chain_warned) {
+      prwarn("%s: chain identifier %s shortened to %c\n", r->filename, asym,
+	     asym[0]);
+      r->chain_warned = true;
+    }
+  }
+
+  rec.chainID = asym[0];
+
+  if (!CIF_NULL(val[AS_AUTH_SEQ]) ) {
+    rec.resSeq = atoi(val[AS_AUTH_SEQ]);
+  } else if (!CIF_NULL(val[AS_LABEL_SEQ]) ) {
+    rec.resSeq = atoi(val[AS_LABEL_SEQ]);
+  } else {
+    rec.resSeq = 0;
+  }
+
+  rec.iCode = CIF_NULL(val[AS_INS_CODE]) ? ' ' : val[AS_INS_CODE][0];
+
+  rec.x = CIF_NULL(val[AS_X]) ? 0 : PDB_MAKE_COORD(CIF_REAL(val[AS_X]) );
+  rec.y = CIF_NULL(val[AS_Y]) ? 0 : PDB_MAKE_COORD(CIF_REAL(val[AS_Y]) );
+  rec.z = CIF_NULL(val[AS_Z]) ? 0 : PDB_MAKE_COORD(CIF_REAL(val[AS_Z]) );
+  rec.occupancy = CIF_NULL(val[AS_OCC]) ? 0 :
+    PDB_MAKE_OCC(CIF_REAL(val[AS_OCC]) );
+  rec.tempFactor = CIF_NULL(val[AS_B]) ? 0 :
+    PDB_MAKE_BFAC(CIF_REAL(val[AS_B]) );
+
+  strcpy(rec.segID, "    ");
+
+  if (CIF_NULL(val[AS_CHARGE]) || atoi(val[AS_CHARGE]) == 0) {
+    strcpy(rec.charge, "  ");
+  } else {
+    sprintf(rec.charge, "%1d%c", abs(atoi(val[AS_CHARGE])) % 10,
+	    atoi(val[AS_CHARGE]) > 0 ? '+' : '-');
+  }
+
+  pdb_builder_add_atom(r->builder, &rec);
+}
+
+
+/*
+ * cif_ssbond_partner: fill one partner of a disulfide bond
+ *
+ * in:  partner, author and label chain, author and label sequence number,
+ *      insertion code, symmetry operator
+ *
+ */
+
+static void cif_ssbond_partner(struct _ssbond *ss, const char *auth_asym,
+			       const char *label_asym, const char *auth_seq,
+			       const char *label_seq, const char *icode,
+			       const char *symmetry)
+{
+  char symop[PDB_SSBOND_SYMOP_LEN+1];
+  char *p;
+
+
+  if (CIF_NULL(auth_asym) ) {
+    auth_asym = label_asym;
+  }
+
+  if (CIF_NULL(auth_seq) ) {
+    auth_seq = label_seq;
+  }
+
+  ss->chainID = CIF_NULL(auth_asym) ? ' ' : auth_asym[0];
+  ss->seqNum = CIF_NULL(auth_seq) ? 0 : atoi(auth_seq);
+  ss->icode = CIF_NULL(icode) ? ' ' : icode[0];
+
+  /* "1_555" is written as "  1555" in SSBOND */
+  if (CIF_NULL(symmetry) ) {
+    symmetry = "1_555";
+  }
+
+  cif_strip(symop, sizeof(symop), symmetry);
+
+  if ( (p = strchr(symop, '_')) ) {
+    memmove(p, p + 1, strlen(p) );
+  }
+
+  snprintf(ss->SymOP, PDB_SSBOND_SYMOP_LEN, "%6.6s", symop);
+}
+
+
+/*
+ * cif_struct_conn: take disulfide bonds from _struct_conn
+ *
+ * in:  reader, values of the category items
+ *
+ */
+
+static void cif_struct_conn(cif_reader *r, char **val)
+{
+  unsigned int nss = 0;
+
+  pdb_ssbond ssbond;
+
+
+  if (!options.rssb || CIF_NULL(val[SC_TYPE]) ||
+      strncasecmp(val[SC_TYPE], "disulf", 6) ) {
+    return;
+  }
+
+  if (r->pdb->ssbonds) {
+    while (r->pdb->ssbonds[nss]) {
+      nss++;
+    }
+  }
+
+  ssbond.serNum = nss + 1;
+
+  cif_ssbond_partner(&ssbond.ss1, val[SC_AUTH_ASYM1], val[SC_LABEL_ASYM1],
+		     val[SC_AUTH_SEQ1], val[SC_LABEL_SEQ1], val[SC_INS_CODE1],
+		     val[SC_SYMMETRY1]);
+  cif_ssbond_partner(&ssbond.ss2, val[SC_AUTH_ASYM2], val[SC_LABEL_ASYM2],
+		     val[SC_AUTH_SEQ2], val[SC_LABEL_SEQ2], val[SC_INS_CODE2],
+		     val[SC_SYMMETRY2]);
+
+  ssbond.Length = CIF_NULL(val[SC_DIST]) ? 0.0 : strtof(val[SC_DIST], NULL);
+
+  pdb_add_ssbond(r->pdb, &ssbond);
+}
+
+
+/*
+ * cif_cell, cif_symmetry, cif_entry, cif_struct, cif_exptl, cif_refine:
+ *   single item categories for CRYST1, the ID and notes as from the PDB title
+ *   section
+ *
+ * in:  reader, values of the category items
+ *
+ */
+
+static void cif_cell(cif_reader *r, char **val)
+{
+  int i;
+
+
+  for (i = 0; i < 6; i++) {
+    if (CIF_NULL(val[i]) ) {
+      return;
+    }
+
+    r->cell[i] = strtof(val[i], NULL);
+  }
+
+  r->z = CIF_NULL(val[6]) ? 1 : atoi(val[6]);
+  r->cell_found = true;
+}
+
+
+static void cif_symmetry(cif_reader *r, char **val)
+{
+  if (!CIF_NULL(val[0]) ) {
+    cif_strip(r->spgrp, CIF_SPGRP_LEN, val[0]);
+  }
+}
+
+
+static void cif_entry(cif_reader *r, char **val)
+{
+  if (!CIF_NULL(val[0]) ) {
+    cif_strip(r->pdb->ID, PDB_ID_LEN, val[0]);
+  }
+}
+
+
+static void cif_struct(cif_reader *r, char **val)
+{
+  char title[PDB_LINE_LEN];
+  char *p;
+
+
+  if (!CIF_NULL(val[0]) ) {
+    cif_strip(title, PDB_LINE_LEN, val[0]);
+
+    for (p = title; (p = strchr(p, '\n')); ) {
+      *p = ' ';
+    }
+
+    prnote("title of %s\n   %s\n", r->filename, title);
+  }
+}
+
+
+static void cif_exptl(cif_reader *r, char **val)
+{
+  char method[PDB_LINE_LEN];
+
+
+  (void) r;
+
+  if (!CIF_NULL(val[0]) ) {
+    prnote("PDB reports experiment type as %s\n",
+	   cif_strip(method, PDB_LINE_LEN, val[0]) );
+  }
+}
+
+
+static void cif_refine(cif_reader *r, char **val)
+{
+  (void) r;
+
+  if (!CIF_NULL(val[0]) ) {
+    prnote("PDB resolution is %.2f\n", strtof(val[0], NULL) );
+  }
+}
+
+
+#define CAT(name, items, func) \
+  {name, items, sizeof(items) / sizeof(items[0]), func}
+
+static const cif_category categories[] = {
+  CAT("_atom_site", atom_site_items, cif_atom_site),
+  CAT("_struct_conn", struct_conn_items, cif_struct_conn),
+  CAT("_cell", cell_items, cif_cell),
+  CAT("_symmetry", symmetry_items, cif_symmetry),
+  CAT("_entry", entry_items, cif_entry),
+  CAT("_struct", struct_items, cif_struct),
+  CAT("_exptl", exptl_items, cif_exptl),
+  CAT("_refine", refine_items, cif_refine)
+};
+
+#undef CAT
+
+
+/*
+ * table_start: begin a table of a new category
+ *
+ * in:  table, tag of the first item, if a loop
+ *
+ */
+
+static void table_start(cif_table *t, const char *tag, bool loop)
+{
+  size_t i, len;
+
+
+  len = strcspn(tag, ".");
+
+  if (len > CIF_NAME_LEN-1) {
+    len = CIF_NAME_LEN-1;
+  }
+
+  memcpy(t->name, tag, len);
+  t->name[len] = '\0';
+
+  t->cat = NULL;
+
+  for (i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+    if (!strcasecmp(t->name, categories[i].name) ) {
+      t->cat = &categories[i];
+      break;
+    }
+  }
+
+  if (t->cat) {
+    for (i = 0; i < t->cat->nitems; i++) {
+      t->map[i] = -1;
+    }
+  }
+
+  t->loop = loop;
+  t->ncols = 0;
+  t->nvals = 0;
+  t->buf_used = 0;
+}
+
+
+/*
+ * table_same: check if a tag belongs to the category of the table
+ *
+ * in:  table, tag
+ * out: true if same category
+ *
+ */
+
+static bool table_same(const cif_table *t, const char *tag)
+{
+  size_t len = strlen(t->name);
+
+  return !strncasecmp(tag, t->name, len) && tag[len] == '.';
+}
+
+
+/*
+ * table_add_column: add an item to the table and resolve it against the
+ *                   items of the category
+ *
+ * in:  table, tag
+ *
+ */
+
+static void table_add_column(cif_table *t, const char *tag)
+{
+  unsigned int i;
+
+  const char *item;
+
+
+  if (t->ncols == t->max_cols) {
+    t->max_cols *= 2;
+    t->offset = reallocate(t->offset, t->max_cols * sizeof(*t->offset) );
+  }
+
+  if (t->cat) {
+    item = tag + strlen(t->name) + 1;
+
+    for (i = 0; i < t->cat->nitems; i++) {
+      if (!strcasecmp(item, t->cat->items[i]) ) {
+	t->map[i] = t->ncols;
+	break;
+      }
+    }
+  }
+
+  t->ncols++;
+}
+
+
+/*
+ * table_row: hand the current row over to the category
+ *
+ * in:  reader, table
+ *
+ */
+
+static void table_row(cif_reader *r, cif_table *t)
+{
+  unsigned int i;
+
+
+  if (t->cat) {
+    for (i = 0; i < t->cat->nitems; i++) {
+      t->val[i] = t->map[i] < 0 ? NULL : t->buf + t->offset[t->map[i]];
+    }
+
+    t->cat->row(r, t->val);
+  }
+
+  t->nvals = 0;
+  t->buf_used = 0;
+}
+
+
+/*
+ * table_add_value: store a value of the current row, a complete loop row is
+ *                  handed over to the category
+ *
+ * in:  reader, table, value
+ *
+ */
+
+static void table_add_value(cif_reader *r, cif_table *t, const char *tok)
+{
+  size_t len;
+
+
+  if (t->cat) {
+    len = strlen(tok) + 1;
+
+    if (t->buf_used + len > t->buf_size) {
+      t->buf_size = 2 * (t->buf_used + len);
+      t->buf = reallocate(t->buf, t->buf_size);
+    }
+
+    memcpy(t->buf + t->buf_used, tok, len);
+    t->offset[t->nvals] = t->buf_used;
+    t->buf_used += len;
+  }
+
+  if (++t->nvals == t->ncols && t->loop) {
+    table_row(r, t);
+  }
+}
+
+
+/*
+ * table_end: finish a table, the last row must be complete
+ *
+ * in:  input, reader, table
+ *
+ */
+
+static void table_end(cif_input *in, cif_reader *r, cif_table *t)
+{
+  if (!t->loop && t->nvals == t->ncols) {
+    table_row(r, t);
+  } else if (t->nvals > 0) {
+    prwarn("%s: incomplete row of %s ignored (line %d)\n", in->filename,
+	   t->name, in->line_cnt);
+  }
+
+  t->name[0] = '\0';
+  t->ncols = t->nvals = 0;
+  t->buf_used = 0;
+}
+
+
+/*
+ * is_cif_file: check if a file name has an mmCIF extension, possibly
+ *              followed by a compression suffix
+ *
+ * in:  file name
+ * out: true if mmCIF
+ *
+ */
+
+bool is_cif_file(const char *filename)
+{
+  static const char *const zsuffix[] = {".gz", ".bz2", ".xz", ".lzma", ".zst"};
+
+  size_t i, len, slen;
+
+
+  len = strlen(filename);
+
+  for (i = 0; i < sizeof(zsuffix) / sizeof(zsuffix[0]); i++) {
+    slen = strlen(zsuffix[i]);
+
+    if (len > slen && !strcasecmp(filename + len - slen, zsuffix[i]) ) {
+      len -= slen;
+      break;
+    }
+  }
+
+  return (len > 4 && !strncasecmp(filename + len - 4, ".cif", 4) ) ||
+    (len > 6 && !strncasecmp(filename + len - 6, ".mmcif", 6) );
+}
+
+
+/*
+ * cif_read: read atoms, disulfide bonds and the unit cell from an mmCIF file
+ *
+ * in:  pdb structure, mmCIF file name, name for CYS residues in disulfide
+ *      bond, chosen model number (the first one if not positive), counter
+ *      for S-S bonds
+ * out: pdb root structure
+ *
+ */
+
+pdb_root *cif_read(pdb_root *pdb, const char *filename, const char *ss_name,
+		   int model_no, int *nssb)
+{
+  unsigned int i, max_items = 0;
+  int nblocks = 0;
+
+  bool in_loop = false;
+
+  char *tok;
+
+  cif_token type;
+  cif_input in;
+  cif_table table;
+  cif_reader reader;
+
+  pdb_root *model;
+
+
+  if (!(in.stream = fzopen(filename, "r")) ) {
+    prerror(2, "Cannot open mmCIF file %s for reading.\n", filename);
+  }
+
+  in.filename = filename;
+  in.size = CIF_LINE_LEN;
+  in.line = allocate(in.size);
+  in.pos = NULL;
+  in.line_cnt = 0;
+  in.text = NULL;
+  in.text_size = 0;
+  in.pushback = CIF_EOF;
+
+  for (i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+    if (categories[i].nitems > max_items) {
+      max_items = categories[i].nitems;
+    }
+  }
+
+  table.name[0] = '\0';
+  table.cat = NULL;
+  table.loop = false;
+  table.ncols = table.nvals = 0;
+  table.max_cols = 32;
+  table.map = allocate(max_items * sizeof(*table.map) );
+  table.val = allocate(max_items * sizeof(*table.val) );
+  table.offset = allocate(table.max_cols * sizeof(*table.offset) );
+  table.buf_size = CIF_LINE_LEN;
+  table.buf = allocate(table.buf_size);
+  table.buf_used = 0;
+
+  reader.filename = filename;
+  reader.builder = pdb_builder_create(ss_name);
+  reader.pdb = pdb = pdb_builder_root(reader.builder);
+  reader.model_no = model_no;
+  reader.curr_model = 0;
+  reader.nmodels = 0;
+  reader.chain_warned = false;
+  reader.asym[0] = '\0';
+  reader.cell_found = false;
+  reader.z = 1;
+  strcpy(reader.spgrp, "P 1");
+
+  while ( (type = cif_next(&in, &tok)) != CIF_EOF) {
+    /* values continue a loop, anything else ends it */
+    if (in_loop) {
+      if (type == CIF_VALUE) {
+	table_add_value(&reader, &table, tok);
+	continue;
+      }
+
+      table_end(&in, &reader, &table);
+      in_loop = false;
+    }
+
+    switch (type) {
+    case CIF_DATA:
+      if (table.ncols > 0) {
+	table_end(&in, &reader, &table);
+      }
+
+      if (++nblocks > 1) {
+	prwarn("%s: only the first data block is read\n", filename);
+	goto done;
+      }
+
+      break;
+
+    case CIF_LOOP:
+      if (table.ncols > 0) {
+	table_end(&in, &reader, &table);
+      }
+
+      type = cif_next(&in, &tok);
+
+      if (type != CIF_TAG) {
+	prerror(2, "%s: loop_ without items in line %d.\n", filename,
+		in.line_cnt);
+      }
+
+      table_start(&table, tok, true);
+
+      do {
+	if (!table_same(&table, tok) ) {
+	  prerror(2, "%s: loop_ mixes categories in line %d.\n", filename,
+		  in.line_cnt);
+	}
+
+	table_add_column(&table, tok);
+      } while ( (type = cif_next(&in, &tok)) == CIF_TAG);
+
+      in.pushback = type;
+      in.pushback_tok = tok;
+      in_loop = true;
+
+      break;
+
+    case CIF_TAG:
+      /* single items of a category are collected into a one row table */
+      if (table.ncols > 0 && !table_same(&table, tok) ) {
+	table_end(&in, &reader, &table);
+      }
+
+      if (table.ncols == 0) {
+	table_start(&table, tok, false);
+      }
+
+      table_add_column(&table, tok);
+
+      if (cif_next(&in, &tok) != CIF_VALUE) {
+	prerror(2, "%s: item without value in line %d.\n", filename,
+		in.line_cnt);
+      }
+
+      table_add_value(&reader, &table, tok);
+
+      break;
+
+    default:
+      prwarn("%s: stray value %s ignored (line %d)\n", filename, tok,
+	     in.line_cnt);
+    }
+  }
+
+  if (table.ncols > 0) {
+    table_end(&in, &reader, &table);
+  }
+
+ done:
+  fzclose(in.stream);
+
+  free(in.line);
+  free(in.text);
+  free(table.map);
+  free(table.val);
+  free(table.offset);
+  free(table.buf);
+
+  if (pdb->nchains == 0) {
+    prerror(2, "\n%d lines read but no atoms extracted from %s.\n",
+	    in.line_cnt, filename);
+  }
+
+  /* like PDB files without MODEL records */
+  if (reader.nmodels <= 1) {
+    for (model = pdb; model; model = model->next_model) {
+      model->model_no = 0;
+    }
+  } else if (reader.model_no != PDB_ALL_MODELS) {
+    pdb->model_no = reader.model_no;
+  }
+
+  if (reader.cell_found) {
+    snprintf(pdb->cryst1, PDB_LINE_LEN,
+	     "CRYST1%9.3f%9.3f%9.3f%7.2f%7.2f%7.2f %-11s%4d%10s",
+	     reader.cell[0], reader.cell[1], reader.cell[2], reader.cell[3],
+	     reader.cell[4], reader.cell[5], reader.spgrp, reader.z, "");
+  }
+
+  pdb = pdb_builder_finish(reader.builder, nssb);
+  pdb_summary(pdb);
+
+  return pdb;
+}
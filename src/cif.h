@@ -0,0 +1,16 @@
+/*
+ * Header file for the mmCIF/PDBx reader.
+ *
+ */
+
+
+#ifndef _CIF_H
+#define _CIF_H      1
+
+#include <stdbool.h>
+
+bool is_cif_file(const char *filename);
+pdb_root *cif_read(pdb_root *pdb, const char *filename, const char* ss_name,
+		   int model_no, int *nssb);
+
+#endif
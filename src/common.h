@@ -31,7 +31,8 @@ void dbgprintf(const char *funcname, const char *filename, unsigned int lineno,
 /* global structure to hold the option flags */
 extern struct opt_flags {
   bool remh, nomodel, nocryst, noter, noend, prot, rssb, wrss, keepssn,
-    keepser, nterm, cterm, dna5term, dna3term, rna5term, rna3term, warnocc;
+    keepser, nterm, cterm, dna5term, dna3term, rna5term, rna3term, warnocc,
+    midx, cache;
 } options;
 
 #endif
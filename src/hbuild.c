@@ -21,55 +21,78 @@
 #include "common.h"
 #include "pdb.h"
 #include "top.h"
-#include "util/hashtab.h"
-#include "util/stack.h"
+#include "hplace.h"
+#include "util/arena.h"
 #include "util/queue.h"
 #include "util/util.h"
+#include "util/parallel.h"
 
 
 #define MAX_XHDIST 1.5		/* "generous" X-H distance squared */
-#define ISHYD(e) ( ( (e)[0] ) == ' ' && ( (e)[1] ) == 'H' )
-
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-/* pre-calculated value for calculation of H positions */
-#define SIN_tetra 0.9428090415820634       /* sin(109.47) */
-#define COS_tetra -0.3333333333333333      /* cos(109.47) */
-#define SIN_tetra_h 0.8164965809277260     /* sin(109.47 / 2) */
-#define COS_tetra_h 0.5773502691896257     /* cos(109.47 / 2) */
-#define SIN_tetra_05 0.4714045207910317	   /* sin(109.47) * 0.5 */
-#define SIN_120 0.8660254037844387         /* sin(120) */
-#define COS_120 -0.5		           /* cos(120) */
-
-// _very_ arbitrary pre-calculated values for spherical coordinates for H2O
-// theta1 = 50 deg, theta2 = 50 + 104.52 deg, phi = 70 deg
-#define SIN_theta1 0.76604444311897803520
-#define SIN_theta2 0.43019600888661864331
-#define COS_phi 0.34202014332566873305
-#define SIN_phi 0.93969262078590838405
-#define COS_theta1 0.64278760968653932632
-#define COS_theta2 0.90273550608028281612
+#define SCRATCH_SIZE 4096	/* per residue scratch space */
+#define BATCH_SIZE 512		/* placements queued per bonding type */
+#define BLOCKS_PER_THREAD 4	/* residue blocks per thread for balance */
+#define BLOCK_MIN_RES 256	/* fewest residues worth a block */
+#define GRID_MIN_ATOMS 48	/* smaller residues are searched directly */
+#define XH_CELL 1.25f		/* not below the bond length sqrt(MAX_XHDIST) */
+#define GRID_CELLS_PER_ATOM 4	/* grid size limit for sparse residues */
+
+enum water_state {		/* what a residue is to the solvent fast path */
+  WATER_NONE,			/* not a water or not a simple one */
+  WATER_BARE,			/* just the oxygen */
+  WATER_COMPLETE		/* oxygen and all its hydrogens */
+};
+
+struct _hbuild_job {
+  pdb_root **models;
+  const pdb_root **refs;
+};
+
+/* what is known of each residue before any hydrogen is added */
+struct _hbuild_map {
+  unsigned int *first;		/* first entry of a residue in atom_slot */
+  int *atom_slot;		/* plan slot of each atom or -1 */
+  unsigned int *first_halo;	/* first entry of a residue in halo_pos */
+  fvec *halo_pos;		/* control atoms in the previous residue */
+  bool *halo_found;
+  unsigned int *nfree;		/* hydrogens at most added */
+};
+
+struct _hbuild_block {		/* consecutive residues built by one thread */
+  unsigned int begin, end;
+  int natoms;			/* change in the number of atoms */
+  Queue *warn;			/* residues not in the topology */
+};
+
+struct _hbuild_blocks {
+  pdb_root *pdb;
+  const pdb_root *ref;
+  struct _hbuild_map map;
+  struct _hbuild_block *blocks;
+};
 
 
 
 /*
  * fill_atom: fill records of a PDB atom entry
  *
- * in:  atom node, record type, atom name, coordinates
+ * in:  atom store, slot, atom name and its code
  *
  */
 
-static void fill_atom(pdb_atom *at, const char *atom0, const fvec pos)
+static void fill_atom(pdb_atoms *atoms, unsigned int idx, const char *atom0,
+		      uint32_t code)
 {
-  strncpy(at->name, atom0, PDB_ATOM_NAME_LEN-1);
-  at->name[PDB_ATOM_NAME_LEN-1] = '\0';
+  pdb_atom *at = &atoms->info[idx];
+
+
+  at->serial[0] = '\0';
+  memcpy(at->name, atom0, PDB_ATOM_NAME_LEN);
+  at->code = code;
 
   at->altLoc = ' ';
-  vecCopy(at->pos, pos);
-  at->occupancy = 1.0;
-  at->tempFactor = 0.0;
+  atoms->occupancy[idx] = PDB_MAKE_OCC(1.0);
+  atoms->tempFactor[idx] = PDB_MAKE_BFAC(0.0);
 
   strcpy(at->element, " H");
   strcpy(at->charge, "  ");
@@ -77,541 +100,1086 @@ static void fill_atom(pdb_atom *at, const char *atom0, const fvec pos)
 
 
 /*
- * format_atom_name: append number to PDB atom name
+ * res_check: check if a residue has all heavy atoms as per topology database
  *
- * in:  name from top (assumed to be PDB_ATOM_NAME_LEN chars long),
- *      character (number) to be added to name
- * out: formatted name
+ * in:  atom store, chain, reside, topology entry, scratch arena
  *
  */
 
-static char *format_atom_name(char *name, char c)
+static void res_check(const pdb_atoms *atoms, const pdb_chain *chain,
+		      const pdb_residue *residue, const topol *entry,
+		      Arena *scratch)
 {
+  unsigned int a, h, j, nheavy = 0, nmissing = 0;
+  unsigned int n_bb_found = 0, n_CB_found = 0;
+
+  bool found = false;
+
+  uint32_t heavy;
+  unsigned int *missing;
+
+  /* FIXME: we should not hardcode this... */
+  static const uint32_t backbone[] = {
+    PDB_NAME_CODE(' ', 'C', 'A', ' '), PDB_NAME_CODE(' ', 'N', ' ', ' '),
+    PDB_NAME_CODE(' ', 'C', ' ', ' '), PDB_NAME_CODE(' ', 'O', ' ', ' ')
+  };
 
-  if (name[3] != ' ') {
-    for (unsigned int i = 0; i < 3; i++) {
-      name[i] = name[i+1];
+  const pdb_atom *atom;
+
+
+
+  while (entry->heavy_codes[nheavy]) {
+    nheavy++;
+  }
+
+  missing = arena_alloc(scratch, nheavy * sizeof(*missing));
+
+  for (h = 0; h < nheavy; h++) {
+    heavy = entry->heavy_codes[h];
+
+    for (a = residue->begin; a < residue->end; a++) {
+      atom = &atoms->info[a];
+      found = false;
+
+      if (atom->code == heavy) {
+        found = true;
+
+        /* FIXME: since we do the check for backbone atoms here we could skip
+           bb entries in the HEAVY records of the topology database */
+        if (entry->mol_type == 'P') {
+          for (unsigned int i = 0; i < 4; i++) {
+            if (heavy == backbone[i]) {
+              n_bb_found++;
+            }
+          }
+
+          if (heavy == PDB_NAME_CODE(' ', 'C', 'B', ' ') ) {
+            n_CB_found++;
+          }
+        }
+
+        break;
+      }
     }
 
-    name[3] = ' ';
+    if (!found) {
+      for (j = 0; j < nmissing; j++) {
+	if (entry->heavy_codes[missing[j]] == heavy) {
+	  break;
+	}
+      }
+
+      if (j == nmissing) {
+	missing[nmissing++] = h;
+      }
+    }
   }
 
-  if (name[2] == ' ') {
-    name[2] = c;
-  } else if (name[3] == ' ') {
-    name[3] = c;
+  if (nmissing > 0) {
+    prwarn("atoms not found in residue %s %d%c %c: ",
+	   residue->resName, residue->resSeq, residue->iCode, chain->chainID);
+
+    /* latest first */
+    while (nmissing > 0) {
+      fprintf(prout(), " %s", entry->heavy_atoms[missing[--nmissing]]);
+    }
+
+    fprintf(prout(), "\n");
   }
+}
+
+
+/*
+ * map_slots: assign the heavy atoms of a residue to the slots of a build plan
+ *
+ * in:  atom store, residue, slot codes, number of slots, slot of each atom
+ *      to be filled, -1 for hydrogens and atoms not in the plan
+ *
+ */
+
+static void map_slots(const pdb_atoms *atoms, const pdb_residue *residue,
+		      const uint32_t *codes, unsigned int nslots,
+		      int *atom_slot)
+{
+  unsigned int a, s;
+
+
+  for (a = residue->begin; a < residue->end; a++) {
+    atom_slot[a - residue->begin] = -1;
 
-  return name;
+    if (ISHYD(atoms->info[a].element) )
+      continue;
+
+    for (s = 0; s < nslots && codes[s] != atoms->info[a].code; s++)
+      ;
+
+    if (s < nslots) {
+      atom_slot[a - residue->begin] = s;
+    }
+  }
 }
 
 
 /*
- * vec_helper: simple helper function for some needed vectors
+ * slot_positions: positions of the slots of a residue, the first atom with
+ *                 a slot's name counts
  *
- * in:  vectors
+ * in:  atom store, residue, slot of each atom, positions and flags to be
+ *      filled
  *
  */
 
-static void vec_helper(fvec v1, fvec v2, fvec v3,
-		       const fvec atom0, const fvec ctrl0, const fvec ctrl1)
+static void slot_positions(const pdb_atoms *atoms, const pdb_residue *residue,
+			   const int *atom_slot, fvec *pos, bool *found)
 {
-  vecSub(v1, atom0, ctrl0);
-  vecSub(v3, ctrl0, ctrl1);
-  vecCrossProd(v2, v1, v3);
+  int s;
+
 
-  vecScalarDiv(v1, v1, vecLen(v1));
-  vecScalarDiv(v2, v2, vecLen(v2));
-  vecCrossProd(v3, v2, v1);
+  for (unsigned int a = residue->begin; a < residue->end; a++) {
+    s = atom_slot[a - residue->begin];
+
+    if (s >= 0 && !found[s]) {
+      PDB_ATOM_POS(atoms, a, pos[s]);
+      found[s] = true;
+    }
+  }
 }
 
 
 /*
- * res_check: check if a residue has all heavy atoms as per topology database
+ * shadow_positions: positions of the slots whose first heavy atom in file
+ *                   order belongs to a conformer pdb_select_altloc dropped,
+ *                   to be filled before slot_positions so they come first
  *
- * in:  chain, reside, topology entry
+ * in:  shadow table, residue, slot codes, number of slots, positions and
+ *      flags to be filled
  *
  */
 
-static void res_check(const pdb_chain *chain, const pdb_residue *residue,
-		      const topol *entry, char altLoc)
+static void shadow_positions(const pdb_shadow *shadows,
+			     const pdb_residue *residue, const uint32_t *codes,
+			     unsigned int nslots, fvec *pos, bool *found)
 {
-  unsigned int n_bb_found = 0, n_CB_found = 0;
+  unsigned int i, s;
 
-  bool found = false;
+  const pdb_shadow *shadow;
 
-  char *res_name, **heavy;
 
-  /* FIXME: we should not hardcode this... */
-  static const char *const backbone[] = {" CA ", " N  ", " C  ", " O  "};
+  for (i = residue->shadow_begin; i < residue->shadow_end; i++) {
+    shadow = &shadows[i];
 
-  Stack *warn = NULL;
+    for (s = 0; s < nslots && codes[s] != shadow->code; s++)
+      ;
 
-  pdb_atom *atom;
+    if (s < nslots && !found[s]) {
+      vecCreate(pos[s], PDB_COORD_FLOAT(shadow->x),
+		PDB_COORD_FLOAT(shadow->y), PDB_COORD_FLOAT(shadow->z));
+      found[s] = true;
+    }
+  }
+}
 
 
+/*
+ * attach: account for a hydrogen within bond distance of a heavy atom
+ *
+ * in:  hydrogen, heavy atom (both from the start of the residue), their
+ *      squared distance, counts
+ *
+ */
 
-  warn = stack_init(warn);
+static inline void attach(unsigned int h, unsigned int j, float dist,
+			  unsigned int *nH)
+{
+  /* don't look backwards here as we may find badly attached hydrogens,
+     but could make that a check... */
+  if (dist < MAX_XHDIST && j < h) {
+    nH[j]++;
+  }
+}
 
-  for (heavy = entry->heavy_atoms; *heavy; heavy++) {
-    for (atom = residue->first_atom;
-         atom && atom->residue == residue;
-         atom = atom->next) {
 
-      if (atom->altLoc != altLoc && atom->altLoc != ' ') {
-	continue;
-      }
+/*
+ * count_attached: count the hydrogens already attached to the atoms of a
+ *                 residue.  A heavy atom counts the hydrogens within bond
+ *                 distance that follow it.  Large residues are sorted into
+ *                 a grid of cells twice the bond length, so only the eight
+ *                 cells around the near corner of a hydrogen need to be
+ *                 searched and the cost is linear in the number of atoms.
+ *
+ * in:  atom store, residue, scratch arena
+ * out: hydrogens counted by each atom, indexed from the start of the
+ *      residue
+ *
+ */
 
-      found = false;
+static void count_attached(const pdb_atoms *atoms, const pdb_residue *residue,
+			   unsigned int *nH, Arena *scratch)
+{
+  unsigned int h, j, k, c, n, nheavy = 0;
+  unsigned int *heavy, *cell_of, *start, *order;
+  unsigned int dim[3], lo[3], hi[3];
 
-      if (STRNEQ(atom->name, *heavy, PDB_ATOM_NAME_LEN-1) ) {
-        found = true;
+  int first;
 
-        /* FIXME: since we do the check for backbone atoms here we could skip
-           bb entries in the HEAVY records of the topology database */
-        if (entry->mol_type == 'P') {
-          for (unsigned int i = 0; i < 4; i++) {
-            if (STRNEQ(*heavy, backbone[i],  PDB_ATOM_NAME_LEN-1) ) {
-              n_bb_found++;
-            }
-          }
+  size_t ncells;
 
-          if (STRNEQ(*heavy, " CB ",  PDB_ATOM_NAME_LEN-1) ) {
-            n_CB_found++;
-          }
-        }
+  float edge = 2.0f * XH_CELL, u;
 
-        break;
+  fvec posh, pos, min, max;
+
+  const pdb_atom *info = atoms->info + residue->begin;
+
+
+  n = residue->end - residue->begin;
+  heavy = arena_alloc(scratch, n * sizeof(*heavy));
+
+  for (j = 0; j < n; j++) {
+    nH[j] = 0;
+
+    if (!ISHYD(info[j].element) ) {
+      heavy[nheavy++] = j;
+    }
+  }
+
+  /* counts only look forward */
+  if (n <= GRID_MIN_ATOMS || nheavy == 0) {
+    for (k = 0; k < nheavy; k++) {
+      j = heavy[k];
+      PDB_ATOM_POS(atoms, residue->begin + j, pos);
+
+      for (h = j + 1; h < n; h++) {
+	if (ISHYD(info[h].element) ) {
+	  PDB_ATOM_POS(atoms, residue->begin + h, posh);
+	  attach(h, j, vecDist(pos, posh), nH);
+	}
       }
     }
 
-    if (!found) {
-      stack_push_uniq(warn, *heavy, PDB_RES_NAME_LEN-1);
+    return;
+  }
+
+  PDB_ATOM_POS(atoms, residue->begin + heavy[0], min);
+  vecCopy(max, min);
+
+  for (k = 1; k < nheavy; k++) {
+    PDB_ATOM_POS(atoms, residue->begin + heavy[k], pos);
+
+    for (c = 0; c < 3; c++) {
+      min[c] = pos[c] < min[c] ? pos[c] : min[c];
+      max[c] = pos[c] > max[c] ? pos[c] : max[c];
     }
   }
 
-  if (!stack_is_empty(warn)) {
-    prwarn("atoms not found in residue %s %d%c %c: ",
-	   residue->resName, residue->resSeq, residue->iCode, chain->chainID);
+  /* coarser cells still find all neighbours, keep sparse residues small */
+  for (;;) {
+    for (c = 0, ncells = 1; c < 3; c++) {
+      dim[c] = (unsigned int) ( (max[c] - min[c]) / edge) + 1;
+      ncells *= dim[c];
+    }
+
+    if (ncells <= GRID_CELLS_PER_ATOM * nheavy) {
+      break;
+    }
+
+    edge *= 1.5f;
+  }
+
+  /* heavy atoms sorted by cell */
+  cell_of = arena_alloc(scratch, nheavy * sizeof(*cell_of));
+  start = arena_alloc(scratch, (ncells + 1) * sizeof(*start));
+  order = arena_alloc(scratch, nheavy * sizeof(*order));
 
-    while ( (res_name = stack_pop(warn)) ) {
-      fprintf(stdout, " %s", (char *)res_name);
+  memset(start, 0, (ncells + 1) * sizeof(*start));
+
+  for (k = 0; k < nheavy; k++) {
+    PDB_ATOM_POS(atoms, residue->begin + heavy[k], pos);
+
+    for (c = 0, cell_of[k] = 0; c < 3; c++) {
+      cell_of[k] = cell_of[k] * dim[c] +
+	(unsigned int) ( (pos[c] - min[c]) / edge);
     }
 
-    fprintf(stdout, "\n");
+    start[cell_of[k] + 1]++;
+  }
+
+  for (c = 0; c < ncells; c++) {
+    start[c+1] += start[c];
+  }
+
+  for (k = 0; k < nheavy; k++) {
+    order[start[cell_of[k]]++] = heavy[k];
   }
 
-  stack_destroy(warn);
+  for (c = ncells; c > 0; c--) {
+    start[c] = start[c-1];
+  }
+
+  start[0] = 0;
+
+  for (h = 0; h < n; h++) {
+    if (!ISHYD(info[h].element) ) {
+      continue;
+    }
+
+    PDB_ATOM_POS(atoms, residue->begin + h, posh);
+
+    /* the bond length is at most half a cell: two cells per dimension */
+    for (c = 0; c < 3; c++) {
+      u = (posh[c] - min[c]) / edge;
+      first = (int) floorf(u - 0.5f);
+
+      if (first + 1 < 0 || first >= (int) dim[c]) {
+	break;
+      }
+
+      lo[c] = first < 0 ? 0 : first;
+      hi[c] = first + 1 < (int) dim[c] ? first + 1 : first;
+    }
+
+    if (c < 3) {
+      continue;
+    }
+
+    for (unsigned int ix = lo[0]; ix <= hi[0]; ix++) {
+      for (unsigned int iy = lo[1]; iy <= hi[1]; iy++) {
+	for (unsigned int iz = lo[2]; iz <= hi[2]; iz++) {
+	  c = (ix * dim[1] + iy) * dim[2] + iz;
+
+	  for (k = start[c]; k < start[c+1]; k++) {
+	    PDB_ATOM_POS(atoms, residue->begin + order[k], pos);
+	    attach(h, order[k], vecDist(pos, posh), nH);
+	  }
+	}
+      }
+    }
+  }
 }
 
 
 /*
- * search_top_hydrogens: search for the proper hydrogen entry in the topology
+ * place_hydrogens: compute the queued hydrogen positions of a batch and
+ *                  store them, the first hydrogen computed is the last one
+ *                  inserted.  Hydrogens are only inserted behind their heavy
+ *                  atom, so queued slots stay valid until then.
  *
- * in:  hydrogen pointer in topology, atom entry
- * out: pointer to hydrogen entry or NULL if not found
+ * in:  atom store, batch
  *
  */
 
-static topol_hydro *search_top_hydrogens(topol_hydro **top_hydro,
-					 const char *atom_name)
+static void place_hydrogens(pdb_atoms *atoms, hplace_batch *batch)
 {
-  topol_hydro *entry, **es;
+  unsigned int i, k, idx;
+
 
+  hplace_run(batch);
 
-  /* simple linear search */
-  for (es = top_hydro; *es; es++) {
-    entry = *es;
+  for (i = 0; i < batch->n; i++) {
+    for (k = 0; k < batch->nhyd[i]; k++) {
+      idx = batch->idx[i] + batch->nhyd[i] - 1 - k;
 
-    if (STRNEQ(entry->atoms[1], atom_name, PDB_ATOM_NAME_LEN-1) ) {
-      return entry;
+      atoms->x[idx] = PDB_MAKE_COORD(batch->out[3*k][i]);
+      atoms->y[idx] = PDB_MAKE_COORD(batch->out[3*k+1][i]);
+      atoms->z[idx] = PDB_MAKE_COORD(batch->out[3*k+2][i]);
     }
   }
 
-  return NULL;
+  batch->n = 0;
 }
 
 
 /*
- * search_top_atom: search for the proper control atom in a top entry
+ * add_hydrogens: insert the hydrogens of a heavy atom and queue their
+ *                placement in the batch of the bonding type, the positions
+ *                are computed by place_hydrogens once the batch is full
  *
- * in:  residue, entry atom name
- * out: entry position
+ * in:  atom store, atom, build step, current residue, slot positions and
+ *      flags of the plan, batches by bonding type
  *
  */
 
-static pdb_atom *search_top_atom(const pdb_residue *residue, const char *name)
+static bool add_hydrogens(pdb_atoms *atoms, unsigned int atom0,
+			  const topol_step *step,
+			  pdb_residue *restrict curr_residue,
+			  fvec *slot_pos, const bool *found,
+			  hplace_batch *batches)
 {
-  pdb_atom *atom;
+  unsigned int pos;
 
+  fvec pos0, ctrl_atom[HPLACE_MAX_CTRL];
+
+  const topol_hydro *entry = step->hydro;
+
+  hplace_batch *batch;
 
-  for (atom = residue->first_atom;
-       atom && atom->residue == residue;
-       atom = atom->next) {
-    if (ISHYD(atom->element) )
-      continue;
 
-    if (STRNEQ(name, atom->name, PDB_ATOM_NAME_LEN-1) ) {
-      return atom;
+
+  /* control atoms of the previous residue are not found without one */
+  for (unsigned int i = 0; i < step->nctrl; i++) {
+    if (!found[step->ctrl[i]]) {
+      return false;
     }
+
+    vecCopy(ctrl_atom[i], slot_pos[step->ctrl[i]]);
+  }
+
+  if (!hplace_nhyd(entry->type) ) {
+    prerror(1, "hydrogen type %d does not exist in database\n", entry->type);
+  } else if (entry->nhyd > hplace_nhyd(entry->type) ) {
+    prerror(1, "hydrogen type %d places at most %u hydrogens\n", entry->type,
+	    hplace_nhyd(entry->type));
+  }
+
+  PDB_ATOM_POS(atoms, atom0, pos0);
+
+  /* the hydrogens follow their heavy atom, the first one last */
+  pos = pdb_open_atoms(atoms, curr_residue, atom0 + 1, entry->nhyd);
+
+  for (unsigned int k = 0; k < entry->nhyd; k++) {
+    fill_atom(atoms, pos + k, step->names[k], step->codes[k]);
+  }
+
+  batch = &batches[entry->type];
+  hplace_push(batch, pos, entry->nhyd, pos0, ctrl_atom, step->nctrl,
+	      entry->xhdist);
+
+  if (batch->n >= BATCH_SIZE) {
+    place_hydrogens(atoms, batch);
   }
 
-  return NULL;
+  return true;
 }
 
 
 /*
- * add_hydrogens: compute positions for hydrogens according to bonding type
+ * residue_shared: check if the hydrogens of a residue can be taken from a
+ *                 reference, i.e. another conformer of the same model
  *
- * in:  atom, current topology entry, current residue, previous residue
+ * in:  pdb root structure, reference or NULL, chain, residue index
+ * out: true if neither the residue nor its predecessor had alternate
+ *      locations and both copies were bound to the same entry
  *
  */
 
-static bool add_hydrogens(pdb_atom *atom0,  const topol_hydro *entry,
-			  pdb_residue *restrict curr_residue,
-			  pdb_residue *restrict prev_residue)
+static bool residue_shared(const pdb_root *pdb, const pdb_root *ref,
+			   const pdb_chain *chain, unsigned int r)
 {
-  unsigned int ub;
+  const pdb_residue *residue = &pdb->residues[r];
 
-  char name[PDB_ATOM_NAME_LEN];
 
-  float vlen;
+  if (!ref || ref->nres != pdb->nres || residue->has_alt ||
+      residue->entry != ref->residues[r].entry) {
+    return false;
+  }
 
-  fvec v1, v2, v3, rcent;
-  fvec ctrl_atom[3], rH[3];
+  return r == chain->begin || !pdb->residues[r-1].has_alt;
+}
 
-  pdb_atom *atom, *newH;
 
+/*
+ * water_state: recognise the waters of bulk solvent.  These are handled
+ *              without res_check, slot maps and the attached hydrogen count
+ *              as the outcome is known: a bare oxygen gets its hydrogens
+ *              and a complete water is left as it is.  Anything else goes
+ *              the general way.
+ *
+ * in:  atom store, residue, build step to be set
+ * out: state of the residue
+ *
+ */
 
+static enum water_state water_state(const pdb_atoms *atoms,
+				    const pdb_residue *residue,
+				    const topol_step **step)
+{
+  unsigned int a, n;
+
+  fvec pos0, pos;
 
-  switch (entry->type) {
-  case 5:			// 5 contol atoms
-    ub = 5;
-    break;
+  const topol_plan *plan;
 
-  case 10:			// special case water with no control atoms
-    ub = 0;
-    break;
 
-  default:
-    ub = 4;
+  if (residue->res_class != PDB_RES_WATER || !residue->entry) {
+    return WATER_NONE;
   }
 
-  for (unsigned int i = 2; i < ub; i++) {
-    if (strchr(entry->atoms[i], '-') && prev_residue) {	 // check for prev res
-      strncpy(name, entry->atoms[i], PDB_RES_NAME_LEN-1);
-      name[PDB_RES_NAME_LEN-1] = '\0';
+  plan = residue->entry->plan;
 
-      if (name[0] == '-') {
-	name[0] = ' ';
-      } else if (name[1] == '-') {
-	name[1] = name[2];
-	name[2] = name[3];
-	name[3] = ' ';
-      }
+  if (plan->nslots != 1 || plan->slot_step[0] < 0 ||
+      atoms->info[residue->begin].code != plan->slot_codes[0]) {
+    return WATER_NONE;
+  }
 
-      atom = search_top_atom(prev_residue, name);
+  *step = &plan->steps[plan->slot_step[0]];
 
-      if (atom) {
-	vecCopy(ctrl_atom[i-2], atom->pos);
-      } else {
-	return false;
-      }
-    } else {
-      atom = search_top_atom(curr_residue, entry->atoms[i]);
+  if ( (*step)->nctrl > 0) {
+    return WATER_NONE;
+  }
 
-      if (atom) {
-	vecCopy(ctrl_atom[i-2], atom->pos);
-      } else {
-	return false;
-      }
-    }
+  n = residue->end - residue->begin;
+
+  if (n == 1) {
+    return WATER_BARE;
   }
 
+  if (n != 1 + (*step)->hydro->nhyd) {
+    return WATER_NONE;
+  }
 
-  switch (entry->type) {
-  case 1:			/* planar hydrogens */
-    vecSub(v1, atom0->pos, ctrl_atom[0]);
-    vecSub(v3, atom0->pos, ctrl_atom[1]);
+  PDB_ATOM_POS(atoms, residue->begin, pos0);
 
-    vecAdd(v2, v1, v3);
-    vecScalarDiv(v2, v2, vecLen(v2));
+  for (a = residue->begin + 1; a < residue->end; a++) {
+    PDB_ATOM_POS(atoms, a, pos);
 
-    for (unsigned int i = 0; i < 3; i++) {
-      rH[0][i] = atom0->pos[i] + entry->xhdist * v2[i];
+    if (!ISHYD(atoms->info[a].element) || vecDist(pos0, pos) >= MAX_XHDIST) {
+      return WATER_NONE;
     }
+  }
 
-    break;
+  return WATER_COMPLETE;
+}
 
-  case 2:			/* hydrogen bound to O or S */
-    vec_helper(v1, v2, v3, atom0->pos, ctrl_atom[0], ctrl_atom[1]);
 
-    for (unsigned int i = 0; i < 3; i++) {
-      rH[0][i] = atom0->pos[i] +
-	entry->xhdist * SIN_tetra * v3[i] - entry->xhdist * COS_tetra * v1[i];
-    }
+/*
+ * find_chain: chain a residue belongs to
+ *
+ * in:  pdb root structure, residue index
+ * out: chain
+ *
+ */
+
+static pdb_chain *find_chain(const pdb_root *pdb, unsigned int r)
+{
+  unsigned int lo = 0, hi = pdb->nchains - 1, mid;
+
+  pdb_chain *chain;
 
-    break;
 
-  case 3:			/* two planar hydrogens */
-    vec_helper(v1, v2, v3, atom0->pos, ctrl_atom[0], ctrl_atom[1]);
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
 
-    for (unsigned int i = 0; i < 3; i++) {
-      rH[0][i] = atom0->pos[i] -
-	entry->xhdist * SIN_120 * v3[i] - entry->xhdist * COS_120 * v1[i];
-      rH[1][i] = atom0->pos[i] +
-	entry->xhdist * SIN_120 * v3[i] - entry->xhdist * COS_120 * v1[i];
+    if (pdb->chains[mid].begin <= r) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
     }
+  }
+
+  /* skip chains without residues */
+  for (chain = &pdb->chains[lo]; r >= chain->end; chain++)
+    ;
+
+  return chain;
+}
 
-    break;
 
-  case 4:			/* three tetrahedal hydrogens */
-    vec_helper(v1, v2, v3, atom0->pos, ctrl_atom[0], ctrl_atom[1]);
+/*
+ * hbuild_map_job: par_for body, map the slots of the residues in a block,
+ *                 count the hydrogens they will need and take a snapshot of
+ *                 the control atoms each needs from its predecessor
+ *
+ * in:  block index, job description
+ *
+ */
+
+static void hbuild_map_job(unsigned int idx, void *arg)
+{
+  struct _hbuild_blocks *job = arg;
+  struct _hbuild_map *map = &job->map;
+  const struct _hbuild_block *block = &job->blocks[idx];
 
-    for (unsigned int i = 0; i < 3; i++) {
-      rH[0][i] = atom0->pos[i] +
-	entry->xhdist * SIN_tetra * v3[i]  - entry->xhdist * COS_tetra * v1[i];
-      rH[1][i] = atom0->pos[i] -
-	entry->xhdist * SIN_tetra_05 * v3[i] +
-	entry->xhdist * SIN_tetra_h * v2[i] -
-	entry->xhdist * COS_tetra * v1[i];
-      rH[2][i] = atom0->pos[i] -
-	entry->xhdist * SIN_tetra_05 * v3[i] -
-	entry->xhdist * SIN_tetra_h * v2[i] -
-	entry->xhdist * COS_tetra * v1[i];
+  unsigned int r, n;
+
+  int *atom_slot, *prev_slot;
+
+  const topol *top_entry;
+  const topol_plan *plan;
+  const topol_step *step;
+
+  Arena *scratch;
+
+  pdb_root *pdb = job->pdb;
+  const pdb_root *ref = job->ref;
+  pdb_residue *residue;
+  pdb_chain *chain;
+
+
+  if (block->begin >= block->end) {
+    return;
+  }
+
+  scratch = arena_init(SCRATCH_SIZE);
+  chain = find_chain(pdb, block->begin);
+
+  for (r = block->begin; r < block->end; r++) {
+    while (r >= chain->end) {
+      chain++;
     }
 
-    break;
+    residue = &pdb->residues[r];
+    map->nfree[r] = 0;
 
-  case 5:			/* one tetrahedral hydrogen */
-    for (unsigned int i = 0; i < 3; i++) {
-      rcent[i] = atom0->pos[i] - 
-	(ctrl_atom[0][i] + ctrl_atom[1][i] + ctrl_atom[2][i]) / 3.0;
+    if (residue_shared(pdb, ref, chain, r) ) {
+      map->nfree[r] = ref->residues[r].end - ref->residues[r].begin;
+      map->nfree[r] -= residue->end - residue->begin;
+      continue;
     }
 
-    vlen = vecLen(rcent);
+    switch (water_state(&pdb->atoms, residue, &step) ) {
+    case WATER_BARE:
+      map->nfree[r] = step->hydro->nhyd;
+      continue;
+    case WATER_COMPLETE:
+      continue;
+    case WATER_NONE:
+      break;
+    }
+
+    if (!(top_entry = residue->entry) ) {
+      continue;
+    }
+
+    plan = top_entry->plan;
+    atom_slot = map->atom_slot + map->first[r];
+    n = residue->end - residue->begin;
 
-    if (vlen < 0.2) {		// arbitrary length for "short" vector
-      for (unsigned int i = 0; i < 3; i++) {
-	v1[i] = ctrl_atom[1][i] - ctrl_atom[0][i];
-	v2[i] = ctrl_atom[2][i] - ctrl_atom[0][i];
-	v3[i] = copysignf(v3[i], rcent[i]);  // gives correct direction?
+    map_slots(&pdb->atoms, residue, plan->slot_codes, plan->nslots,
+	      atom_slot);
+
+    for (unsigned int j = 0; j < n; j++) {
+      if (atom_slot[j] >= 0 && plan->slot_step[atom_slot[j]] >= 0) {
+	map->nfree[r] += plan->steps[plan->slot_step[atom_slot[j]]].hydro->nhyd;
       }
+    }
 
-      vecCrossProd(v3, v1, v2);
-      vecScalarDiv(rcent, v3, vecLen(v3));
-    } else {
-      vecScalarDiv(rcent, rcent, vlen);
+    if (r > chain->begin && plan->nprev > 0) {
+      arena_reset(scratch);
+      prev_slot = arena_alloc(scratch, (residue[-1].end - residue[-1].begin) *
+			      sizeof(*prev_slot));
+
+      map_slots(&pdb->atoms, residue - 1, plan->slot_codes + plan->nslots,
+		plan->nprev, prev_slot);
+      shadow_positions(pdb->shadows, residue - 1,
+		       plan->slot_codes + plan->nslots, plan->nprev,
+		       map->halo_pos + map->first_halo[r],
+		       map->halo_found + map->first_halo[r]);
+      slot_positions(&pdb->atoms, residue - 1, prev_slot,
+		     map->halo_pos + map->first_halo[r],
+		     map->halo_found + map->first_halo[r]);
     }
+  }
+
+  arena_destroy(scratch);
+}
+
+
+/*
+ * build_residue: add the hydrogens missing from one residue
+ *
+ * in:  atom store, shadow table, chain, residue, whether the residue has a
+ *      predecessor, slot of each atom as mapped before any hydrogen was
+ *      added, positions and flags of the control atoms in the predecessor,
+ *      scratch arena, batches by bonding type
+ * out: number of atoms added
+ *
+ */
 
-    for (unsigned int i = 0; i < 3; i++)
-      rH[0][i] = atom0->pos[i] + entry->xhdist * rcent[i];
+static unsigned int build_residue(pdb_atoms *atoms,
+				  const pdb_shadow *shadows,
+				  const pdb_chain *chain,
+				  pdb_residue *curr_residue, bool has_prev,
+				  const int *atom_slot, fvec *halo_pos,
+				  const bool *halo_found, Arena *scratch,
+				  hplace_batch *batches)
+{
+  unsigned int j, n, a1, nH, shift, *attached;
 
-    break;
+  bool add_ok, *found;
 
-  case 6:			/* two tetrahedral hydrogens */
-    for (unsigned int i = 0; i < 3; i++) 
-      rcent[i] = atom0->pos[i] - (ctrl_atom[0][i] + ctrl_atom[1][i]) / 2.0;
+  fvec *slot_pos;
 
-    vecSub(v1, atom0->pos, ctrl_atom[0]);
-    vecSub(v2, atom0->pos, ctrl_atom[1]);
-    vecCrossProd(v3, v1, v2);
+  const topol *top_entry = curr_residue->entry;
+  const topol_plan *plan = top_entry->plan;
+  const topol_step *step;
+  const topol_hydro *entry;
 
-    vecScalarDiv(rcent, rcent, vecLen(rcent));
-    vecScalarDiv(v3, v3, vecLen(v3));
+  pdb_atom *atom1;
 
-    for (unsigned int i = 0; i < 3; i++) {
-      rH[0][i] = atom0->pos[i] +
-	entry->xhdist * (COS_tetra_h * rcent[i] + SIN_tetra_h * v3[i]);
-      rH[1][i] = atom0->pos[i] +
-	entry->xhdist * (COS_tetra_h * rcent[i] - SIN_tetra_h * v3[i]);
-    }
 
-    break;
+  arena_reset(scratch);
+  res_check(atoms, chain, curr_residue, top_entry, scratch);
 
-    // FIXME: we may want to use a better scheme...
-  case 10:			// 3 point water (as TIP3P)
-    rH[0][0] = atom0->pos[0] + entry->xhdist * SIN_theta1 * COS_phi;
-    rH[0][1] = atom0->pos[1] + entry->xhdist * SIN_theta1 * SIN_phi;
-    rH[0][2] = atom0->pos[2] + entry->xhdist * COS_theta1;
+  n = curr_residue->end - curr_residue->begin;
 
-    rH[1][0] = atom0->pos[0] + entry->xhdist * SIN_theta2 * COS_phi;
-    rH[1][1] = atom0->pos[1] + entry->xhdist * SIN_theta2 * SIN_phi;
-    rH[1][2] = atom0->pos[2] - entry->xhdist * COS_theta2;
+  slot_pos = arena_alloc(scratch, (plan->nslots + plan->nprev) *
+			 sizeof(*slot_pos));
+  found = arena_alloc(scratch, (plan->nslots + plan->nprev) * sizeof(*found));
 
-    break;
+  memset(found, 0, (plan->nslots + plan->nprev) * sizeof(*found));
 
-  default:
-    prerror(1, "hydrogen type %d does not exist in database\n", entry->type);
+  /* heavy atoms do not move, so the slots were looked up only once */
+  shadow_positions(shadows, curr_residue, plan->slot_codes, plan->nslots,
+		   slot_pos, found);
+  slot_positions(atoms, curr_residue, atom_slot, slot_pos, found);
+
+  if (has_prev) {
+    memcpy(slot_pos + plan->nslots, halo_pos, plan->nprev * sizeof(*slot_pos));
+    memcpy(found + plan->nslots, halo_found, plan->nprev * sizeof(*found));
   }
 
-  for (unsigned int i = 0; i < entry->nhyd; i++) {
-    strncpy(name, entry->atoms[0], PDB_RES_NAME_LEN-1);
-    name[PDB_RES_NAME_LEN-1] = '\0';
+  /* existing hydrogens are counted before the residue grows */
+  attached = arena_alloc(scratch, n * sizeof(*attached));
+  count_attached(atoms, curr_residue, attached, scratch);
+
+  /* the residue grows while hydrogens are added behind their atom */
+  for (j = 0, shift = 0; j < n; j++) { /* atom1 */
+    if (atom_slot[j] < 0 || plan->slot_step[atom_slot[j]] < 0) {
+      continue;
+    }
+
+    a1 = curr_residue->begin + j + shift;
+    atom1 = &atoms->info[a1];
+    step = &plan->steps[plan->slot_step[atom_slot[j]]];
+    entry = step->hydro;
 
-    newH = pdb_insert_atom_node(atom0);
-    newH->residue = curr_residue;
+    nH = attached[j];
+
+    if (nH > entry->nhyd && has_prev) {
+      prwarn("atom %s-%s %d%c %c has too many hydrogens (%d) already.\n",
+	     atom1->name, curr_residue->resName, curr_residue->resSeq,
+	     chain->chainID, curr_residue->iCode, nH);
+      continue;
+    } else if (entry->nhyd == nH) {
+      continue;
+    } else if (nH > 0) {
+      if (has_prev)
+	prwarn("atom %s-%s %d%c %c: cannot handle partially (%d) "
+	       "populated hydrogens\n", atom1->name,
+	       curr_residue->resName, curr_residue->resSeq,
+	       chain->chainID, curr_residue->iCode, nH);
 
-    if (entry->nhyd > 1) {
-      fill_atom(newH, format_atom_name(name, 48 +  entry->nhyd - i), rH[i]);
+      continue;
     } else {
-      fill_atom(newH, name, rH[i]);
+      add_ok = add_hydrogens(atoms, a1, step, curr_residue, slot_pos, found,
+			     batches);
+
+      if (add_ok) {
+	shift += entry->nhyd;
+      } else {
+	prwarn("cannot find all control atoms for atom %s (%s %d%c %c) "
+	       "in PDB.\n", atoms->info[a1].name, curr_residue->resName,
+	       curr_residue->resSeq, curr_residue->iCode, chain->chainID);
+      }
     }
   }
 
-  return true;
+  return shift;
 }
 
 
 /*
- * hbuild: main loop over heavy atoms and add hydrogens accordingly (actual
- *         routine is in add_hydrogens), check terminal residues and transform
- *         if required
+ * hbuild_block_job: par_for body, build the hydrogens of the residues in a
+ *                   block.  A residue only ever grows into its own free
+ *                   slots and reads its predecessor from the snapshot, so
+ *                   blocks do not touch each other.
  *
- * in:  pdb root structure, top hash table
+ * in:  block index, job description
  *
  */
 
-void hbuild(pdb_root *pdb, const Hashtable *top, char altLoc)
+static void hbuild_block_job(unsigned int idx, void *arg)
 {
-  unsigned int nH;
+  struct _hbuild_blocks *job = arg;
+  const struct _hbuild_map *map = &job->map;
+  struct _hbuild_block *block = &job->blocks[idx];
 
-  bool add_ok;
+  unsigned int r;
 
-  char *res_name;
+  Arena *scratch;
 
-  float dist;
+  hplace_batch batches[HPLACE_NTYPES];
 
-  topol *top_entry;
-  topol_hydro *entry;
+  const topol_step *step;
 
-  Queue *warn = NULL;
+  pdb_root *pdb = job->pdb;
+  const pdb_root *ref = job->ref;
+  pdb_residue *curr_residue;
+  pdb_chain *chain;
 
-  Hashnode *curr_node;
 
-  pdb_atom *atom1, *atom2;
-  pdb_residue *curr_residue, *prev_residue;
-  pdb_chain *chain;
+  if (block->begin >= block->end) {
+    return;
+  }
 
+  scratch = arena_init(SCRATCH_SIZE);
 
+  for (unsigned int t = 0; t < HPLACE_NTYPES; t++) {
+    hplace_init(&batches[t], t);
+  }
 
-  warn = queue_init(warn);
+  chain = find_chain(pdb, block->begin);
 
-  for (chain = pdb->first_chain; chain; chain = chain->next) { /* chain */
+  for (r = block->begin; r < block->end; r++) { /* residue */
+    while (r >= chain->end) {
+      chain++;
+    }
 
-    prev_residue = NULL;
+    curr_residue = &pdb->residues[r];
 
-    for (curr_residue = chain->first_residue;
-	 curr_residue && curr_residue->chain == chain;
-	 prev_residue = curr_residue,
-	   curr_residue = curr_residue->next) { /* residue */
+    if (!curr_residue->entry) {
+      queue_push_uniq(block->warn, curr_residue->resName, PDB_RES_NAME_LEN-1);
+      continue;
+    }
 
-      if (!(curr_node = hash_search(top, curr_residue->resName,
-				    strlen(curr_residue->resName) ) ) ) {
-	queue_push_uniq(warn, curr_residue->resName, PDB_RES_NAME_LEN-1);
-	continue;
-      }
+    if (residue_shared(pdb, ref, chain, r) ) {
+      block->natoms += pdb_copy_residue(&pdb->atoms, curr_residue,
+					&ref->atoms, &ref->residues[r]);
+      continue;
+    }
 
-      top_entry = hash_node_get_data(curr_node);
+    switch (water_state(&pdb->atoms, curr_residue, &step) ) {
+    case WATER_BARE:
+      add_hydrogens(&pdb->atoms, curr_residue->begin, step, curr_residue,
+		    NULL, NULL, batches);
+      block->natoms += step->hydro->nhyd;
+      continue;
+    case WATER_COMPLETE:
+      continue;
+    case WATER_NONE:
+      break;
+    }
 
-      /* check only according to defined residue type in top.dat as residues
-	 may have names colliding with force field conventions, e.g.
-	 TYM = TRYPTOPHANYL-5'AMP, HID = (5-HYDROXY-1H-INDOL-3-YL)ACETIC ACID,
-	 DGN = D-GLUTAMINE, etc. */
-      if (top_entry->res_type != '@' &&
-	  curr_residue->rectype != top_entry->res_type) {
-	queue_push_uniq(warn, curr_residue->resName, PDB_RES_NAME_LEN-1);
-	continue;
-      }
+    block->natoms += build_residue(&pdb->atoms, pdb->shadows, chain,
+				   curr_residue, r > chain->begin,
+				   map->atom_slot + map->first[r],
+				   map->halo_pos + map->first_halo[r],
+				   map->halo_found + map->first_halo[r],
+				   scratch, batches);
+  }
 
-      if (curr_residue == chain->first_residue &&
-		 top_entry->first_term &&
-	  ( (top_entry->mol_type == 'P' && options.nterm) ||
-	    (top_entry->mol_type == 'D' && options.dna5term) ||
-	    (top_entry->mol_type == 'R' && options.rna5term) ) ) {
-
-	top_entry = top_entry->first_term;
-      } else if ( (!curr_residue->next ||
-		   curr_residue->next->chain != chain) &&
-		  top_entry->last_term &&
-		  ( (top_entry->mol_type == 'P' && options.cterm) ||
-		    (top_entry->mol_type == 'D' && options.dna3term) ||
-		    (top_entry->mol_type == 'R' && options.rna3term) ) ) {
-
-	top_entry = top_entry->last_term;
-      }
+  arena_destroy(scratch);
 
-      res_check(chain, curr_residue, top_entry, altLoc);
+  for (unsigned int t = 0; t < HPLACE_NTYPES; t++) {
+    place_hydrogens(&pdb->atoms, &batches[t]);
+    hplace_destroy(&batches[t]);
+  }
+}
 
-      for (atom1 = curr_residue->first_atom;
-	   atom1 && atom1->residue == curr_residue;
-	   atom1 = atom1->next) { /* atom1 */
 
-	if ( (atom1->altLoc != altLoc && atom1->altLoc != ' ') ||
-	     ISHYD(atom1->element) ) {
-	  continue;
-	}
+/*
+ * build_blocks: add hydrogens to the residues in consecutive blocks.  All
+ *               residues are mapped and given exactly the room they need
+ *               first, then the blocks are built concurrently.  Messages
+ *               come out in residue order whatever the number of threads.
+ *
+ * in:  pdb root structure, reference or NULL, number of blocks
+ *
+ */
 
-	nH = 0;
+static void build_blocks(pdb_root *pdb, const pdb_root *ref,
+			 unsigned int nblocks)
+{
+  unsigned int r, b, nres = pdb->nres;
 
-	/* don't look backwards here as we may find badly attached hydrogens,
-	   but could make that a check... */
-	for (atom2 = atom1->next;
-	     atom2 && atom2->residue == curr_residue;
-	     atom2 = atom2->next) {
+  char *res_name;
 
-	  if (atom2->altLoc != altLoc && atom2->altLoc != ' ') {
-	    continue;
-	  }
+  const topol *top_entry;
 
-	  dist = vecDist(atom1->pos, atom2->pos);
+  Queue *warn = NULL;
 
-	  if (dist < MAX_XHDIST && ISHYD(atom2->element)) {
-	    nH++;
-	  }
-	}
+  struct _hbuild_blocks job;
+  struct _hbuild_map *map = &job.map;
 
-	entry = search_top_hydrogens(top_entry->hydrogens, atom1->name);
-
-	if (entry) {
-	  if (nH > entry->nhyd && prev_residue) {
-	    prwarn("atom %s-%s %d%c %c has too many hydrogens (%d) already.\n",
-		   atom1->name, curr_residue->resName, curr_residue->resSeq,
-		   chain->chainID, curr_residue->iCode, nH);
-	    continue;
-	  } else if (entry->nhyd == nH) {
-	    continue;
-	  } else if (nH > 0) {
-	    if (prev_residue)
-	      prwarn("atom %s-%s %d%c %c: cannot handle partially (%d) "
-		     "populated hydrogens\n", atom1->name,
-		     curr_residue->resName, curr_residue->resSeq,
-		     chain->chainID, curr_residue->iCode, nH);
-
-	    continue;
-	  } else {
-	    add_ok = add_hydrogens(atom1, entry, curr_residue, prev_residue);
-
-	    if (!add_ok) {
-	      prwarn("cannot find all control atoms for atom %s (%s %d%c %c) "
-		     "in PDB.\n", atom1->name, curr_residue->resName,
-		     curr_residue->resSeq, curr_residue->iCode, chain->chainID);
-	    }
-	  }
-	}
+  pdb_chain *chain;
+
+
+  job.pdb = pdb;
+  job.ref = ref;
+
+  map->first = allocate( (nres + 1) * sizeof(*map->first) );
+  map->first_halo = allocate( (nres + 1) * sizeof(*map->first_halo) );
+  map->nfree = allocate(nres * sizeof(*map->nfree) );
+
+  map->first[0] = map->first_halo[0] = 0;
+
+  for (chain = pdb->chains; chain < pdb->chains + pdb->nchains; chain++) {
+    for (r = chain->begin; r < chain->end; r++) {
+      top_entry = pdb->residues[r].entry;
+
+      map->first[r+1] = map->first[r] + pdb->residues[r].end -
+	pdb->residues[r].begin;
+      map->first_halo[r+1] = map->first_halo[r];
+
+      if (r > chain->begin && top_entry) {
+	map->first_halo[r+1] += top_entry->plan->nprev;
       }
     }
   }
 
+  map->atom_slot = allocate(map->first[nres] * sizeof(*map->atom_slot) );
+  map->halo_pos = allocate(map->first_halo[nres] * sizeof(*map->halo_pos) );
+  map->halo_found = allocate(map->first_halo[nres] *
+			     sizeof(*map->halo_found) );
+  memset(map->halo_found, 0, map->first_halo[nres] * sizeof(*map->halo_found));
+
+  job.blocks = allocate(nblocks * sizeof(*job.blocks) );
+
+  for (b = 0; b < nblocks; b++) {
+    job.blocks[b].begin = (unsigned long) nres * b / nblocks;
+    job.blocks[b].end = (unsigned long) nres * (b + 1) / nblocks;
+    job.blocks[b].natoms = 0;
+    job.blocks[b].warn = queue_init(NULL);
+  }
+
+  par_for(nblocks, hbuild_map_job, &job);
+  pdb_reserve_atoms(pdb, map->nfree);
+  par_for(nblocks, hbuild_block_job, &job);
+
+  warn = queue_init(warn);
+
+  for (b = 0; b < nblocks; b++) {
+    pdb->natoms += job.blocks[b].natoms;
+
+    while ( (res_name = queue_pop_front(job.blocks[b].warn)) ) {
+      queue_push_uniq(warn, res_name, PDB_RES_NAME_LEN-1);
+    }
+
+    queue_destroy(job.blocks[b].warn);
+  }
+
   if (!queue_is_empty(warn)) {
     prwarn("residues not found in topology database:");
 
     while ( (res_name = queue_pop_front(warn)) ) {
-      fprintf(stdout, " %s", (char *)res_name);
+      fprintf(prout(), " %s", (char *)res_name);
     }
 
-    fprintf(stdout, "\n");
+    fprintf(prout(), "\n");
   }
 
   queue_destroy(warn);
+
+  free(job.blocks);
+  free(map->first);
+  free(map->first_halo);
+  free(map->nfree);
+  free(map->atom_slot);
+  free(map->halo_pos);
+  free(map->halo_found);
+}
+
+
+/*
+ * hbuild_nblocks: number of residue blocks for a structure, a few per
+ *                 thread but none too small to be worth it
+ *
+ * in:  pdb root structure
+ * out: number of blocks
+ *
+ */
+
+static unsigned int hbuild_nblocks(const pdb_root *pdb)
+{
+  unsigned int nthreads, nblocks;
+
+
+  nthreads = par_get_threads();
+
+  if (nthreads < 2) {
+    return 1;
+  }
+
+  nblocks = (pdb->nres + BLOCK_MIN_RES - 1) / BLOCK_MIN_RES;
+
+  if (nblocks > nthreads * BLOCKS_PER_THREAD) {
+    nblocks = nthreads * BLOCKS_PER_THREAD;
+  }
+
+  return nblocks > 0 ? nblocks : 1;
+}
+
+
+/*
+ * hbuild: main loop over heavy atoms and add hydrogens accordingly (actual
+ *         routines are add_hydrogens and place_hydrogens).  The residues
+ *         must have been bound to the topology with top_bind, terminal
+ *         variants included.  Only the selected alternate location is
+ *         expected in the store, control atoms of dropped conformers come
+ *         from the shadow table, see pdb_select_altloc.  With a reference,
+ *         another conformer of the same model already built, residues no
+ *         alternate location touches are copied from it instead.  Blocks
+ *         of residues are built concurrently, the result does not depend
+ *         on the number of threads.
+ *
+ * in:  pdb root structure, reference or NULL
+ *
+ */
+
+void hbuild(pdb_root *pdb, const pdb_root *ref)
+{
+  build_blocks(pdb, ref, hbuild_nblocks(pdb) );
+}
+
+
+/*
+ * hbuild_model_job: par_for body, build hydrogens for one model
+ *
+ * in:  model index, job description
+ *
+ */
+
+static void hbuild_model_job(unsigned int idx, void *arg)
+{
+  struct _hbuild_job *job = arg;
+
+
+  /* the models are the parallel loop already */
+  build_blocks(job->models[idx], job->refs[idx], 1);
+}
+
+
+/*
+ * hbuild_models: add hydrogens to all models linked to the root structure,
+ *                the models are processed concurrently, a single one in
+ *                residue blocks
+ *
+ * in:  pdb root structure, reference with the same models or NULL
+ *
+ */
+
+void hbuild_models(pdb_root *pdb, const pdb_root *ref)
+{
+  unsigned int nmodels = 0;
+
+  pdb_root *model;
+
+  struct _hbuild_job job;
+
+
+  for (model = pdb; model; model = model->next_model) {
+    nmodels++;
+  }
+
+  job.models = allocate(nmodels * sizeof(*job.models));
+  job.refs = allocate(nmodels * sizeof(*job.refs));
+
+  nmodels = 0;
+
+  for (model = pdb; model; model = model->next_model) {
+    job.refs[nmodels] = ref;
+    job.models[nmodels++] = model;
+
+    if (ref) {
+      ref = ref->next_model;
+    }
+  }
+
+  if (nmodels == 1) {
+    hbuild(job.models[0], job.refs[0]);
+  } else {
+    par_for(nmodels, hbuild_model_job, &job);
+  }
+
+  free(job.models);
+  free(job.refs);
 }
@@ -9,8 +9,9 @@
 #ifndef _HBUILD_H
 #define _HBUILD_H      1
 
-#include "util/hashtab.h"
+#include "pdb.h"
 
-void hbuild(pdb_root *pdb, const Hashtable *top, char altLoc);
+void hbuild(pdb_root *pdb, const pdb_root *ref);
+void hbuild_models(pdb_root *pdb, const pdb_root *ref);
 
 #endif
@@ -0,0 +1,582 @@
+/*
+ * Hydrogen positions from their heavy atom and control atoms, computed in
+ * batches of one bonding type at a time.  The placements are gathered into
+ * columns (structure of arrays) so that each kernel works on several of them
+ * at once with SSE2 or AVX where the compiler targets those, otherwise one by
+ * one.  All variants perform the same single precision operations in the
+ * same order and thus give identical results.
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "hplace.h"
+#include "util/util.h"
+
+
+#if defined(__AVX__)
+
+#include <immintrin.h>
+
+#define VF_LEN 8
+#define VF_ISA "AVX"
+
+typedef __m256 vfloat;
+
+#define vf_load(p) _mm256_loadu_ps(p)
+#define vf_store(p, a) _mm256_storeu_ps(p, a)
+#define vf_set1(c) _mm256_set1_ps(c)
+#define vf_add(a, b) _mm256_add_ps(a, b)
+#define vf_sub(a, b) _mm256_sub_ps(a, b)
+#define vf_mul(a, b) _mm256_mul_ps(a, b)
+#define vf_div(a, b) _mm256_div_ps(a, b)
+#define vf_sqrt(a) _mm256_sqrt_ps(a)
+#define vf_lt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vf_select(m, a, b) _mm256_blendv_ps(b, a, m)
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define VF_LEN 4
+#define VF_ISA "SSE2"
+
+typedef __m128 vfloat;
+
+#define vf_load(p) _mm_loadu_ps(p)
+#define vf_store(p, a) _mm_storeu_ps(p, a)
+#define vf_set1(c) _mm_set1_ps(c)
+#define vf_add(a, b) _mm_add_ps(a, b)
+#define vf_sub(a, b) _mm_sub_ps(a, b)
+#define vf_mul(a, b) _mm_mul_ps(a, b)
+#define vf_div(a, b) _mm_div_ps(a, b)
+#define vf_sqrt(a) _mm_sqrt_ps(a)
+#define vf_lt(a, b) _mm_cmplt_ps(a, b)
+#define vf_select(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+
+#else
+
+#define VF_LEN 1
+#define VF_ISA "scalar"
+
+typedef float vfloat;
+
+#define vf_load(p) (*(p))
+#define vf_store(p, a) (*(p) = (a))
+#define vf_set1(c) ((float) (c))
+#define vf_add(a, b) ((a) + (b))
+#define vf_sub(a, b) ((a) - (b))
+#define vf_mul(a, b) ((a) * (b))
+#define vf_div(a, b) ((a) / (b))
+#define vf_sqrt(a) sqrtf(a)
+#define vf_lt(a, b) ((float) ((a) < (b)))
+#define vf_select(m, a, b) ((m) != 0.0f ? (a) : (b))
+
+#endif
+
+
+#define BATCH_CHUNK 256		/* initial room for placements */
+
+/* pre-calculated value for calculation of H positions */
+#define SIN_tetra 0.9428090415820634       /* sin(109.47) */
+#define COS_tetra -0.3333333333333333      /* cos(109.47) */
+#define SIN_tetra_h 0.8164965809277260     /* sin(109.47 / 2) */
+#define COS_tetra_h 0.5773502691896257     /* cos(109.47 / 2) */
+#define SIN_tetra_05 0.4714045207910317	   /* sin(109.47) * 0.5 */
+#define SIN_120 0.8660254037844387         /* sin(120) */
+#define COS_120 -0.5		           /* cos(120) */
+
+// _very_ arbitrary pre-calculated values for spherical coordinates for H2O
+// theta1 = 50 deg, theta2 = 50 + 104.52 deg, phi = 70 deg
+#define SIN_theta1 0.76604444311897803520
+#define SIN_theta2 0.43019600888661864331
+#define COS_phi 0.34202014332566873305
+#define SIN_phi 0.93969262078590838405
+#define COS_theta1 0.64278760968653932632
+#define COS_theta2 0.90273550608028281612
+
+
+typedef struct {
+  vfloat x, y, z;
+} vvec;
+
+typedef void (*kernel_fn)(const hplace_batch *batch, unsigned int i);
+
+
+
+/*
+ * lane-wise vector helpers, the counterparts of vecSub etc.
+ *
+ */
+
+static inline void vv_load(vvec *r, const hplace_batch *batch,
+			   unsigned int atom, unsigned int i)
+{
+  r->x = vf_load(batch->in[3*atom] + i);
+  r->y = vf_load(batch->in[3*atom+1] + i);
+  r->z = vf_load(batch->in[3*atom+2] + i);
+}
+
+static inline void vv_store(const hplace_batch *batch, unsigned int hyd,
+			    unsigned int i, const vvec *v)
+{
+  vf_store(batch->out[3*hyd] + i, v->x);
+  vf_store(batch->out[3*hyd+1] + i, v->y);
+  vf_store(batch->out[3*hyd+2] + i, v->z);
+}
+
+static inline void vv_add(vvec *r, const vvec *v, const vvec *w)
+{
+  r->x = vf_add(v->x, w->x);
+  r->y = vf_add(v->y, w->y);
+  r->z = vf_add(v->z, w->z);
+}
+
+static inline void vv_sub(vvec *r, const vvec *v, const vvec *w)
+{
+  r->x = vf_sub(v->x, w->x);
+  r->y = vf_sub(v->y, w->y);
+  r->z = vf_sub(v->z, w->z);
+}
+
+/* r = v + a * w */
+static inline void vv_add_scaled(vvec *r, const vvec *v, vfloat a,
+				 const vvec *w)
+{
+  r->x = vf_add(v->x, vf_mul(a, w->x));
+  r->y = vf_add(v->y, vf_mul(a, w->y));
+  r->z = vf_add(v->z, vf_mul(a, w->z));
+}
+
+/* r = v - a * w */
+static inline void vv_sub_scaled(vvec *r, const vvec *v, vfloat a,
+				 const vvec *w)
+{
+  r->x = vf_sub(v->x, vf_mul(a, w->x));
+  r->y = vf_sub(v->y, vf_mul(a, w->y));
+  r->z = vf_sub(v->z, vf_mul(a, w->z));
+}
+
+static inline void vv_scale(vvec *r, vfloat a, const vvec *v)
+{
+  r->x = vf_mul(a, v->x);
+  r->y = vf_mul(a, v->y);
+  r->z = vf_mul(a, v->z);
+}
+
+static inline void vv_div(vvec *r, const vvec *v, vfloat a)
+{
+  r->x = vf_div(v->x, a);
+  r->y = vf_div(v->y, a);
+  r->z = vf_div(v->z, a);
+}
+
+static inline vfloat vv_len(const vvec *v)
+{
+  return vf_sqrt(vf_add(vf_add(vf_mul(v->x, v->x), vf_mul(v->y, v->y)),
+			vf_mul(v->z, v->z)));
+}
+
+static inline void vv_cross(vvec *r, const vvec *v, const vvec *w)
+{
+  vvec t;
+
+
+  t.x = vf_sub(vf_mul(v->y, w->z), vf_mul(v->z, w->y));
+  t.y = vf_sub(vf_mul(v->z, w->x), vf_mul(v->x, w->z));
+  t.z = vf_sub(vf_mul(v->x, w->y), vf_mul(v->y, w->x));
+
+  *r = t;
+}
+
+
+/*
+ * frame: orthonormal frame from heavy atom and two control atoms, v1 along
+ *        the bond, v2 normal to the plane, v3 in the plane
+ *
+ * in:  heavy atom, control atoms
+ * out: v1, v2, v3
+ *
+ */
+
+static inline void frame(vvec *v1, vvec *v2, vvec *v3, const vvec *atom0,
+			 const vvec *ctrl0, const vvec *ctrl1)
+{
+  vv_sub(v1, atom0, ctrl0);
+  vv_sub(v3, ctrl0, ctrl1);
+  vv_cross(v2, v1, v3);
+
+  vv_div(v1, v1, vv_len(v1));
+  vv_div(v2, v2, vv_len(v2));
+  vv_cross(v3, v2, v1);
+}
+
+
+/*
+ * kernel_*: positions of VF_LEN placements starting at i for each bonding
+ *           type
+ *
+ * in:  batch, first placement
+ *
+ */
+
+static void kernel_planar(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i);
+  vvec p0, c0, c1, v1, v2, v3;
+
+
+  vv_load(&p0, batch, 0, i);
+  vv_load(&c0, batch, 1, i);
+  vv_load(&c1, batch, 2, i);
+
+  vv_sub(&v1, &p0, &c0);
+  vv_sub(&v3, &p0, &c1);
+  vv_add(&v2, &v1, &v3);
+  vv_div(&v2, &v2, vv_len(&v2));
+
+  vv_add_scaled(&v1, &p0, d, &v2);
+  vv_store(batch, 0, i, &v1);
+}
+
+static void kernel_oh(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i);
+  vfloat a = vf_mul(d, vf_set1(SIN_tetra));
+  vfloat b = vf_mul(d, vf_set1(COS_tetra));
+  vvec p0, c0, c1, v1, v2, v3, h;
+
+
+  vv_load(&p0, batch, 0, i);
+  vv_load(&c0, batch, 1, i);
+  vv_load(&c1, batch, 2, i);
+  frame(&v1, &v2, &v3, &p0, &c0, &c1);
+
+  vv_add_scaled(&h, &p0, a, &v3);
+  vv_sub_scaled(&h, &h, b, &v1);
+  vv_store(batch, 0, i, &h);
+}
+
+static void kernel_nh2(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i);
+  vfloat a = vf_mul(d, vf_set1(SIN_120));
+  vfloat b = vf_mul(d, vf_set1(COS_120));
+  vvec p0, c0, c1, v1, v2, v3, h;
+
+
+  vv_load(&p0, batch, 0, i);
+  vv_load(&c0, batch, 1, i);
+  vv_load(&c1, batch, 2, i);
+  frame(&v1, &v2, &v3, &p0, &c0, &c1);
+
+  vv_sub_scaled(&h, &p0, a, &v3);
+  vv_sub_scaled(&h, &h, b, &v1);
+  vv_store(batch, 0, i, &h);
+
+  vv_add_scaled(&h, &p0, a, &v3);
+  vv_sub_scaled(&h, &h, b, &v1);
+  vv_store(batch, 1, i, &h);
+}
+
+static void kernel_methyl(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i);
+  vfloat a = vf_mul(d, vf_set1(SIN_tetra));
+  vfloat b = vf_mul(d, vf_set1(COS_tetra));
+  vfloat c = vf_mul(d, vf_set1(SIN_tetra_05));
+  vfloat e = vf_mul(d, vf_set1(SIN_tetra_h));
+  vvec p0, c0, c1, v1, v2, v3, base, h;
+
+
+  vv_load(&p0, batch, 0, i);
+  vv_load(&c0, batch, 1, i);
+  vv_load(&c1, batch, 2, i);
+  frame(&v1, &v2, &v3, &p0, &c0, &c1);
+
+  vv_add_scaled(&h, &p0, a, &v3);
+  vv_sub_scaled(&h, &h, b, &v1);
+  vv_store(batch, 0, i, &h);
+
+  vv_sub_scaled(&base, &p0, c, &v3);
+
+  vv_add_scaled(&h, &base, e, &v2);
+  vv_sub_scaled(&h, &h, b, &v1);
+  vv_store(batch, 1, i, &h);
+
+  vv_sub_scaled(&h, &base, e, &v2);
+  vv_sub_scaled(&h, &h, b, &v1);
+  vv_store(batch, 2, i, &h);
+}
+
+static void kernel_ch(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i), len, m;
+  vvec p0, c0, c1, c2, rcent, v1, v2, normal;
+
+
+  vv_load(&p0, batch, 0, i);
+  vv_load(&c0, batch, 1, i);
+  vv_load(&c1, batch, 2, i);
+  vv_load(&c2, batch, 3, i);
+
+  vv_add(&rcent, &c0, &c1);
+  vv_add(&rcent, &rcent, &c2);
+  vv_div(&rcent, &rcent, vf_set1(3.0f));
+  vv_sub(&rcent, &p0, &rcent);
+
+  len = vv_len(&rcent);
+  vv_div(&rcent, &rcent, len);
+
+  /* a "short" vector means the control atoms surround the heavy atom in a
+     plane, take the normal of that plane instead */
+  vv_sub(&v1, &c1, &c0);
+  vv_sub(&v2, &c2, &c0);
+  vv_cross(&normal, &v1, &v2);
+  vv_div(&normal, &normal, vv_len(&normal));
+
+  m = vf_lt(len, vf_set1(0.2f));
+  rcent.x = vf_select(m, normal.x, rcent.x);
+  rcent.y = vf_select(m, normal.y, rcent.y);
+  rcent.z = vf_select(m, normal.z, rcent.z);
+
+  vv_add_scaled(&v1, &p0, d, &rcent);
+  vv_store(batch, 0, i, &v1);
+}
+
+static void kernel_ch2(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i);
+  vvec p0, c0, c1, rcent, v1, v2, v3, h;
+
+
+  vv_load(&p0, batch, 0, i);
+  vv_load(&c0, batch, 1, i);
+  vv_load(&c1, batch, 2, i);
+
+  vv_add(&rcent, &c0, &c1);
+  vv_div(&rcent, &rcent, vf_set1(2.0f));
+  vv_sub(&rcent, &p0, &rcent);
+
+  vv_sub(&v1, &p0, &c0);
+  vv_sub(&v2, &p0, &c1);
+  vv_cross(&v3, &v1, &v2);
+
+  vv_div(&rcent, &rcent, vv_len(&rcent));
+  vv_scale(&rcent, vf_set1(COS_tetra_h), &rcent);
+  vv_div(&v3, &v3, vv_len(&v3));
+  vv_scale(&v3, vf_set1(SIN_tetra_h), &v3);
+
+  vv_add(&v1, &rcent, &v3);
+  vv_add_scaled(&h, &p0, d, &v1);
+  vv_store(batch, 0, i, &h);
+
+  vv_sub(&v1, &rcent, &v3);
+  vv_add_scaled(&h, &p0, d, &v1);
+  vv_store(batch, 1, i, &h);
+}
+
+// FIXME: we may want to use a better scheme...
+static void kernel_water(const hplace_batch *batch, unsigned int i)
+{
+  vfloat d = vf_load(batch->in[HPLACE_DIST] + i);
+  vvec p0, h;
+
+
+  vv_load(&p0, batch, 0, i);
+
+  h.x = vf_add(p0.x, vf_mul(d, vf_set1(SIN_theta1 * COS_phi)));
+  h.y = vf_add(p0.y, vf_mul(d, vf_set1(SIN_theta1 * SIN_phi)));
+  h.z = vf_add(p0.z, vf_mul(d, vf_set1(COS_theta1)));
+  vv_store(batch, 0, i, &h);
+
+  h.x = vf_add(p0.x, vf_mul(d, vf_set1(SIN_theta2 * COS_phi)));
+  h.y = vf_add(p0.y, vf_mul(d, vf_set1(SIN_theta2 * SIN_phi)));
+  h.z = vf_sub(p0.z, vf_mul(d, vf_set1(COS_theta2)));
+  vv_store(batch, 1, i, &h);
+}
+
+
+static const struct {
+  kernel_fn kernel;
+  unsigned int nhyd;
+} kernels[HPLACE_NTYPES] = {
+  [1] = {kernel_planar, 1},	/* planar hydrogens */
+  [2] = {kernel_oh, 1},		/* hydrogen bound to O or S */
+  [3] = {kernel_nh2, 2},	/* two planar hydrogens */
+  [4] = {kernel_methyl, 3},	/* three tetrahedal hydrogens */
+  [5] = {kernel_ch, 1},		/* one tetrahedral hydrogen */
+  [6] = {kernel_ch2, 2},	/* two tetrahedral hydrogens */
+  [10] = {kernel_water, 2}	/* 3 point water (as TIP3P) */
+};
+
+
+/*
+ * hplace_nhyd: number of hydrogens a bonding type places
+ *
+ * in:  bonding type
+ * out: number of hydrogens, 0 for an unknown type
+ *
+ */
+
+unsigned int hplace_nhyd(unsigned int type)
+{
+  return type < HPLACE_NTYPES ? kernels[type].nhyd : 0;
+}
+
+
+/*
+ * hplace_isa: instruction set the kernels were compiled for
+ *
+ * out: name
+ *
+ */
+
+const char *hplace_isa(void)
+{
+  return VF_ISA;
+}
+
+
+/*
+ * hplace_init: set up an empty batch
+ *
+ * in:  batch, bonding type
+ *
+ */
+
+void hplace_init(hplace_batch *batch, unsigned int type)
+{
+  batch->type = type;
+  batch->n = 0;
+  batch->size = 0;
+  batch->idx = NULL;
+  batch->nhyd = NULL;
+
+  for (unsigned int c = 0; c < HPLACE_IN; c++) {
+    batch->in[c] = NULL;
+  }
+
+  for (unsigned int c = 0; c < HPLACE_OUT; c++) {
+    batch->out[c] = NULL;
+  }
+}
+
+
+/*
+ * hplace_push: add a placement to a batch, the columns always have room for
+ *              a full vector beyond the last placement
+ *
+ * in:  batch, store slot of the first hydrogen, number of hydrogens, heavy
+ *      atom, control atoms, number of control atoms, X-H distance
+ *
+ */
+
+void hplace_push(hplace_batch *batch, unsigned int idx, unsigned int nhyd,
+		 const fvec atom0, fvec *ctrl, unsigned int nctrl,
+		 float dist)
+{
+  unsigned int c, k, n = batch->n;
+
+
+  if (n + VF_LEN > batch->size) {
+    batch->size = batch->size ? 2 * batch->size : BATCH_CHUNK;
+
+    for (c = 0; c < HPLACE_IN; c++) {
+      batch->in[c] = reallocate(batch->in[c],
+				batch->size * sizeof(*batch->in[c]));
+    }
+
+    for (c = 0; c < HPLACE_OUT; c++) {
+      batch->out[c] = reallocate(batch->out[c],
+				 batch->size * sizeof(*batch->out[c]));
+    }
+
+    batch->idx = reallocate(batch->idx, batch->size * sizeof(*batch->idx));
+    batch->nhyd = reallocate(batch->nhyd,
+			     batch->size * sizeof(*batch->nhyd));
+  }
+
+  for (c = 0; c < 3; c++) {
+    batch->in[c][n] = atom0[c];
+  }
+
+  /* unused control atoms are set to the heavy atom */
+  for (k = 0; k < HPLACE_MAX_CTRL; k++) {
+    for (c = 0; c < 3; c++) {
+      batch->in[3*(k+1) + c][n] = k < nctrl ? ctrl[k][c] : atom0[c];
+    }
+  }
+
+  batch->in[HPLACE_DIST][n] = dist;
+  batch->idx[n] = idx;
+  batch->nhyd[n] = nhyd;
+  batch->n++;
+}
+
+
+/*
+ * hplace_run: compute all hydrogen positions of a batch into its output
+ *             columns, hydrogen k of placement i is at out[3*k..3*k+2][i]
+ *
+ * in:  batch
+ *
+ */
+
+void hplace_run(hplace_batch *batch)
+{
+  unsigned int c, i, n = batch->n;
+
+  kernel_fn kernel;
+
+
+  if (n == 0) {
+    return;
+  }
+
+  if (!hplace_nhyd(batch->type) ) {
+    prerror(1, "hydrogen type %d does not exist in database\n", batch->type);
+  }
+
+  kernel = kernels[batch->type].kernel;
+
+  /* pad the last vector with copies of the last placement */
+  for (i = n; i % VF_LEN; i++) {
+    for (c = 0; c < HPLACE_IN; c++) {
+      batch->in[c][i] = batch->in[c][n-1];
+    }
+  }
+
+  for (i = 0; i < n; i += VF_LEN) {
+    kernel(batch, i);
+  }
+}
+
+
+/*
+ * hplace_destroy: free the columns of a batch
+ *
+ * in:  batch
+ *
+ */
+
+void hplace_destroy(hplace_batch *batch)
+{
+  for (unsigned int c = 0; c < HPLACE_IN; c++) {
+    free(batch->in[c]);
+  }
+
+  for (unsigned int c = 0; c < HPLACE_OUT; c++) {
+    free(batch->out[c]);
+  }
+
+  free(batch->idx);
+  free(batch->nhyd);
+
+  hplace_init(batch, batch->type);
+}
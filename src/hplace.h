@@ -0,0 +1,42 @@
+/*
+ * Header file for the batched hydrogen placement kernels.
+ *
+ */
+
+
+#ifndef _HPLACE_H
+#define _HPLACE_H      1
+
+#include "util/vec.h"
+
+#define HPLACE_NTYPES 11	/* bonding types are 1-6 and 10 */
+#define HPLACE_MAX_CTRL 3
+#define HPLACE_MAX_HYD 3
+
+/* input columns: x, y, z of the heavy atom and its control atoms, distance */
+#define HPLACE_IN (3 * (1 + HPLACE_MAX_CTRL) + 1)
+#define HPLACE_DIST (HPLACE_IN - 1)
+
+/* output columns: x, y, z of each hydrogen */
+#define HPLACE_OUT (3 * HPLACE_MAX_HYD)
+
+typedef struct _hplace_batch {	/* pending placements of one bonding type */
+  unsigned int type;
+  unsigned int n, size;
+  float *in[HPLACE_IN];
+  float *out[HPLACE_OUT];
+  unsigned int *idx;		/* store slot of the first hydrogen */
+  unsigned int *nhyd;		/* hydrogens to store, the first nhyd built */
+} hplace_batch;
+
+unsigned int hplace_nhyd(unsigned int type);
+const char *hplace_isa(void);
+
+void hplace_init(hplace_batch *batch, unsigned int type);
+void hplace_push(hplace_batch *batch, unsigned int idx, unsigned int nhyd,
+		 const fvec atom0, fvec *ctrl, unsigned int nctrl,
+		 float dist);
+void hplace_run(hplace_batch *batch);
+void hplace_destroy(hplace_batch *batch);
+
+#endif
@@ -23,6 +23,8 @@
 
 #include "common.h"
 #include "pdb.h"
+#include "cif.h"
+#include "cache.h"
 #include "top.h"
 #include "ssbuild.h"
 #include "protonate.h"
@@ -30,6 +32,7 @@
 #include "config.h"
 #include "util/hashtab.h"
 #include "util/util.h"
+#include "util/parallel.h"
 
 
 #define INPUT_LINE_LEN 258
@@ -54,6 +57,14 @@ struct _opt_dict {
   bool *val;
 };
 
+struct _read_capture {
+  pr_hook hook;			/* must be first */
+  FILE *capture;		/* messages printed while reading */
+  FILE *out;
+  const pdb_metadata *meta;	/* header data read so far or NULL */
+  const char *filename;
+};
+
 
 
 /*
@@ -73,11 +84,202 @@ static int scmp(const void *p1, const void *p2)
 }
 
 
+/*
+ * altloc_filename: output file name for one alternate location, the
+ *                  indicator is inserted before the extension
+ *
+ * in:  buffer of PATH_MAX characters, output file name, alternate location
+ *
+ */
+
+static void altloc_filename(char *dest, const char *filename, char altLoc)
+{
+  size_t len = strlen(filename);
+
+  const char *base, *ext;
+
+
+  base = strrchr(filename, '/');
+  ext = strrchr(base ? base : filename, '.');
+
+  if (!ext || ext == base + 1 || ext == filename) {
+    ext = filename + len;
+  }
+
+  snprintf(dest, PATH_MAX, "%.*s_%c%s", (int) (ext - filename), filename,
+	   altLoc, ext);
+}
+
+
+/*
+ * prepare_models: select the alternate location in all models, build
+ *                 disulfide bonds, bind the topology and protonate
+ *
+ * in:  pdb root structure, alternate location, number of CYS, name for CYS
+ *      residues in disulfide bond, topology, titratable translation table,
+ *      pH
+ *
+ */
+
+static void prepare_models(pdb_root *pdb, char altLoc, int nssb,
+			   const char *ss_name, const topol_hash *top,
+			   const char *ttb_filename, float pH)
+{
+  pdb_root *model;
+
+
+  /* PROPKA works through fixed file names so models are done in turn */
+  for (model = pdb; model; model = model->next_model) {
+    pdb_select_altloc(model, altLoc);
+
+    if (!options.rssb && nssb > 1)
+      model = ssbuild(model, ss_name);
+
+    top_bind(model, top->hash_table);
+
+    if (options.prot)
+      protonate(model, top->hash_table, ttb_filename, pH);
+  }
+}
+
+
+/*
+ * read_log: copy the messages captured while reading to the output stream
+ *
+ * in:  capture file, output stream
+ * out: the messages or NULL if they cannot be retrieved
+ *
+ */
+
+static char *read_log(FILE *capture, FILE *out)
+{
+  long len;
+
+  char *log;
+
+
+  if ( (len = ftell(capture)) < 0) {
+    return NULL;
+  }
+
+  rewind(capture);
+
+  log = allocate(len + 1);
+  len = fread(log, 1, len, capture);
+  log[len] = '\0';
+
+  fwrite(log, 1, len, out);
+
+  return log;
+}
+
+
+/*
+ * read_fatal: fatal error hook while reading, the messages captured and the
+ *             header data collected so far are printed before the error
+ *
+ * in:  hook
+ *
+ */
+
+static void read_fatal(pr_hook *hook)
+{
+  const struct _read_capture *rc = (const struct _read_capture *) hook;
+
+
+  if (rc->capture) {
+    free(read_log(rc->capture, rc->out) );
+  }
+
+  if (rc->meta) {
+    prsetout(rc->out);
+    pdb_metadata_print(rc->meta, rc->filename);
+  }
+
+  fflush(rc->out);
+}
+
+
+/*
+ * read_input: read the input structure, from the cache if enabled and valid;
+ *             a structure read from file is cached together with the
+ *             messages printed while reading so that a later cache hit can
+ *             report them again
+ *
+ * in:  input file name, name for CYS residues in disulfide bond, model
+ *      number
+ * out: pdb root structure, number of CYS
+ *
+ */
+
+static pdb_root *read_input(const char *filename, const char *ss_name,
+			    int model_no, int *nssb)
+{
+  char *log;
+
+  pdb_metadata meta;
+  pdb_root *pdb = NULL;
+
+  struct _read_capture rc = {{read_fatal, prgethook()}, NULL, prout(), NULL,
+			     filename};
+
+
+  if (options.cache) {
+    pdb = cache_read(filename, ss_name, model_no, nssb);
+
+    if (pdb) {
+      return pdb;
+    }
+
+    fflush(rc.out);
+
+    /* without a capture file the structure is simply not cached */
+    if ( (rc.capture = tmpfile()) ) {
+      prsetout(rc.capture);
+    }
+  }
+
+  prsethook(&rc.hook);
+
+  if (is_cif_file(filename) )
+    pdb = cif_read(pdb, filename, ss_name, model_no, nssb);
+  else {
+    /* header notes are not lost to a fatal error in the coordinates */
+    rc.meta = &meta;
+    pdb = pdb_read(pdb, filename, ss_name, model_no, nssb, &meta);
+    rc.meta = NULL;
+
+    pdb_metadata_print(&meta, filename);
+    pdb_metadata_destroy(&meta);
+  }
+
+  prsethook(rc.hook.next);
+
+  if (!rc.capture) {
+    return pdb;
+  }
+
+  prsetout(rc.out);
+
+  if ( (log = read_log(rc.capture, rc.out)) ) {
+    cache_write(pdb, filename, ss_name, model_no, *nssb, log);
+    free(log);
+  }
+
+  fclose(rc.capture);
+
+  return pdb;
+}
+
+
 int main(int argc, char **argv)
 {
+  bool altloc_all = false;
+
   char altloc_ind = 'A';
 
   int line_cnt = 0, model_no = INT_MIN, nssb = 0;
+  unsigned int i, nlocs = 0;
 
   char pdb_in_filename[PATH_MAX] = "\0";
   char pdb_out_filename[PATH_MAX] = "\0";
@@ -85,7 +287,9 @@ int main(int argc, char **argv)
   char ttb_filename[PATH_MAX] = "\0";
   char pdb_std_out_type[PDB_TYPE_LEN] = "\0";
   char ss_name[PDB_RES_NAME_LEN] = "CYS2";
+  char altloc_out_filename[PATH_MAX];
   char buffer[INPUT_LINE_LEN];
+  char locs[UCHAR_MAX];
 
   char *progname;
   char *key, *val, *bufp, *end;
@@ -96,7 +300,7 @@ int main(int argc, char **argv)
 
   struct _opt_dict *od;
 
-  pdb_root *pdb = NULL;
+  pdb_root *pdb = NULL, *conf, *ref = NULL;
   topol_hash *top = NULL;
 
 #define X(a, b, c) {a, b},
@@ -156,13 +360,26 @@ struct _opt_dict opt_dict[] = {
       strncpy(pdb_std_out_type, val, PDB_TYPE_LEN-1);
       pdb_std_out_type[PDB_TYPE_LEN-1] = '\0';
     } else if (STREQ(key, "altloc") ) {
-      altloc_ind = *val;
+      if (STREQ(val, "all") )
+	altloc_all = true;
+      else if (STREQ(val, "occupancy") )
+	altloc_ind = PDB_ALTLOC_OCC;
+      else if (strlen(val) == 1 && isgraph((unsigned char) *val) )
+	altloc_ind = *val;
+      else
+	prerror(1, "%s: altloc must be a single character, 'occupancy' or "
+		"'all' (line %d).\n", progname, line_cnt);
     } else if (STREQ(key, "ss_name") ) {
 	if (!pdb_format_residue(ss_name, val) )
 	  prerror(1, "%s: ss_name cannot be longer than %d characters (line %d).\n",
 		  progname, PDB_RES_NAME_LEN-1, line_cnt);
     } else if (STREQ(key, "model_no") ) {
-      model_no = atoi(val);
+      if (STREQ(val, "all") )
+	model_no = PDB_ALL_MODELS;
+      else
+	model_no = atoi(val);
+    } else if (STREQ(key, "threads") ) {
+      par_set_threads(atoi(val) );
     } else if (STREQ(key, "protonate_ttb") ) {
       strncpy(ttb_filename, val, PATH_MAX-1);
       ttb_filename[PATH_MAX-1] = '\0';
@@ -210,17 +427,37 @@ struct _opt_dict opt_dict[] = {
   }
 
   top = top_read(top, top_filename);
-  pdb = pdb_read(pdb, pdb_in_filename, ss_name, model_no, &nssb);
+  pdb = read_input(pdb_in_filename, ss_name, model_no, &nssb);
+
+  if (altloc_all)
+    nlocs = pdb_altlocs(pdb, locs);
+
+  if (nlocs == 0) {
+    prepare_models(pdb, altloc_ind, nssb, ss_name, top, ttb_filename, pH);
+    hbuild_models(pdb, NULL);
+    pdb_write(pdb, pdb_out_filename, pdb_std_out_type, ss_name);
+  }
+
+  /* every conformer is a copy of the structure as read, the first one built
+     serves as reference for the residues the alternate locations leave
+     alone */
+  for (i = 0; i < nlocs; i++) {
+    conf = i < nlocs - 1 ? pdb_copy(pdb) : pdb;
 
-  if (!options.rssb && nssb > 1)
-    pdb = ssbuild(pdb, ss_name);
+    prepare_models(conf, locs[i], nssb, ss_name, top, ttb_filename, pH);
+    hbuild_models(conf, ref);
 
-  if (options.prot)
-    protonate(pdb, top->hash_table, ttb_filename, pH, altloc_ind);
+    altloc_filename(altloc_out_filename, pdb_out_filename, locs[i]);
+    pdb_write(conf, altloc_out_filename, pdb_std_out_type, ss_name);
 
-  hbuild(pdb, top->hash_table, altloc_ind);
+    if (!ref)
+      ref = conf;
+    else if (conf != pdb)
+      pdb_destroy(conf);
+  }
 
-  pdb_write(pdb, pdb_out_filename, pdb_std_out_type, ss_name, altloc_ind);
+  if (ref && ref != pdb)
+    pdb_destroy(ref);
 
   top_destroy(top);
   top = NULL;
@@ -9,7 +9,10 @@
  * ATOM/HETATM records must follow the standard closely although a slightly
  * more relaxed regime is used.  SSBOND records are read if desired, one chosen
  * MODEL can be read, TER and CRYST1 records are read.  Some of the title
- * section records and some of the REMARKs are read for output only.
+ * section records and some of the REMARKs are read for output only.  Large
+ * uncompressed files are split into line aligned chunks whose ATOM/HETATM
+ * records are decoded concurrently; assembly into chains, residues and atoms
+ * stays serial so the result does not depend on the number of threads.
  *
  *
  * $Id: pdb.c 162 2012-06-25 14:33:29Z hhl $
@@ -18,490 +21,2799 @@
 
 
 
+#define _POSIX_C_SOURCE 200809L	/* st_mtim */
+
 #include <stdio.h>
+#include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <float.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "pdb.h"
-#include "util/stack.h"
+#include "util/hashtab.h"
 #include "util/util.h"
 #include "util/zio.h"
+#include "util/parallel.h"
 
 
 #define PDB_REC_LEN 6
-#define PDB_STD_IN_FORMAT "%*6c%5c%*c%4c%c%4c%c%4i%c%*3c%8f%8f%8f%6f%6f%*6c%4c%2c%2c"
+
+/* mapped files of at least PDB_PAR_MIN_SIZE bytes are decoded concurrently in
+   line aligned chunks of about PDB_CHUNK_SIZE bytes */
+#ifndef PDB_PAR_MIN_SIZE
+#define PDB_PAR_MIN_SIZE (16 * 1024 * 1024)
+#endif
+#ifndef PDB_CHUNK_SIZE
+#define PDB_CHUNK_SIZE (4 * 1024 * 1024)
+#endif
+
+/* sidecar MODEL index, see pdb_index_models() */
+#define PDB_MIDX_SUFFIX ".midx"
+#define PDB_MIDX_MAGIC "molprep MODEL index"
+#define PDB_MIDX_VERSION 2
+#define PDB_MIDX_SPAN (1024 * 1024)	/* distance of gzip access points */
+#ifdef PDB_FIXED_COORDS
+#define PDB_STD_OUT_FORMAT "%6s%5s %4s%c%4s%c%4i%c   %8s%8s%8s%6s%6s      %-4s%2s%2s\n"
+#define PDB_MIN_OUT_FORMAT "%6s%5s %4s %4s%c%4i    %8s%8s%8s\n"
+#define PDB_NUM_LEN 16		/* formatted fixed-point number */
+#else
 #define PDB_STD_OUT_FORMAT "%6s%5s %4s%c%4s%c%4i%c   %8.3f%8.3f%8.3f%6.2f%6.2f      %-4s%2s%2s\n"
 #define PDB_MIN_OUT_FORMAT "%6s%5s %4s %4s%c%4i    %8.3f%8.3f%8.3f\n"
+#endif
 #define PDB_SSBOND_FORMAT "%*7c%3i%*5c%c%*c%3i%c%*7c%c%*c%3i%c%*23c%6c%*c%6c%*2c%5f"
 
 
 enum pdb_format_t {PDB_FMT_STD, PDB_FMT_MIN};
+/* the first six columns of a record packed for a switch */
+#define PDB_REC_KEY(a, b, c, d, e, f)					\
+  ( (uint64_t) (unsigned char) (a) << 40 |				\
+    (uint64_t) (unsigned char) (b) << 32 |				\
+    (uint64_t) (unsigned char) (c) << 24 |				\
+    (uint64_t) (unsigned char) (d) << 16 |				\
+    (uint64_t) (unsigned char) (e) << 8 | (uint64_t) (unsigned char) (f) )
+
+/* records pdb_read acts on, those after PDB_REC_HEADER only go into the
+   metadata */
+enum pdb_rec_type {
+  PDB_REC_OTHER, PDB_REC_ATOM, PDB_REC_MODEL, PDB_REC_ENDMDL, PDB_REC_TER,
+  PDB_REC_SSBOND, PDB_REC_CRYST1, PDB_REC_HEADER,
+  PDB_REC_OBSLTE, PDB_REC_TITLE, PDB_REC_SPLIT, PDB_REC_CAVEAT,
+  PDB_REC_EXPDTA, PDB_REC_NUMMDL, PDB_REC_MDLTYP, PDB_REC_REMARK
+};
+
+struct _pdb_res_index {
+  pdb_root *pdb;
+  unsigned int mask;
+  unsigned int *slots;		/* residue index + 1 in file order, 0 free */
+};
+
+typedef struct _pdb_line {
+  const char *line;
+  size_t len;
+  enum pdb_rec_type type;
+  int rec;			/* index of decoded ATOM/HETATM record or -1 */
+} pdb_line;
+
+typedef struct _pdb_chunk {
+  const char *begin;
+  const char *end;
+  pdb_line *lines;
+  unsigned int nlines;
+  unsigned int max_lines;
+  pdb_atom_rec *recs;
+  int *nfields;
+  unsigned int nrecs;
+  unsigned int max_recs;
+  unsigned int nmodels;		/* MODEL records with a serial */
+  int first_model, last_model;	/* their first and last serial */
+  bool in_model;		/* the chunk starts within a MODEL */
+  int curr_model;		/* serial of that MODEL */
+} pdb_chunk;
+
+typedef struct _pdb_input {
+  char *map;			/* memory mapped file or NULL */
+  const char *pos;
+  const char *end;
+  size_t size;
+  void *stream;			/* compressed input */
+  char buffer[PDB_LINE_LEN];
+  pdb_chunk *chunks;		/* window of concurrently decoded chunks */
+  int model_no;			/* MODEL whose records are decoded */
+  bool in_model;		/* the next window starts within a MODEL */
+  int curr_model;		/* serial of that MODEL */
+  unsigned int nchunks;		/* chunks in the window */
+  unsigned int used_chunks;	/* chunks holding data */
+  unsigned int curr_chunk;
+  unsigned int curr_line;
+  const pdb_atom_rec *rec;	/* pre-decoded record of the current line */
+  int nfields;
+  long long offset;		/* byte offset of the current line */
+} pdb_input;
+
+typedef struct _pdb_model_pos {
+  int serial;			/* MODEL serial number */
+  int line;			/* line number of the MODEL record */
+  long long offset;		/* byte offset of the MODEL record */
+} pdb_model_pos;
+
+typedef struct _pdb_model_index {
+  unsigned int nmodels;
+  pdb_model_pos *models;
+} pdb_model_index;
+
+struct _pdb_builder {
+  pdb_root *head;		/* first model, holds the title section data */
+  pdb_root *pdb;		/* model currently being filled */
+  int old_resSeq;
+  char old_iCode;
+  char old_chainID;
+  char ter_chainID;
+  char rectype;
+  bool ter_found;
+  int nssb;
+  const char *ss_name;
+};
+
+
+
+/* true if a table lies within the cache mapping of a model */
+#define PDB_IN_CACHE(pdb, ptr) ( (pdb)->cache &&			\
+				 (uintptr_t) (ptr) - (uintptr_t) (pdb)->cache \
+				 < (pdb)->cache_size )
 
 
 
 /*
- * pdb_add_atom_node: add a atom node to a link list
+ * pdb_regrow: resize a table; tables within a cache mapping are copied to
+ *             the heap instead
  *
- * in:  previous node
- * out: new node
+ * in:  pdb root structure, table, bytes in use, new size in bytes
+ * out: resized table
  *
  */
 
-static pdb_atom *pdb_add_atom_node (pdb_atom *old)
+static void *pdb_regrow(const pdb_root *pdb, void *ptr, size_t used,
+			size_t size)
 {
-  pdb_atom *new;
+  void *new;
 
 
-  new = allocate(sizeof(*new));
-  memset(new, 0, sizeof(*new));
-
-  new->next = NULL;
+  if (!PDB_IN_CACHE(pdb, ptr) ) {
+    return reallocate(ptr, size);
+  }
 
-  if (old) old->next = new;
+  new = allocate(size);
+  memcpy(new, ptr, used < size ? used : size);
 
   return new;
 }
 
 
 /*
- * pdb_insert_atom_node: insert an atom node between two nodes
+ * pdb_resize_atoms: change the number of allocated atom slots
+ *
+ * in:  pdb root structure, new number of slots
  *
- * in:  previous node
- * out: new node
  */
 
-pdb_atom *pdb_insert_atom_node (pdb_atom *old)
+static void pdb_resize_atoms(pdb_root *pdb, unsigned int size)
 {
-  pdb_atom *new;
-
+  pdb_atoms *atoms = &pdb->atoms;
+
+  size_t used = atoms->used;
+
+
+  atoms->x = pdb_regrow(pdb, atoms->x, used * sizeof(*atoms->x),
+			size * sizeof(*atoms->x));
+  atoms->y = pdb_regrow(pdb, atoms->y, used * sizeof(*atoms->y),
+			size * sizeof(*atoms->y));
+  atoms->z = pdb_regrow(pdb, atoms->z, used * sizeof(*atoms->z),
+			size * sizeof(*atoms->z));
+  atoms->occupancy = pdb_regrow(pdb, atoms->occupancy,
+				used * sizeof(*atoms->occupancy),
+				size * sizeof(*atoms->occupancy));
+  atoms->tempFactor = pdb_regrow(pdb, atoms->tempFactor,
+				 used * sizeof(*atoms->tempFactor),
+				 size * sizeof(*atoms->tempFactor));
+  atoms->info = pdb_regrow(pdb, atoms->info, used * sizeof(pdb_atom),
+			   size * sizeof(pdb_atom));
+
+  atoms->size = size;
+}
 
-  new = pdb_add_atom_node(NULL);
 
-  new->next = old->next;
-  old->next = new;
+/*
+ * pdb_move_atoms: move a range of atom slots within the store, the ranges
+ *                 may overlap
+ *
+ * in:  atom store, destination slot, source slot, number of slots
+ *
+ */
 
-  return new;
+static void pdb_move_atoms(pdb_atoms *atoms, unsigned int dest,
+			   unsigned int src, unsigned int n)
+{
+  memmove(atoms->x + dest, atoms->x + src, n * sizeof(*atoms->x));
+  memmove(atoms->y + dest, atoms->y + src, n * sizeof(*atoms->y));
+  memmove(atoms->z + dest, atoms->z + src, n * sizeof(*atoms->z));
+  memmove(atoms->occupancy + dest, atoms->occupancy + src,
+	  n * sizeof(*atoms->occupancy));
+  memmove(atoms->tempFactor + dest, atoms->tempFactor + src,
+	  n * sizeof(*atoms->tempFactor));
+  memmove(atoms->info + dest, atoms->info + src, n * sizeof(pdb_atom));
 }
 
 
 /*
- * pdb_add_residue_node: add a residue node to a link list
+ * pdb_reserve_atoms: lay out the atom store anew so that every residue is
+ *                    followed by a number of free slots for hydrogens
  *
- * in:  previous node
- * out: new node
+ * in:  pdb root structure, free slots wanted for each residue
  *
  */
 
-static pdb_residue *pdb_add_residue_node (pdb_residue *old)
+void pdb_reserve_atoms(pdb_root *pdb, const unsigned int *nfree)
 {
-  pdb_residue *new;
+  unsigned int r, n, pos = 0;
 
+  pdb_atoms old = pdb->atoms, *atoms = &pdb->atoms;
+  pdb_residue *residue;
 
-  new = allocate(sizeof(*new));
-  memset(new, 0, sizeof(*new));
 
-  new->next = NULL;
+  for (r = 0; r < pdb->nres; r++) {
+    pos += pdb->residues[r].end - pdb->residues[r].begin + nfree[r];
+  }
 
-  if (old) old->next = new;
+  atoms->used = atoms->size = pos;
+  atoms->x = allocate(pos * sizeof(*atoms->x));
+  atoms->y = allocate(pos * sizeof(*atoms->y));
+  atoms->z = allocate(pos * sizeof(*atoms->z));
+  atoms->occupancy = allocate(pos * sizeof(*atoms->occupancy));
+  atoms->tempFactor = allocate(pos * sizeof(*atoms->tempFactor));
+  atoms->info = allocate(pos * sizeof(pdb_atom));
+
+  for (r = 0, pos = 0; r < pdb->nres; r++) {
+    residue = &pdb->residues[r];
+    n = residue->end - residue->begin;
+
+    memcpy(atoms->x + pos, old.x + residue->begin, n * sizeof(*atoms->x));
+    memcpy(atoms->y + pos, old.y + residue->begin, n * sizeof(*atoms->y));
+    memcpy(atoms->z + pos, old.z + residue->begin, n * sizeof(*atoms->z));
+    memcpy(atoms->occupancy + pos, old.occupancy + residue->begin,
+	   n * sizeof(*atoms->occupancy));
+    memcpy(atoms->tempFactor + pos, old.tempFactor + residue->begin,
+	   n * sizeof(*atoms->tempFactor));
+    memcpy(atoms->info + pos, old.info + residue->begin, n * sizeof(pdb_atom));
+
+    residue->begin = pos;
+    residue->end = pos + n;
+    residue->limit = residue->end + nfree[r];
+    pos = residue->limit;
+  }
 
-  return new;
+  if (!PDB_IN_CACHE(pdb, old.x) ) {
+    free(old.x);
+    free(old.y);
+    free(old.z);
+    free(old.occupancy);
+    free(old.tempFactor);
+    free(old.info);
+  }
 }
 
 
 /*
- * pdb_add_chain_node: add a chain node to a link list
+ * pdb_insert_atoms: open blank atom slots within a residue, the free slots
+ *                   after the residue are used first and only if they do not
+ *                   suffice are the atoms of all following residues moved
  *
- * in:  previous node
- * out: new node
+ * in:  pdb root structure, residue, first slot to open, number of slots
+ * out: first opened slot
  *
  */
 
-static pdb_chain *pdb_add_chain_node (pdb_chain *old)
+unsigned int pdb_insert_atoms(pdb_root *pdb, pdb_residue *residue,
+			      unsigned int pos, unsigned int n)
 {
-  pdb_chain *new;
+  unsigned int extra, size;
 
+  pdb_atoms *atoms = &pdb->atoms;
+  pdb_residue *res, *last = pdb->residues + pdb->nres;
 
-  new = allocate(sizeof(*new));
-  memset(new, 0, sizeof(*new));
 
-  new->next = NULL;
+  if (residue->limit - residue->end < n) {
+    extra = n - (residue->limit - residue->end);
 
-  if (old) old->next = new;
+    if (atoms->used + extra > atoms->size) {
+      for (size = atoms->size ? atoms->size : 64; size < atoms->used + extra;
+	   size *= 2);
 
-  return new;
+      pdb_resize_atoms(pdb, size);
+    }
+
+    pdb_move_atoms(atoms, residue->limit + extra, residue->limit,
+		   atoms->used - residue->limit);
+
+    for (res = residue + 1; res < last; res++) {
+      res->begin += extra;
+      res->end += extra;
+      res->limit += extra;
+    }
+
+    residue->limit += extra;
+    atoms->used += extra;
+  }
+
+  pdb->natoms += n;
+
+  return pdb_open_atoms(atoms, residue, pos, n);
 }
 
 
 /*
- * pdb_format_atom: format atom entry required for PDB
+ * pdb_open_atoms: open blank atom slots within the free slots of a residue,
+ *                 nothing outside the residue is touched and the atom count
+ *                 is left to the caller, so different residues can be worked
+ *                 on concurrently
  *
- * in:  destination string, source string
- * out: 1 if error, 0 if no error
+ * in:  atom store, residue with at least n free slots, first slot to open,
+ *      number of slots
+ * out: first opened slot
  *
  */
 
-int pdb_format_atom (char *restrict dest, const char *restrict src)
+unsigned int pdb_open_atoms(pdb_atoms *atoms, pdb_residue *residue,
+			    unsigned int pos, unsigned int n)
 {
-  size_t len;
+  assert(residue->limit - residue->end >= n);
 
+  pdb_move_atoms(atoms, pos + n, pos, residue->end - pos);
+  memset(atoms->info + pos, 0, n * sizeof(pdb_atom));
 
-  strcpy(dest, "    ");
-  len = strlen(src);		// FIXME: source string may not be \0 terminated
+  residue->end += n;
 
-  switch (len) {
-  case 0:
-    *dest = '\0';
-    break;
+  return pos;
+}
 
-  case 1:
-  case 2:
-  case 3:
-    strncpy(dest + 1, src, len);
-    break;
 
-  case 4:
-    strncpy(dest, src, len);
-    break;
+/*
+ * residue_altloc: alternate location of a residue with the highest mean
+ *                 occupancy, the first one seen on a tie
+ *
+ * in:  atom store, residue
+ * out: alternate location indicator, ' ' if the residue has none
+ *
+ */
 
-  default:
-    return 1;
+static char residue_altloc(const pdb_atoms *atoms, const pdb_residue *residue)
+{
+  unsigned int a, i, nloc = 0;
+  unsigned int count[UCHAR_MAX+1];
+
+  float best = -1.0, mean;
+  float sum[UCHAR_MAX+1];
+
+  char loc, order[UCHAR_MAX+1], altLoc = ' ';
+
+
+  for (a = residue->begin; a < residue->end; a++) {
+    loc = atoms->info[a].altLoc;
+
+    if (loc == ' ') {
+      continue;
+    }
+
+    for (i = 0; i < nloc && order[i] != loc; i++)
+      ;
+
+    if (i == nloc) {
+      order[nloc++] = loc;
+      count[(unsigned char) loc] = 0;
+      sum[(unsigned char) loc] = 0.0;
+    }
+
+    count[(unsigned char) loc]++;
+    sum[(unsigned char) loc] += PDB_OCC_FLOAT(atoms->occupancy[a]);
   }
 
-  dest[PDB_ATOM_NAME_LEN-1] = '\0';
+  for (i = 0; i < nloc; i++) {
+    loc = order[i];
+    mean = sum[(unsigned char) loc] / count[(unsigned char) loc];
 
-  return 0;
+    if (mean > best) {
+      best = mean;
+      altLoc = loc;
+    }
+  }
+
+  return altLoc;
 }
 
 
 /*
- * pdb_format_resiude: format residue entry required for PDB
+ * shadow_first: check if a dropped atom is the first heavy atom of its name
+ *               in a residue, the atoms before it were either kept or are
+ *               in the shadow table already
  *
- * in:  destination string, source string
- * out: destination string or NULL if error
+ * in:  atom store, dropped atom, first and end of the kept atoms of the
+ *      residue, shadow table, first and end of the shadows of the residue
+ * out: true if no earlier heavy atom has the same name
  *
  */
 
-char *pdb_format_residue(char *restrict dest, const char *restrict src)
+static bool shadow_first(const pdb_atoms *atoms, unsigned int a,
+			 unsigned int begin, unsigned int pos,
+			 const pdb_shadow *shadows, unsigned int first,
+			 unsigned int nshadows)
 {
-  size_t len;
+  unsigned int i;
 
+  const uint32_t code = atoms->info[a].code;
 
-  len = strlen(src);		// FIXME: source string may not be \0 terminated
 
-  switch (len) {
-  case 0:
-    return NULL;
-    break;
+  for (i = begin; i < pos; i++) {
+    if (atoms->info[i].code == code && !ISHYD(atoms->info[i].element) ) {
+      return false;
+    }
+  }
 
-  case 1:
-    dest[2] = src[0];
-    dest[0] = dest[1] = dest[3] = ' ';
-    break;
-	
-  case 2:
-    dest[2] = src[1];
-    dest[1] = src[0];
-    dest[0] = dest[3] = ' ';
-    break;
+  for (i = first; i < nshadows; i++) {
+    if (shadows[i].code == code) {
+      return false;
+    }
+  }
 
-  case 3:
-    strncpy(dest, src, len);
-    dest[3] = ' ';
-    break;
+  return true;
+}
 
-  case 4:
-    strncpy(dest, src, len);
-    break;
 
-  default:    
-    return NULL;
-  }
+/*
+ * pdb_select_altloc: keep only the atoms of one alternate location and those
+ *                    without, the store is compacted in place so later
+ *                    stages see no unselected conformers; free hydrogen
+ *                    slots are dropped.  hbuild searches control atoms
+ *                    among all conformers, the first heavy atom of a name
+ *                    in file order counts, so where that one is dropped it
+ *                    is kept in the shadow table of the structure.
+ *
+ * in:  pdb root structure of one model, alternate location indicator or
+ *      PDB_ALTLOC_OCC to choose the one with the highest occupancy in each
+ *      residue
+ *
+ */
 
-  dest[PDB_RES_NAME_LEN-1] = '\0';
+void pdb_select_altloc(pdb_root *pdb, char altLoc)
+{
+  unsigned int r, a, pos = 0, nshadows = 0, max_shadows = 0;
 
-  return dest;
+  char keep;
+
+  pdb_atoms *atoms = &pdb->atoms;
+  pdb_residue *residue;
+  pdb_shadow *shadow;
+
+
+  pdb->shadows = NULL;
+
+  for (r = 0; r < pdb->nres; r++) {
+    residue = &pdb->residues[r];
+    keep = altLoc == PDB_ALTLOC_OCC ? residue_altloc(atoms, residue) : altLoc;
+
+    a = residue->begin;
+    residue->begin = pos;
+    residue->shadow_begin = nshadows;
+
+    for (; a < residue->end; a++) {
+      if (atoms->info[a].altLoc != keep && atoms->info[a].altLoc != ' ') {
+	if (!ISHYD(atoms->info[a].element) &&
+	    shadow_first(atoms, a, residue->begin, pos, pdb->shadows,
+			 residue->shadow_begin, nshadows) ) {
+	  if (nshadows >= max_shadows) {
+	    max_shadows = max_shadows ? 2 * max_shadows : 64;
+	    pdb->shadows = reallocate(pdb->shadows,
+				      max_shadows * sizeof(*pdb->shadows));
+	  }
+
+	  shadow = &pdb->shadows[nshadows++];
+	  shadow->code = atoms->info[a].code;
+	  shadow->x = atoms->x[a];
+	  shadow->y = atoms->y[a];
+	  shadow->z = atoms->z[a];
+	}
+
+	continue;
+      }
+
+      if (a != pos) {
+	pdb_move_atoms(atoms, pos, a, 1);
+      }
+
+      pos++;
+    }
+
+    residue->end = residue->limit = pos;
+    residue->shadow_end = nshadows;
+  }
+
+  atoms->used = pdb->natoms = pos;
 }
 
 
 /*
- * extrdat: move past white-space of a string, remove trailing white-space
+ * pdb_altlocs: the alternate location indicators found in a structure
  *
- * in:  string, offset
- * out: pointer to first non-space
+ * in:  pdb root structure, buffer for UCHAR_MAX indicators
+ * out: number of indicators stored in the order first seen
  *
  */
 
-static char *extrdat(char *pos)
+unsigned int pdb_altlocs(const pdb_root *pdb, char *locs)
 {
-  char *end;
+  unsigned int a, i, nloc = 0;
 
-  pos = pos + strspn(pos, " ");
-  end = pos + strlen(pos);
+  char loc;
 
-  while (isspace((unsigned char) *--end) && end >= pos) {
-    *end = '\0';
+  const pdb_root *model;
+
+
+  for (model = pdb; model; model = model->next_model) {
+    for (a = 0; a < model->atoms.used; a++) {
+      loc = model->atoms.info[a].altLoc;
+
+      if (loc == ' ' || loc == '\0') {
+	continue;
+      }
+
+      for (i = 0; i < nloc && locs[i] != loc; i++)
+	;
+
+      if (i == nloc) {
+	locs[nloc++] = loc;
+      }
+    }
   }
 
-  return pos;
+  return nloc;
 }
 
 
+/*
+ * pdb_copy_residue: replace the atoms of a residue by those of a residue in
+ *                   another copy of the model, as pdb_open_atoms only the
+ *                   residue itself is touched
+ *
+ * in:  atom store, residue with room for the source atoms, source atom
+ *      store, source residue
+ * out: change in the number of atoms
+ *
+ */
+
+int pdb_copy_residue(pdb_atoms *atoms, pdb_residue *residue,
+		     const pdb_atoms *from, const pdb_residue *source)
+{
+  unsigned int n, have;
+
+
+  n = source->end - source->begin;
+  have = residue->end - residue->begin;
+
+  assert(residue->begin + n <= residue->limit);
+
+  residue->end = residue->begin + n;
+
+  memcpy(atoms->x + residue->begin, from->x + source->begin,
+	 n * sizeof(*atoms->x));
+  memcpy(atoms->y + residue->begin, from->y + source->begin,
+	 n * sizeof(*atoms->y));
+  memcpy(atoms->z + residue->begin, from->z + source->begin,
+	 n * sizeof(*atoms->z));
+  memcpy(atoms->occupancy + residue->begin, from->occupancy + source->begin,
+	 n * sizeof(*atoms->occupancy));
+  memcpy(atoms->tempFactor + residue->begin, from->tempFactor + source->begin,
+	 n * sizeof(*atoms->tempFactor));
+  memcpy(atoms->info + residue->begin, from->info + source->begin,
+	 n * sizeof(pdb_atom));
+
+  return (int) n - (int) have;
+}
+
 
 /*
- * pdb_read: read and analyse ATOM/HETATM, SSBOND, TER, and CRYST1 records from
- *           a file
+ * pdb_copy: deep copy of a structure with all its models, the copy never
+ *           refers to a cache mapping
  *
- * in:  pdb structure, PDB file name, name for CYS residues in disulfide bond,
- *      alternate location indicator, chosen model number, counter for S-S bonds
- * out: pdb root structure
+ * in:  pdb root structure
+ * out: new pdb root structure
  *
  */
 
-pdb_root *pdb_read(pdb_root *pdb, const char *filename, const char* ss_name,
-		   int model_no, int *nssb)
+#define PDB_DUP(ptr, n) memcpy(allocate((n) * sizeof(*(ptr)) ), (ptr),	\
+			       (n) * sizeof(*(ptr)) )
+
+pdb_root *pdb_copy(const pdb_root *pdb)
 {
-  int atom_cnt = 0, residue_cnt = 0, chain_cnt = 0, line_cnt = 0;
-  int resSeq, old_resSeq = INT_MIN, curr_model_no, gap;
-  int serNum, seqNum1, seqNum2, nss = 0, nfields;
+  unsigned int nss = 0, n;
 
-  bool new_chain = false, new_residue = false;
-  bool ter_found = false, model_found = false, ss_found = false;
-  bool mdltyp_found = false, caveat_found = false;
-  bool fr465 = false, fr470 = false, fr475 = false, fr480 = false;
+  pdb_root *copy;
+  const pdb_atoms *atoms = &pdb->atoms;
 
-  char altLoc, iCode, old_iCode = '\0', chainID;
-  char old_chainID = '\0', ter_chainID = '\0', curr_rectype = '\0';
-  char chainID1, chainID2, icode1, icode2;
-  char *pos, *res_name, *end;
 
-  float x, y, z, occupancy, tempFactor;
-  float Length, f;
+  copy = allocate(sizeof(*copy) );
+  *copy = *pdb;
 
-  char serial[PDB_SERIAL_LEN], name[PDB_ATOM_NAME_LEN], segID[PDB_SEG_NAME_LEN];
-  char element[PDB_ELEMENT_LEN], charge[PDB_CHARGE_LEN];
-  char SymOP1[PDB_SSBOND_SYMOP_LEN], SymOP2[PDB_SSBOND_SYMOP_LEN];
-  char resName[PDB_RES_NAME_LEN];
-  char buffer[PDB_LINE_LEN];
+  copy->chains = PDB_DUP(pdb->chains, pdb->nchains);
+  copy->residues = PDB_DUP(pdb->residues, pdb->nres);
+  copy->max_chains = pdb->nchains;
+  copy->max_res = pdb->nres;
 
-  FILE *pdb_stream;
+  n = atoms->used;
+  copy->atoms.size = n;
+  copy->atoms.x = PDB_DUP(atoms->x, n);
+  copy->atoms.y = PDB_DUP(atoms->y, n);
+  copy->atoms.z = PDB_DUP(atoms->z, n);
+  copy->atoms.occupancy = PDB_DUP(atoms->occupancy, n);
+  copy->atoms.tempFactor = PDB_DUP(atoms->tempFactor, n);
+  copy->atoms.info = PDB_DUP(atoms->info, n);
+
+  if (pdb->shadows) {
+    n = pdb->nres ? pdb->residues[pdb->nres-1].shadow_end : 0;
+    copy->shadows = PDB_DUP(pdb->shadows, n);
+  }
 
-  Stack *occ_warn = NULL;
+  if (pdb->ssbonds) {
+    while (pdb->ssbonds[nss]) {
+      nss++;
+    }
 
-  pdb_atom *old_atom, *curr_atom = NULL;
-  pdb_residue *old_residue, *curr_residue = NULL;
-  pdb_chain *old_chain, *curr_chain = NULL;
+    copy->ssbonds = allocate((nss+1) * sizeof(*copy->ssbonds));
+    copy->ssbonds[nss] = NULL;
 
-  pdb_ssbond *ssbond, **ssbonds;
+    while (nss--) {
+      copy->ssbonds[nss] = PDB_DUP(pdb->ssbonds[nss], 1);
+    }
+  }
 
+  copy->cache = NULL;
+  copy->cache_size = 0;
+  copy->next_model = pdb->next_model ? pdb_copy(pdb->next_model) : NULL;
 
+  return copy;
+}
 
-  if (!(pdb_stream = fzopen(filename, "r")) ) {
-    perror(filename);
-    exit(2);
+#undef PDB_DUP
+
+
+/*
+ * pdb_name_code: pack an atom or residue name into an integer, characters
+ *                after the end of a short name count as zero
+ *
+ * in:  name
+ * out: code
+ *
+ */
+
+uint32_t pdb_name_code(const char *name)
+{
+  char c[PDB_ATOM_NAME_LEN-1] = {'\0'};
+
+
+  for (unsigned int i = 0; i < PDB_ATOM_NAME_LEN-1 && name[i]; i++) {
+    c[i] = name[i];
   }
 
-  pdb = allocate(sizeof(*pdb) );
-  pdb->model_no = 0;
-  pdb->ID[0] = '\0';
-  pdb->cryst1[0] = '\0';
-  pdb->ssbonds = NULL;
-  pdb->first_chain = NULL;
+  return PDB_NAME_CODE(c[0], c[1], c[2], c[3]);
+}
 
-  *nssb = 0;
 
-  occ_warn = stack_init(occ_warn);
+/*
+ * pdb_set_res_name: change the name of a residue and its code
+ *
+ * in:  residue, new name
+ *
+ */
 
+void pdb_set_res_name(pdb_residue *residue, const char *name)
+{
+  strncpy(residue->resName, name, PDB_RES_NAME_LEN-1);
+  residue->resName[PDB_RES_NAME_LEN-1] = '\0';
+  residue->code = pdb_name_code(residue->resName);
+}
 
-  while (fzgets(pdb_stream, buffer, PDB_LINE_LEN) ) {
-    line_cnt++;
-    delnl(buffer);		/* fgets stores the newline */
 
-    if (STRNEQ(buffer, "ATOM", 4) || STRNEQ(buffer, "HETATM", 6)) {
-      if (model_found && curr_model_no != model_no) {
-	continue;
-      }
+/*
+ * pdb_set_atom_name: change the name of an atom and its code
+ *
+ * in:  atom, new name
+ *
+ */
 
-      serial[0] = name[0] = resName[0] = segID[0] = element[0] =
-	charge[0] = '\0';
-      altLoc = chainID = iCode = ' ';
-      resSeq = 0;
-      x = y = z = occupancy = tempFactor = 0.0;
+void pdb_set_atom_name(pdb_atom *atom, const char *name)
+{
+  strncpy(atom->name, name, PDB_ATOM_NAME_LEN-1);
+  atom->name[PDB_ATOM_NAME_LEN-1] = '\0';
+  atom->code = pdb_name_code(atom->name);
+}
 
-      nfields = sscanf(buffer, PDB_STD_IN_FORMAT,
-		       serial, name, &altLoc, resName, &chainID, &resSeq,
-		       &iCode, &x, &y, &z, &occupancy, &tempFactor,
-		       segID, element, charge);
 
-      if (nfields < 10) {
-	prerror(2, "%s: only %d ATOM/HETATM fields read successfully in line %d"
-		"but expected at least 10.\n", filename, nfields, line_cnt);
-      }
+/*
+ * res_key_hash: hash of the residue key used by the residue index
+ *
+ * in:  chain ID, residue sequence number
+ * out: hash value
+ *
+ */
 
-      if (ishydrogen(element, name) ) {
-	if (options.remh) {
-	  continue;
-	} else {
-	  strcpy(element, " H"); // tag hydrogens
-	}
-      }
+static unsigned int res_key_hash(char chainID, int resSeq)
+{
+  uint32_t h = (uint32_t) resSeq * 2654435761U ^
+    (uint32_t) (unsigned char) chainID * 0x9e3779b9U;
 
-      resName[PDB_RES_NAME_LEN-1] = '\0';
 
-      if (chainID != old_chainID ||
-	  (ter_found && ter_chainID != old_chainID) ) {
-	old_chain = curr_chain;
-	curr_chain = pdb_add_chain_node(old_chain);
+  return h ^ h >> 15;
+}
 
-	curr_chain->chainID = chainID;
 
-	if (atom_cnt == 0) {
-	  pdb->first_chain = curr_chain;
-	}
+/*
+ * pdb_res_index_init: index the residues of a model by chain ID and sequence
+ *                     number for constant time lookup, the model must not
+ *                     gain or lose residues while the index is in use
+ *
+ * in:  pdb root structure of one model
+ * out: residue index
+ *
+ */
 
-	new_chain = true;
-      }
+pdb_res_index *pdb_res_index_init(pdb_root *pdb)
+{
+  unsigned int r, slot;
 
-      if (new_chain || resSeq != old_resSeq ||
-	  iCode != old_iCode) {	// if new res
-	if (options.warnocc && !stack_is_empty(occ_warn) ) {
-	  prwarn("very low occupancy for atoms in residue %s %d%c %c: ",
-		 curr_residue->resName, curr_residue->resSeq,
-		 curr_residue->iCode, curr_chain->chainID);
+  const pdb_residue *residue;
 
-	  while ( (res_name = stack_pop(occ_warn)) ) {
-	    fprintf(stdout, " %s", (char *)res_name);
-	  }
+  pdb_res_index *index;
 
-	  fprintf(stdout, "\n");
-	}
 
-	old_residue = curr_residue;
+  index = allocate(sizeof(*index));
+  index->pdb = pdb;
+  index->mask = (hibit(pdb->nres + 1) << 2) - 1;
+  index->slots = allocate( (index->mask + 1) * sizeof(*index->slots));
+
+  memset(index->slots, 0, (index->mask + 1) * sizeof(*index->slots));
+
+  /* linear probing keeps equal keys in file order along the probe sequence */
+  for (r = 0; r < pdb->nres; r++) {
+    residue = &pdb->residues[r];
+    slot = res_key_hash(pdb->chains[residue->chain].chainID, residue->resSeq) &
+      index->mask;
+
+    while (index->slots[slot]) {
+      slot = (slot + 1) & index->mask;
+    }
+
+    index->slots[slot] = r + 1;
+  }
+
+  return index;
+}
+
+
+/*
+ * pdb_res_index_find: find the next residue with chain ID and sequence
+ *                     number, insertion codes are left to the caller
+ *
+ * in:  residue index, chain ID, residue sequence number, residue found last
+ *      or NULL to start with the first one in the file
+ * out: residue or NULL if there are no more
+ *
+ */
+
+pdb_residue *pdb_res_index_find(const pdb_res_index *index, char chainID,
+				int resSeq, const pdb_residue *after)
+{
+  unsigned int slot, r;
+
+  const unsigned int first = after ? after - index->pdb->residues + 1 : 0;
+
+  pdb_residue *residue;
+
+
+  slot = res_key_hash(chainID, resSeq) & index->mask;
+
+  for (; index->slots[slot]; slot = (slot + 1) & index->mask) {
+    r = index->slots[slot] - 1;
+    residue = &index->pdb->residues[r];
+
+    if (r >= first && residue->resSeq == resSeq &&
+	index->pdb->chains[residue->chain].chainID == chainID) {
+      return residue;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * pdb_res_index_destroy: free a residue index
+ *
+ * in:  residue index
+ *
+ */
+
+void pdb_res_index_destroy(pdb_res_index *index)
+{
+  if (index) {
+    free(index->slots);
+    free(index);
+  }
+}
+
+
+/*
+ * pdb_format_atom: format atom entry required for PDB
+ *
+ * in:  destination string, source string
+ * out: 1 if error, 0 if no error
+ *
+ */
+
+int pdb_format_atom (char *restrict dest, const char *restrict src)
+{
+  size_t len;
+
+
+  strcpy(dest, "    ");
+  len = strlen(src);		// FIXME: source string may not be \0 terminated
+
+  switch (len) {
+  case 0:
+    *dest = '\0';
+    break;
+
+  case 1:
+  case 2:
+  case 3:
+    strncpy(dest + 1, src, len);
+    break;
+
+  case 4:
+    strncpy(dest, src, len);
+    break;
+
+  default:
+    return 1;
+  }
+
+  dest[PDB_ATOM_NAME_LEN-1] = '\0';
+
+  return 0;
+}
+
+
+/*
+ * pdb_format_resiude: format residue entry required for PDB
+ *
+ * in:  destination string, source string
+ * out: destination string or NULL if error
+ *
+ */
+
+char *pdb_format_residue(char *restrict dest, const char *restrict src)
+{
+  size_t len;
+
+
+  len = strlen(src);		// FIXME: source string may not be \0 terminated
+
+  switch (len) {
+  case 0:
+    return NULL;
+    break;
+
+  case 1:
+    dest[2] = src[0];
+    dest[0] = dest[1] = dest[3] = ' ';
+    break;
+	
+  case 2:
+    dest[2] = src[1];
+    dest[1] = src[0];
+    dest[0] = dest[3] = ' ';
+    break;
+
+  case 3:
+    strncpy(dest, src, len);
+    dest[3] = ' ';
+    break;
+
+  case 4:
+    strncpy(dest, src, len);
+    break;
+
+  default:    
+    return NULL;
+  }
+
+  dest[PDB_RES_NAME_LEN-1] = '\0';
+
+  return dest;
+}
+
+
+/*
+ * extrdat: move past white-space of a string, remove trailing white-space
+ *
+ * in:  string, offset
+ * out: pointer to first non-space
+ *
+ */
+
+static char *extrdat(char *pos)
+{
+  char *end;
+
+  pos = pos + strspn(pos, " ");
+  end = pos + strlen(pos);
+
+  while (isspace((unsigned char) *--end) && end >= pos) {
+    *end = '\0';
+  }
+
+  return pos;
+}
+
+
+
+/*
+ * scan_decimal: accumulate the digits of a fixed-point decimal field like the
+ *               %8.3f coordinates or the %6.2f occupancies into an integer
+ *               mantissa
+ *
+ * in:  start of field, field width, pointers to mantissa, number of
+ *      fractional digits and sign
+ * out: false for unusual input which is left to the caller
+ *
+ */
+
+static bool scan_decimal(const char *field, size_t width, long *mant,
+			 unsigned int *nfrac, bool *neg)
+{
+  unsigned int ndigits = 0;
+
+  const char *pos = field, *last = field + width;
+
+
+  *mant = 0;
+  *nfrac = 0;
+  *neg = false;
+
+  while (pos < last && *pos == ' ') {
+    pos++;
+  }
+
+  if (pos < last && (*pos == '-' || *pos == '+') ) {
+    *neg = *pos == '-';
+    pos++;
+  }
+
+  for (; pos < last && isdigit((unsigned char) *pos); pos++, ndigits++) {
+    *mant = 10 * *mant + (*pos - '0');
+  }
+
+  if (pos < last && *pos == '.') {
+    for (pos++; pos < last && isdigit((unsigned char) *pos); pos++) {
+      *mant = 10 * *mant + (*pos - '0');
+      (*nfrac)++;
+    }
+  }
+
+  while (pos < last && *pos == ' ') {
+    pos++;
+  }
+
+  return pos == last && ndigits + *nfrac > 0 && *nfrac < 10;
+}
+
+
+/*
+ * field_copy: copy a field into a string for the conversion functions of the
+ *             C library
+ *
+ * in:  buffer of PDB_LINE_LEN chars, start of field, field width
+ * out: false if the field does not fit
+ *
+ */
+
+static bool field_copy(char *tmp, const char *field, size_t width)
+{
+  if (width >= PDB_LINE_LEN) {
+    return false;
+  }
+
+  memcpy(tmp, field, width);
+  tmp[width] = '\0';
+
+  return true;
+}
+
+
+#ifdef PDB_FIXED_COORDS
+/*
+ * scan_scaled: convert a fixed-point decimal field to an integer in units of
+ *              10^-ndec, exact for up to ndec decimals
+ *
+ * in:  start of field, field width, number of decimals, pointer to result
+ * out: true if a number was converted, false otherwise
+ *
+ */
+
+static bool scan_scaled(const char *field, size_t width, unsigned int ndec,
+			long *val)
+{
+  unsigned int nfrac;
+  long mant;
+
+  bool neg;
+
+  char tmp[PDB_LINE_LEN], *end;
+
+  double d;
+
+
+  if (scan_decimal(field, width, &mant, &nfrac, &neg) && nfrac <= ndec) {
+    for (; nfrac < ndec; nfrac++) {
+      mant *= 10;
+    }
+
+    *val = neg ? -mant : mant;
+
+    return true;
+  }
+
+  if (!field_copy(tmp, field, width) ) {
+    return false;
+  }
+
+  d = strtod(tmp, &end);
+
+  if (end == tmp) {
+    return false;
+  }
+
+  for (; ndec > 0; ndec--) {
+    d *= 10.0;
+  }
+
+  *val = lrint(d);
+
+  return true;
+}
+#else
+/*
+ * scan_fixed: convert a fixed-point decimal field to a float, the mantissa
+ *             is scaled in one division; unusual input is left to strtof(3)
+ *
+ * in:  start of field, field width, pointer to result
+ * out: true if a number was converted, false otherwise
+ *
+ */
+
+static bool scan_fixed(const char *field, size_t width, float *val)
+{
+  /* mantissa / 10^n is correctly rounded for the few digits of a PDB field */
+  static const double pow10[] = {1.0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5,
+				 1.0e6, 1.0e7, 1.0e8, 1.0e9};
+
+  unsigned int nfrac;
+  long mant;
+
+  bool neg;
+
+  char tmp[PDB_LINE_LEN], *end;
+
+  double d;
+
+
+  if (scan_decimal(field, width, &mant, &nfrac, &neg) ) {
+    d = mant / pow10[nfrac];
+    *val = (float) (neg ? -d : d);	/* keep -0.000 as in the input */
+
+    return true;
+  }
+
+  if (!field_copy(tmp, field, width) ) {
+    return false;
+  }
+
+  *val = strtof(tmp, &end);
+
+  return end != tmp;
+}
+#endif
+
+
+/*
+ * scan_coord, scan_occ, scan_bfac: convert coordinate, occupancy and B-factor
+ *                                  fields to their stored representation
+ *
+ * in:  start of field, field width, pointer to result
+ * out: true if a number was converted, false otherwise
+ *
+ */
+
+static bool scan_coord(const char *field, size_t width, pdb_coord *val)
+{
+#ifdef PDB_FIXED_COORDS
+  long l;
+
+  if (!scan_scaled(field, width, 3, &l) ) {
+    return false;
+  }
+
+  *val = (pdb_coord) l;
+
+  return true;
+#else
+  return scan_fixed(field, width, val);
+#endif
+}
+
+static bool scan_occ(const char *field, size_t width, pdb_occ *val)
+{
+#ifdef PDB_FIXED_COORDS
+  long l;
+
+  if (!scan_scaled(field, width, 2, &l) ) {
+    return false;
+  }
+
+  *val = (pdb_occ) (l > INT16_MAX ? INT16_MAX : l < INT16_MIN ? INT16_MIN : l);
+
+  return true;
+#else
+  return scan_fixed(field, width, val);
+#endif
+}
+
+static bool scan_bfac(const char *field, size_t width, pdb_bfac *val)
+{
+#ifdef PDB_FIXED_COORDS
+  long l;
+
+  if (!scan_scaled(field, width, 2, &l) ) {
+    return false;
+  }
+
+  *val = (pdb_bfac) l;
+
+  return true;
+#else
+  return scan_fixed(field, width, val);
+#endif
+}
+
+
+/*
+ * scan_int: convert a right-justified integer field
+ *
+ * in:  start of field, field width, pointer to result
+ * out: true if a number was converted, false otherwise
+ *
+ */
+
+static bool scan_int(const char *field, size_t width, int *val)
+{
+  int n = 0;
+
+  bool neg = false, found = false;
+
+  const char *pos = field, *last = field + width;
+
+
+  while (pos < last && *pos == ' ') {
+    pos++;
+  }
+
+  if (pos < last && (*pos == '-' || *pos == '+') ) {
+    neg = *pos == '-';
+    pos++;
+  }
+
+  for (; pos < last && isdigit((unsigned char) *pos); pos++) {
+    n = 10 * n + (*pos - '0');
+    found = true;
+  }
+
+  if (found) {
+    *val = neg ? -n : n;
+  }
+
+  return found;
+}
+
+
+/*
+ * pdb_scan_atom: decode an ATOM/HETATM record by column position
+ *
+ * Fields are extracted in record order and decoding stops at the first field
+ * which is either missing because the line is too short or which cannot be
+ * converted.  Fields not decoded keep their defaults.
+ *
+ * in:  record to be filled, line (need not be NUL terminated), line length
+ * out: number of fields successfully decoded
+ *
+ */
+
+#define FIELD_AVAIL(off, width) ( len > (off) ? \
+				  ( len - (off) < (width) ? len - (off) : \
+				    (width) ) : 0 )
+
+int pdb_scan_atom(pdb_atom_rec *rec, const char *line, size_t len)
+{
+  int nfields = 0;
+
+
+  rec->rectype = len > 0 ? line[0] : '\0';
+  rec->serial[0] = rec->name[0] = rec->resName[0] = rec->segID[0] =
+    rec->element[0] = rec->charge[0] = '\0';
+  rec->altLoc = rec->chainID = rec->iCode = ' ';
+  rec->resSeq = 0;
+  rec->x = rec->y = rec->z = 0;
+  rec->occupancy = 0;
+  rec->tempFactor = 0;
+
+  /* columns 1-6 record name, 7-11 serial, 12 blank */
+  if (len < 11) return nfields;
+  memcpy(rec->serial, line + 6, PDB_SERIAL_LEN-1);
+  rec->serial[PDB_SERIAL_LEN-1] = '\0';
+  nfields++;
+
+  /* columns 13-16 atom name, 17 altLoc */
+  if (len < 16) return nfields;
+  memcpy(rec->name, line + 12, PDB_ATOM_NAME_LEN-1);
+  rec->name[PDB_ATOM_NAME_LEN-1] = '\0';
+  nfields++;
+
+  if (len < 17) return nfields;
+  rec->altLoc = line[16];
+  nfields++;
+
+  /* columns 18-21 residue name (PDB: 18-20), 22 chainID */
+  if (len < 21) return nfields;
+  memcpy(rec->resName, line + 17, PDB_RES_NAME_LEN-1);
+  rec->resName[PDB_RES_NAME_LEN-1] = '\0';
+  nfields++;
+
+  if (len < 22) return nfields;
+  rec->chainID = line[21];
+  nfields++;
+
+  /* columns 23-26 resSeq, 27 iCode, 28-30 blank */
+  if (!scan_int(line + 22, FIELD_AVAIL(22, 4), &rec->resSeq) ) return nfields;
+  nfields++;
+
+  if (len < 27) return nfields;
+  rec->iCode = line[26];
+  nfields++;
+
+  /* columns 31-54 coordinates, 55-60 occupancy, 61-66 tempFactor */
+  if (!scan_coord(line + 30, FIELD_AVAIL(30, 8), &rec->x) ) return nfields;
+  nfields++;
+
+  if (!scan_coord(line + 38, FIELD_AVAIL(38, 8), &rec->y) ) return nfields;
+  nfields++;
+
+  if (!scan_coord(line + 46, FIELD_AVAIL(46, 8), &rec->z) ) return nfields;
+  nfields++;
+
+  if (!scan_occ(line + 54, FIELD_AVAIL(54, 6), &rec->occupancy) )
+    return nfields;
+  nfields++;
+
+  if (!scan_bfac(line + 60, FIELD_AVAIL(60, 6), &rec->tempFactor) )
+    return nfields;
+  nfields++;
+
+  /* columns 67-72 blank, 73-76 segID, 77-78 element, 79-80 charge */
+  if (len < 76) return nfields;
+  memcpy(rec->segID, line + 72, PDB_SEG_NAME_LEN-1);
+  rec->segID[PDB_SEG_NAME_LEN-1] = '\0';
+  nfields++;
+
+  if (len < 78) return nfields;
+  memcpy(rec->element, line + 76, PDB_ELEMENT_LEN-1);
+  rec->element[PDB_ELEMENT_LEN-1] = '\0';
+  nfields++;
+
+  if (len < 80) return nfields;
+  memcpy(rec->charge, line + 78, PDB_CHARGE_LEN-1);
+  rec->charge[PDB_CHARGE_LEN-1] = '\0';
+  nfields++;
+
+  return nfields;
+}
+
+#undef FIELD_AVAIL
+
+
+/*
+ * record_type: classify a record by its name, short lines count as padded
+ *              with blanks
+ *
+ * in:  line (need not be NUL terminated), line length
+ * out: record type
+ *
+ */
+
+static enum pdb_rec_type record_type(const char *line, size_t len)
+{
+  unsigned int i;
+
+  uint64_t key = 0;
+
+
+  for (i = 0; i < 6; i++) {
+    key = key << 8 | (i < len ? (unsigned char) line[i] : ' ');
+  }
+
+  switch (key) {
+  case PDB_REC_KEY('A', 'T', 'O', 'M', ' ', ' '):
+  case PDB_REC_KEY('H', 'E', 'T', 'A', 'T', 'M'):
+    return PDB_REC_ATOM;
+  case PDB_REC_KEY('M', 'O', 'D', 'E', 'L', ' '):
+    return PDB_REC_MODEL;
+  case PDB_REC_KEY('E', 'N', 'D', 'M', 'D', 'L'):
+    return PDB_REC_ENDMDL;
+  case PDB_REC_KEY('T', 'E', 'R', ' ', ' ', ' '):
+    return PDB_REC_TER;
+  case PDB_REC_KEY('S', 'S', 'B', 'O', 'N', 'D'):
+    return PDB_REC_SSBOND;
+  case PDB_REC_KEY('C', 'R', 'Y', 'S', 'T', '1'):
+    return PDB_REC_CRYST1;
+  case PDB_REC_KEY('H', 'E', 'A', 'D', 'E', 'R'):
+    return PDB_REC_HEADER;
+  case PDB_REC_KEY('O', 'B', 'S', 'L', 'T', 'E'):
+    return PDB_REC_OBSLTE;
+  case PDB_REC_KEY('T', 'I', 'T', 'L', 'E', ' '):
+    return PDB_REC_TITLE;
+  case PDB_REC_KEY('S', 'P', 'L', 'I', 'T', ' '):
+    return PDB_REC_SPLIT;
+  case PDB_REC_KEY('C', 'A', 'V', 'E', 'A', 'T'):
+    return PDB_REC_CAVEAT;
+  case PDB_REC_KEY('E', 'X', 'P', 'D', 'T', 'A'):
+    return PDB_REC_EXPDTA;
+  case PDB_REC_KEY('N', 'U', 'M', 'M', 'D', 'L'):
+    return PDB_REC_NUMMDL;
+  case PDB_REC_KEY('M', 'D', 'L', 'T', 'Y', 'P'):
+    return PDB_REC_MDLTYP;
+  case PDB_REC_KEY('R', 'E', 'M', 'A', 'R', 'K'):
+    return PDB_REC_REMARK;
+  }
+
+  /* serial numbers beyond 99999 run into the record name */
+  if (len >= 4 && STRNEQ(line, "ATOM", 4) ) {
+    return PDB_REC_ATOM;
+  }
+
+  return PDB_REC_OTHER;
+}
+
+
+/*
+ * model_serial: serial number of a MODEL record
+ *
+ * in:  line (need not be NUL terminated), line length, serial to be set
+ * out: false if the record has no serial
+ *
+ */
+
+static bool model_serial(const char *line, size_t len, int *serial)
+{
+  char buffer[PDB_LINE_LEN];
+
+
+  if (len > PDB_LINE_LEN-1) {
+    len = PDB_LINE_LEN-1;
+  }
+
+  memcpy(buffer, line, len);
+  buffer[len] = '\0';
+
+  return sscanf(buffer, "%*10c%4i", serial) == 1;
+}
+
+
+/*
+ * pdb_split_chunk: par_for body, split a chunk into lines, classify them and
+ *                  note the MODEL records
+ *
+ * in:  chunk index, input structure
+ *
+ */
+
+static void pdb_split_chunk(unsigned int idx, void *arg)
+{
+  int serial;
+
+  const char *line, *nl;
+
+  pdb_chunk *chunk = &((pdb_input *) arg)->chunks[idx];
+  pdb_line *pl;
+
+
+  chunk->nlines = chunk->nmodels = 0;
+
+  for (line = chunk->begin; line < chunk->end; line = nl + 1) {
+    if (chunk->nlines >= chunk->max_lines) {
+      chunk->max_lines = chunk->max_lines ? 2 * chunk->max_lines : 4096;
+      chunk->lines = reallocate(chunk->lines,
+				chunk->max_lines * sizeof(*chunk->lines));
+    }
+
+    if (!(nl = memchr(line, '\n', chunk->end - line)) ) {
+      nl = chunk->end;
+    }
+
+    pl = &chunk->lines[chunk->nlines++];
+    pl->line = line;
+    pl->len = nl - line;
+    pl->type = record_type(line, pl->len);
+    pl->rec = -1;
+
+    if (pl->type == PDB_REC_MODEL && model_serial(line, pl->len, &serial) ) {
+      if (chunk->nmodels++ == 0) {
+	chunk->first_model = serial;
+      }
+
+      chunk->last_model = serial;
+    }
+  }
+}
+
+
+/*
+ * pdb_decode_chunk: par_for body, decode the ATOM/HETATM records of a chunk
+ *                   that belong to the chosen MODEL, pdb_read skips those of
+ *                   other models anyway and decodes any record left here
+ *                   itself
+ *
+ * in:  chunk index, input structure
+ *
+ */
+
+static void pdb_decode_chunk(unsigned int idx, void *arg)
+{
+  unsigned int l;
+  int serial, curr_model;
+
+  bool in_model;
+
+  const pdb_input *in = arg;
+  pdb_chunk *chunk = &in->chunks[idx];
+  pdb_line *pl;
+
+
+  chunk->nrecs = 0;
+  in_model = chunk->in_model;
+  curr_model = chunk->curr_model;
+
+  for (l = 0; l < chunk->nlines; l++) {
+    pl = &chunk->lines[l];
+
+    if (pl->type == PDB_REC_MODEL && model_serial(pl->line, pl->len, &serial)) {
+      in_model = true;
+      curr_model = serial;
+    }
+
+    if (pl->type != PDB_REC_ATOM || (in_model && in->model_no != PDB_ALL_MODELS
+				     && curr_model != in->model_no) ) {
+      continue;
+    }
+
+    if (chunk->nrecs >= chunk->max_recs) {
+      chunk->max_recs = chunk->max_recs ? 2 * chunk->max_recs : 4096;
+      chunk->recs = reallocate(chunk->recs,
+			       chunk->max_recs * sizeof(*chunk->recs));
+      chunk->nfields = reallocate(chunk->nfields,
+				  chunk->max_recs * sizeof(*chunk->nfields));
+    }
+
+    pl->rec = chunk->nrecs;
+    chunk->nfields[chunk->nrecs] = pdb_scan_atom(&chunk->recs[chunk->nrecs],
+						 pl->line, pl->len);
+    chunk->nrecs++;
+  }
+}
+
+
+/*
+ * pdb_fill_chunks: cut the next window of line aligned chunks from the
+ *                  mapping and decode them concurrently.  The lines are
+ *                  split first, so the MODEL each chunk starts in is known
+ *                  and only the records of the chosen one are decoded.
+ *
+ * in:  input structure
+ * out: false if the mapping is exhausted
+ *
+ */
+
+static bool pdb_fill_chunks(pdb_input *in)
+{
+  unsigned int n, i;
+
+  const char *end, *nl;
+
+  pdb_chunk *chunk;
+
+
+  for (n = 0; n < in->nchunks && in->pos < in->end; n++) {
+    if ( (size_t) (in->end - in->pos) > PDB_CHUNK_SIZE) {
+      end = in->pos + PDB_CHUNK_SIZE;
+
+      if ( (nl = memchr(end, '\n', in->end - end)) ) {
+	end = nl + 1;
+      } else {
+	end = in->end;
+      }
+    } else {
+      end = in->end;
+    }
+
+    in->chunks[n].begin = in->pos;
+    in->chunks[n].end = end;
+    in->pos = end;
+  }
+
+  in->used_chunks = n;
+  in->curr_chunk = in->curr_line = 0;
+
+  if (n == 0) {
+    return false;
+  }
+
+  par_for(n, pdb_split_chunk, in);
+
+  for (i = 0; i < n; i++) {
+    chunk = &in->chunks[i];
+    chunk->in_model = in->in_model;
+    chunk->curr_model = in->curr_model;
+
+    if (chunk->nmodels > 0) {
+      /* as pdb_read, the first MODEL if none was chosen */
+      if (in->model_no < 0) {
+	in->model_no = chunk->first_model;
+      }
+
+      in->in_model = true;
+      in->curr_model = chunk->last_model;
+    }
+  }
+
+  par_for(n, pdb_decode_chunk, in);
+
+  return true;
+}
+
+
+/*
+ * pdb_open_input: set up reading of records from either a memory mapped
+ *                 (uncompressed) file or a compressed stream; large mapped
+ *                 files are decoded concurrently if more than one thread is
+ *                 available
+ *
+ * in:  input structure, file name, chosen model number
+ *
+ */
+
+static void pdb_open_input(pdb_input *in, const char *filename, int model_no)
+{
+  unsigned int nthreads;
+
+
+  in->stream = NULL;
+  in->map = fzmap(filename, &in->size);
+  in->pos = in->map;
+  in->end = in->map ? in->map + in->size : NULL;
+  in->chunks = NULL;
+  in->nchunks = in->used_chunks = in->curr_chunk = in->curr_line = 0;
+  in->rec = NULL;
+  in->offset = 0;
+  in->model_no = model_no;
+  in->in_model = false;
+  in->curr_model = 0;
+
+  if (!in->map && !(in->stream = fzopen(filename, "r")) ) {
+    perror(filename);
+    exit(2);
+  }
+
+  nthreads = par_get_threads();
+
+  if (in->map && nthreads > 1 && in->size >= PDB_PAR_MIN_SIZE) {
+    in->nchunks = nthreads;
+    in->chunks = allocate(in->nchunks * sizeof(*in->chunks));
+    memset(in->chunks, 0, in->nchunks * sizeof(*in->chunks));
+  }
+}
+
+
+/*
+ * pdb_next_record: return the next line without its newline; mapped lines are
+ *                  returned in place and are not NUL terminated.  For chunked
+ *                  input in->rec points to the already decoded ATOM/HETATM
+ *                  record of the line (NULL otherwise).
+ *
+ * in:  input structure, pointer to line length
+ * out: start of line or NULL at end of input
+ *
+ */
+
+static const char *pdb_next_record(pdb_input *in, size_t *len)
+{
+  const char *line, *nl;
+
+  pdb_chunk *chunk;
+  pdb_line *pl;
+
+
+  if (in->chunks) {
+    while (in->curr_chunk >= in->used_chunks ||
+	   in->curr_line >= in->chunks[in->curr_chunk].nlines) {
+      if (in->curr_chunk < in->used_chunks) {
+	in->curr_chunk++;
+	in->curr_line = 0;
+      } else if (!pdb_fill_chunks(in) ) {
+	return NULL;
+      }
+    }
+
+    chunk = &in->chunks[in->curr_chunk];
+    pl = &chunk->lines[in->curr_line++];
+    *len = pl->len;
+    in->offset = pl->line - in->map;
+
+    if (pl->rec >= 0) {
+      in->rec = &chunk->recs[pl->rec];
+      in->nfields = chunk->nfields[pl->rec];
+    } else {
+      in->rec = NULL;
+    }
+
+    return pl->line;
+  }
+
+  if (in->map) {
+    if (in->pos >= in->end) {
+      return NULL;
+    }
+
+    line = in->pos;
+    in->offset = line - in->map;
+
+    if ( (nl = memchr(line, '\n', in->end - line)) ) {
+      *len = nl - line;
+      in->pos = nl + 1;
+    } else {
+      *len = in->end - line;
+      in->pos = in->end;
+    }
+
+    return line;
+  }
+
+  in->offset = fztell(in->stream);
+
+  if (!fzgets(in->stream, in->buffer, PDB_LINE_LEN) ) {
+    return NULL;
+  }
+
+  delnl(in->buffer);		/* fgets stores the newline */
+  *len = strlen(in->buffer);
+
+  return in->buffer;
+}
+
+
+/*
+ * pdb_seek_input: continue reading at a byte offset
+ *
+ * in:  input structure, byte offset
+ * out: false if the offset cannot be reached
+ *
+ */
+
+static bool pdb_seek_input(pdb_input *in, long long offset)
+{
+  if (in->map) {
+    if (offset < 0 || (size_t) offset > in->size) {
+      return false;
+    }
+
+    in->pos = in->map + offset;
+    in->used_chunks = in->curr_chunk = in->curr_line = 0;
+    in->in_model = false;	/* all is decoded up to the next MODEL */
+
+    return true;
+  }
+
+  return fzseek(in->stream, offset) == 0;
+}
+
+
+/*
+ * pdb_close_input: release mapping or stream
+ *
+ * in:  input structure
+ *
+ */
+
+static void pdb_close_input(pdb_input *in)
+{
+  unsigned int n;
+
+
+  for (n = 0; n < in->nchunks; n++) {
+    free(in->chunks[n].lines);
+    free(in->chunks[n].recs);
+    free(in->chunks[n].nfields);
+  }
+
+  free(in->chunks);
+
+  if (in->map) {
+    fzunmap(in->map, in->size);
+  } else {
+    fzclose(in->stream);
+  }
+}
+
+
+/*
+ * midx_load: read a sidecar MODEL index if it matches the input file
+ *
+ * in:  input structure, index file name, status of the input file
+ * out: index or NULL if missing or stale
+ *
+ */
+
+static pdb_model_index *midx_load(pdb_input *in, const char *midx_name,
+				  const struct stat *st)
+{
+  char magic[sizeof(PDB_MIDX_MAGIC)];
+
+  int version;
+
+  long long fsize, fmtime[2];
+
+  FILE *stream;
+
+  pdb_model_index *idx;
+
+
+  if (!(stream = fopen(midx_name, "rb")) ) {
+    return NULL;
+  }
+
+  if (fread(magic, sizeof(magic), 1, stream) != 1 ||
+      !STRNEQ(magic, PDB_MIDX_MAGIC, sizeof(magic)) ||
+      fread(&version, sizeof(version), 1, stream) != 1 ||
+      version != PDB_MIDX_VERSION ||
+      fread(&fsize, sizeof(fsize), 1, stream) != 1 || fsize != st->st_size ||
+      fread(fmtime, sizeof(fmtime), 1, stream) != 1 ||
+      fmtime[0] != st->st_mtim.tv_sec || fmtime[1] != st->st_mtim.tv_nsec) {
+    fclose(stream);
+    return NULL;
+  }
+
+  idx = allocate(sizeof(*idx));
+  idx->models = NULL;
+
+  if (fread(&idx->nmodels, sizeof(idx->nmodels), 1, stream) != 1 ||
+      idx->nmodels > fsize) {
+    idx->nmodels = 0;
+  } else if (idx->nmodels > 0) {
+    idx->models = allocate(idx->nmodels * sizeof(*idx->models));
+
+    if (fread(idx->models, sizeof(*idx->models), idx->nmodels, stream) !=
+	idx->nmodels) {
+      idx->nmodels = 0;
+    }
+  }
+
+  /* access points only exist for compressed input */
+  if (idx->nmodels == 0 || (in->stream && fzindex_read(in->stream, stream)) ) {
+    free(idx->models);
+    free(idx);
+    idx = NULL;
+  }
+
+  fclose(stream);
+
+  return idx;
+}
+
+
+/*
+ * midx_save: write a sidecar MODEL index; failure is not an error as the
+ *            index is only an optimization
+ *
+ * in:  input structure, index, index file name, status of the input file
+ *
+ */
+
+static void midx_save(pdb_input *in, const pdb_model_index *idx,
+		      const char *midx_name, const struct stat *st)
+{
+  int version = PDB_MIDX_VERSION;
+
+  /* nanoseconds catch a rewrite of the same size within one second */
+  long long size = st->st_size;
+  long long mtime[2] = {st->st_mtim.tv_sec, st->st_mtim.tv_nsec};
+
+  bool ok;
+
+  FILE *stream;
+
+
+  if (!(stream = fopen(midx_name, "wb")) ) {
+    return;
+  }
+
+  ok = fwrite(PDB_MIDX_MAGIC, sizeof(PDB_MIDX_MAGIC), 1, stream) == 1 &&
+    fwrite(&version, sizeof(version), 1, stream) == 1 &&
+    fwrite(&size, sizeof(size), 1, stream) == 1 &&
+    fwrite(mtime, sizeof(mtime), 1, stream) == 1 &&
+    fwrite(&idx->nmodels, sizeof(idx->nmodels), 1, stream) == 1 &&
+    fwrite(idx->models, sizeof(*idx->models), idx->nmodels, stream) ==
+    idx->nmodels;
+
+  if (ok && in->stream) {
+    ok = fzindex_write(in->stream, stream) == 0;
+  }
+
+  if (fclose(stream) != 0 || !ok) {
+    remove(midx_name);
+  }
+}
+
+
+/*
+ * midx_build: find all MODEL records of the input; for compressed input
+ *             decompressor access points are recorded on the way
+ *
+ * in:  input structure (must be at the start of the file)
+ * out: index
+ *
+ */
+
+static pdb_model_index *midx_build(pdb_input *in)
+{
+  int line_cnt = 0, serial;
+
+  unsigned int max_models = 0;
+
+  char buffer[PDB_LINE_LEN];
+  const char *line;
+
+  size_t len;
+
+  pdb_model_index *idx;
+
+
+  idx = allocate(sizeof(*idx));
+  idx->nmodels = 0;
+  idx->models = NULL;
+
+  if (in->stream) {
+    fzindex(in->stream, PDB_MIDX_SPAN);
+  }
+
+  while ( (line = pdb_next_record(in, &len)) ) {
+    line_cnt++;
+
+    if (len < 14 || !STRNEQ(line, "MODEL", 5)) {
+      continue;
+    }
+
+    memcpy(buffer, line, 14);
+    buffer[14] = '\0';
+
+    if (sscanf(buffer, "%*10c%4i", &serial) != 1) {
+      continue;
+    }
+
+    if (idx->nmodels >= max_models) {
+      max_models = max_models ? 2 * max_models : 64;
+      idx->models = reallocate(idx->models,
+			       max_models * sizeof(*idx->models));
+    }
+
+    idx->models[idx->nmodels].serial = serial;
+    idx->models[idx->nmodels].line = line_cnt;
+    idx->models[idx->nmodels].offset = in->offset;
+    idx->nmodels++;
+  }
+
+  if (!pdb_seek_input(in, 0) ) {
+    prerror(2, "cannot rewind input after indexing MODEL records.\n");
+  }
+
+  return idx;
+}
+
+
+/*
+ * pdb_index_models: get the byte offsets of all MODEL records of the input
+ *                  from the sidecar index file <input>.midx; the index is
+ *                  (re)built if the file is missing or if the size or the
+ *                  modification time of the input file have changed
+ *
+ * in:  input structure (must be at the start of the file), input file name
+ * out: index or NULL if the file has no MODEL records
+ *
+ */
+
+static pdb_model_index *pdb_index_models(pdb_input *in, const char *filename)
+{
+  char *midx_name;
+
+  struct stat st;
+
+  pdb_model_index *idx;
+
+
+  if (stat(filename, &st) < 0) {
+    return NULL;
+  }
+
+  midx_name = allocate(strlen(filename) + sizeof(PDB_MIDX_SUFFIX));
+  strcpy(midx_name, filename);
+  strcat(midx_name, PDB_MIDX_SUFFIX);
+
+  if (!(idx = midx_load(in, midx_name, &st)) ) {
+    idx = midx_build(in);
+    midx_save(in, idx, midx_name, &st);
+  }
+
+  free(midx_name);
+
+  if (idx->nmodels == 0) {
+    free(idx->models);
+    free(idx);
+    idx = NULL;
+  }
+
+  return idx;
+}
+
+
+/*
+ * pdb_new_root: allocate an empty root structure
+ *
+ * out: pdb root structure
+ *
+ */
+
+static pdb_root *pdb_new_root(void)
+{
+  pdb_root *pdb;
+
+
+  pdb = allocate(sizeof(*pdb) );
+  memset(pdb, 0, sizeof(*pdb));
+
+  pdb->model_no = 0;
+  pdb->ID[0] = '\0';
+  pdb->cryst1[0] = '\0';
+  pdb->ssbonds = NULL;
+  pdb->chains = NULL;
+  pdb->residues = NULL;
+  pdb->next_model = NULL;
+  pdb->cache = NULL;
+  pdb->cache_size = 0;
+
+  return pdb;
+}
+
+
+/*
+ * builder_start_model: prepare the builder for filling a (new) model
+ *
+ * in:  builder, root structure of the model
+ *
+ */
+
+static void builder_start_model(pdb_builder *b, pdb_root *pdb)
+{
+  b->pdb = pdb;
+  b->old_resSeq = INT_MIN;
+  b->old_iCode = '\0';
+  b->old_chainID = '\0';
+  b->ter_chainID = '\0';
+  b->rectype = '\0';
+  b->ter_found = false;
+}
+
+
+/*
+ * builder_flush_occ: print the low occupancy warning of the current residue,
+ *                    every name is given once, latest first
+ *
+ * in:  builder
+ *
+ */
+
+static void builder_flush_occ(pdb_builder *b)
+{
+  unsigned int i, j;
+
+  bool found = false;
+
+  const pdb_root *pdb = b->pdb;
+  const pdb_atoms *atoms = &pdb->atoms;
+  const pdb_residue *residue;
+
+
+  if (!options.warnocc || pdb->nres == 0) {
+    return;
+  }
+
+  residue = &pdb->residues[pdb->nres-1];
+
+  for (i = residue->end; i-- > residue->begin; ) {
+    if (PDB_OCC_FLOAT(atoms->occupancy[i]) >= FLT_EPSILON) {
+      continue;
+    }
+
+    /* only the first occurrence of a name is reported */
+    for (j = residue->begin; j < i; j++) {
+      if (PDB_OCC_FLOAT(atoms->occupancy[j]) < FLT_EPSILON &&
+	  atoms->info[j].code == atoms->info[i].code) {
+	break;
+      }
+    }
+
+    if (j < i) {
+      continue;
+    }
+
+    if (!found) {
+      prwarn("very low occupancy for atoms in residue %s %d%c %c: ",
+	     residue->resName, residue->resSeq, residue->iCode,
+	     pdb->chains[residue->chain].chainID);
+      found = true;
+    }
+
+    fprintf(prout(), " %s", atoms->info[i].name);
+  }
+
+  if (found) {
+    fprintf(prout(), "\n");
+  }
+}
+
+
+/*
+ * pdb_builder_add_atom: append a decoded atom record to the chain, residue
+ *                       and atom tables of the current model, hydrogens are
+ *                       dropped or tagged
+ *
+ * in:  builder, decoded ATOM/HETATM record
+ *
+ */
+
+void pdb_builder_add_atom(pdb_builder *b, pdb_atom_rec *rec)
+{
+  int gap;
+  unsigned int idx;
+  uint32_t res_code;
+
+  bool new_chain = false;
+
+  pdb_root *pdb = b->pdb;
+  pdb_atoms *atoms = &pdb->atoms;
+  pdb_chain *chain;
+  pdb_residue *residue;
+  pdb_atom *atom;
+
+
+  if (ishydrogen(rec->element, rec->name) ) {
+    if (options.remh) {
+      return;
+    } else {
+      strcpy(rec->element, " H"); // tag hydrogens
+    }
+  }
+
+  rec->resName[PDB_RES_NAME_LEN-1] = '\0';
+  res_code = pdb_name_code(rec->resName);
+
+  if (rec->chainID != b->old_chainID ||
+      (b->ter_found && b->ter_chainID != b->old_chainID) ) {
+    if (pdb->nchains >= pdb->max_chains) {
+      pdb->max_chains = pdb->max_chains ? 2 * pdb->max_chains : 16;
+      pdb->chains = reallocate(pdb->chains,
+			       pdb->max_chains * sizeof(*pdb->chains));
+    }
+
+    chain = &pdb->chains[pdb->nchains];
+    chain->chainID = rec->chainID;
+    chain->begin = chain->end = pdb->nres;
+
+    new_chain = true;
+  } else {
+    chain = &pdb->chains[pdb->nchains-1];
+  }
+
+  if (new_chain || rec->resSeq != b->old_resSeq ||
+      rec->iCode != b->old_iCode) {	// if new res
+    builder_flush_occ(b);
+
+    if (pdb->nres >= pdb->max_res) {
+      pdb->max_res = pdb->max_res ? 2 * pdb->max_res : 256;
+      pdb->residues = reallocate(pdb->residues,
+				 pdb->max_res * sizeof(*pdb->residues));
+    }
+
+    residue = &pdb->residues[pdb->nres];
+
+    residue->resSeq = rec->resSeq;
+    residue->iCode = rec->iCode;
+
+    residue->rectype = b->rectype = rec->rectype;
+
+    strncpy(residue->segID, rec->segID, PDB_SEG_NAME_LEN-1);
+    residue->segID[PDB_SEG_NAME_LEN-1] = '\0';
+
+    residue->chain = chain - pdb->chains;
+    residue->begin = residue->end = residue->limit = atoms->used;
+
+    residue->top = residue->entry = NULL;	/* see top_bind */
+    residue->res_class = PDB_RES_OTHER;
+    residue->has_alt = false;
+    residue->shadow_begin = residue->shadow_end = 0;
+
+    gap = rec->resSeq - b->old_resSeq - 1;
+
+    if (gap > 0 && !new_chain && rec->rectype == 'A') {
+      prwarn("gap of %i residue%s prior to %s %d%c %c\n",
+	     gap, gap > 1 ? "s" : "", rec->resName,  residue->resSeq,
+	     residue->iCode, chain->chainID);
+    }
+
+    if (res_code == PDB_NAME_CODE('C', 'Y', 'S', ' ') ) {
+      b->nssb++;
+    }
+
+    pdb_set_res_name(residue, rec->resName);
+
+    if (new_chain) {
+      pdb->nchains++;
+
+      /* FIXME: check for "broken" chains! */
+      b->old_chainID = rec->chainID;
+      b->ter_found = false;
+    }
+
+    pdb->nres++;
+    chain->end = pdb->nres;
+    b->old_resSeq = rec->resSeq;
+    b->old_iCode = rec->iCode;
+  } else {
+    residue = &pdb->residues[pdb->nres-1];
+  }
+
+  if (residue->code != res_code && rec->iCode == residue->iCode) {
+    prerror(1, "residue %s %d%c %c has also other name: %s, "
+	    "check SEQADV/REMARK 999.\n",
+	    residue->resName, residue->resSeq, residue->iCode,
+	    chain->chainID, rec->resName);
+  }
+
+  if (rec->rectype != b->rectype) {
+    prerror(1, "residue %s %d%c %c has both ATOM and HETATM records.\n",
+	    residue->resName, residue->resSeq, residue->iCode,
+	    chain->chainID);
+  }
+
+  if (atoms->used >= atoms->size) {
+    pdb_resize_atoms(pdb, atoms->size ? 2 * atoms->size : 1024);
+  }
+
+  idx = atoms->used++;
+  atom = &atoms->info[idx];
+
+  atom->altLoc = rec->altLoc;
+
+  if (rec->altLoc != ' ') {
+    residue->has_alt = true;
+  }
+  atoms->x[idx] = rec->x;
+  atoms->y[idx] = rec->y;
+  atoms->z[idx] = rec->z;
+  atoms->occupancy[idx] = rec->occupancy;
+  atoms->tempFactor[idx] = rec->tempFactor;
+
+  strncpy(atom->serial, rec->serial, PDB_SERIAL_LEN-1);
+  atom->serial[PDB_SERIAL_LEN-1] = '\0';
+
+  pdb_set_atom_name(atom, rec->name);
+
+  strncpy(atom->element, rec->element, PDB_ELEMENT_LEN-1);
+  atom->element[PDB_ELEMENT_LEN-1] = '\0';
+
+  strncpy(atom->charge, rec->charge, PDB_CHARGE_LEN-1);
+  atom->charge[PDB_CHARGE_LEN-1] = '\0';
+
+  residue->end = residue->limit = atoms->used;
+
+  pdb->natoms++;
+}
+
+
+/*
+ * pdb_builder_create: set up a builder filling a fresh root structure
+ *
+ * in:  name for CYS residues in disulfide bond
+ * out: builder
+ *
+ */
+
+pdb_builder *pdb_builder_create(const char *ss_name)
+{
+  pdb_builder *b;
+
+
+  b = allocate(sizeof(*b) );
+
+  b->head = pdb_new_root();
+  b->nssb = 0;
+  b->ss_name = ss_name;
+  builder_start_model(b, b->head);
+
+  return b;
+}
+
+
+/*
+ * pdb_builder_root: the first model which also holds title section data
+ *                   like SSBOND and CRYST1
+ *
+ * in:  builder
+ * out: pdb root structure
+ *
+ */
+
+pdb_root *pdb_builder_root(pdb_builder *b)
+{
+  return b->head;
+}
+
+
+/*
+ * pdb_builder_new_model: start a further model linked through next_model
+ *                        unless the current one is still empty
+ *
+ * in:  builder, serial of the model
+ *
+ */
+
+void pdb_builder_new_model(pdb_builder *b, int model_no)
+{
+  pdb_root *model;
+
+
+  if (b->pdb->nchains > 0) {
+    builder_flush_occ(b);
+
+    model = pdb_new_root();
+    b->pdb->next_model = model;
+    builder_start_model(b, model);
+  }
+
+  b->pdb->model_no = model_no;
+}
+
+
+/*
+ * pdb_builder_ter: note a chain terminator
+ *
+ * in:  builder, chain identifier of the terminator
+ *
+ */
+
+void pdb_builder_ter(pdb_builder *b, char chainID)
+{
+  b->ter_found = true;
+  b->ter_chainID = chainID;
+}
+
+
+/*
+ * pdb_builder_break_chain: make the next atom start a new chain even if its
+ *                          chain identifier is the same as the current one
+ *
+ * in:  builder
+ *
+ */
+
+void pdb_builder_break_chain(pdb_builder *b)
+{
+  b->old_chainID = '\0';
+}
+
+
+/*
+ * builder_rename_ss: rename CYS residues bonded according to SSBOND in all
+ *                    models; the partners are looked up through a residue
+ *                    index so record order does not matter
+ *
+ * in:  builder
+ *
+ */
+
+static void builder_rename_ss(pdb_builder *b)
+{
+  uint32_t cys;
+
+  const struct _ssbond *partner[2];
+
+  pdb_root *model;
+  pdb_residue *residue;
+  pdb_ssbond **ssbond;
+
+  pdb_res_index *index;
+
+
+  if (!options.rssb || !b->head->ssbonds || !*b->head->ssbonds) {
+    return;
+  }
+
+  cys = PDB_NAME_CODE('C', 'Y', 'S', ' ');
+
+  for (model = b->head; model; model = model->next_model) {
+    index = pdb_res_index_init(model);
+
+    for (ssbond = b->head->ssbonds; *ssbond; ssbond++) {
+      partner[0] = &(*ssbond)->ss1;
+      partner[1] = &(*ssbond)->ss2;
+
+      for (unsigned int i = 0; i < 2; i++) {
+	for (residue = pdb_res_index_find(index, partner[i]->chainID,
+					  partner[i]->seqNum, NULL);
+	     residue;
+	     residue = pdb_res_index_find(index, partner[i]->chainID,
+					  partner[i]->seqNum, residue) ) {
+	  if (residue->iCode == partner[i]->icode && residue->code == cys) {
+	    pdb_set_res_name(residue, b->ss_name);
+	  }
+	}
+      }
+    }
+
+    pdb_res_index_destroy(index);
+  }
+}
+
+
+/*
+ * pdb_builder_finish: flush pending warnings and release the builder
+ *
+ * in:  builder, counter for CYS residues
+ * out: pdb root structure of the first model
+ *
+ */
+
+pdb_root *pdb_builder_finish(pdb_builder *b, int *nssb)
+{
+  pdb_root *pdb = b->head;
+
+
+  /* flush warning of last residue if it exists */
+  builder_flush_occ(b);
+
+  builder_rename_ss(b);
+
+  *nssb = b->nssb;
+  free(b);
+
+  return pdb;
+}
+
+
+/*
+ * pdb_add_ssbond: append a copy of a disulfide bond to the NULL terminated
+ *                 list of the root structure
+ *
+ * in:  pdb root structure, disulfide bond
+ *
+ */
+
+void pdb_add_ssbond(pdb_root *pdb, const pdb_ssbond *ssbond)
+{
+  unsigned int nss = 0;
+
+
+  if (pdb->ssbonds) {
+    while (pdb->ssbonds[nss]) {
+      nss++;
+    }
+  }
+
+  pdb->ssbonds = reallocate(pdb->ssbonds, (nss+2) * sizeof(*pdb->ssbonds));
+  pdb->ssbonds[nss] = allocate(sizeof(**pdb->ssbonds) );
+
+  *pdb->ssbonds[nss] = *ssbond;
+  pdb->ssbonds[nss+1] = NULL;
+}
+
+
+/*
+ * pdb_summary: print the number of atoms, residues, chains and models read
+ *
+ * in:  pdb root structure
+ *
+ */
+
+void pdb_summary(const pdb_root *pdb)
+{
+  unsigned int atom_cnt = 0, residue_cnt = 0, chain_cnt = 0, model_cnt = 0;
+
+  const pdb_root *model;
+
+
+  for (model = pdb; model; model = model->next_model) {
+    atom_cnt += model->natoms;
+    residue_cnt += model->nres;
+    chain_cnt += model->nchains;
+    model_cnt++;
+  }
+
+  fprintf(prout(), "\n%u atoms, %u residues, %u chain%s", atom_cnt,
+	  residue_cnt, chain_cnt, chain_cnt > 1 ? "s" : "");
+
+  if (model_cnt > 1) {
+    fprintf(prout(), " in %u models", model_cnt);
+  }
+
+  fprintf(prout(), " read\n");
+}
+
+
+/*
+ * meta_append: add a line to a metadata text
+ *
+ * in:  pointer to text or NULL, line
+ *
+ */
+
+static void meta_append(char **text, const char *line)
+{
+  size_t len = *text ? strlen(*text) : 0, add = strlen(line);
+
+
+  *text = reallocate(*text, len + add + 2);
+  memcpy(*text + len, line, add);
+  (*text)[len + add] = '\n';
+  (*text)[len + add + 1] = '\0';
+}
+
+
+/*
+ * meta_remark: pick the data of interest from a REMARK record
+ *
+ * in:  metadata, NUL terminated record
+ *
+ */
+
+static void meta_remark(pdb_metadata *meta, char *buffer)
+{
+  int num = 0;
+
+  char *pos, *end;
+
+  float f;
+
+
+  if (!scan_int(buffer + 7, 3, &num) ) {
+    return;
+  }
+
+  switch (num) {
+  case 2:
+    if (STRNEQ(buffer + 10, " RESOLUTION.", 12) ) {
+      pos = buffer + 22;
+      errno = 0;
+      f = strtof(pos, &end);
+
+      if ( !(end == pos || errno == ERANGE) ) {
+	meta->resolution = f;
+      }
+    }
+    break;
+  case 4:
+    if (STRNEQ(buffer + 30, "FORMAT", 6) ) {
+      strcpy(meta->version, extrdat(buffer + 40) );
+    }
+    break;
+  case 465:
+    meta->missing_res = true;
+    break;
+  case 470:
+    meta->missing_atoms = true;
+    break;
+  case 475:
+    meta->zero_occ_res = true;
+    break;
+  case 480:
+    meta->zero_occ_atoms = true;
+    break;
+  default:
+    /* experimental details, REMARK 200 to 265 but not 22x */
+    if (num >= 200 && num < 270 && num / 10 != 22 && meta->pH < 0.0 &&
+	STRNEQ(buffer + 11, " PH ", 4) && (pos = strchr(buffer, ':')) ) {
+      pos++;
+      errno = 0;
+      f = strtof(pos, &end);
+
+      if ( !(end == pos || errno == ERANGE) ) {
+	meta->pH = f;
+      }
+    }
+  }
+}
+
+
+/*
+ * print_lines: print every line of a metadata text with a prefix
+ *
+ * in:  prefix, text or NULL
+ *
+ */
+
+static void print_lines(const char *prefix, const char *text)
+{
+  const char *nl;
+
+
+  for (; text && *text; text = nl + 1) {
+    nl = strchr(text, '\n');
+    fprintf(prout(), "%s%.*s\n", prefix, (int) (nl - text), text);
+  }
+}
+
+
+/*
+ * pdb_metadata_print: report the metadata of a PDB file
+ *
+ * in:  metadata as filled by pdb_read, PDB file name
+ *
+ */
+
+void pdb_metadata_print(const pdb_metadata *meta, const char *filename)
+{
+  const char *text, *nl;
+
+
+  if (meta->header[0] != '\0') {
+    prnote("header and title of %s\n   %s\n", filename, meta->header);
+  }
+
+  for (text = meta->obsolete; text && *text; text = nl + 1) {
+    nl = strchr(text, '\n');
+    prwarn("this PDB has been obsoleted by %.*s\n", (int) (nl - text), text);
+  }
+
+  print_lines("   ", meta->title);
+
+  for (text = meta->split; text && *text; text = nl + 1) {
+    nl = strchr(text, '\n');
+    prwarn("PDB has been split.  Required IDs to reconstitute: %.*s\n",
+	   (int) (nl - text), text);
+  }
+
+  if (meta->caveat) {
+    prwarn("This PDB contains SEVERE ERRORS:\n");
+    print_lines("    ", meta->caveat);
+  }
+
+  for (text = meta->expdta; text && *text; text = nl + 1) {
+    nl = strchr(text, '\n');
+    prnote("PDB reports experiment type as %.*s\n", (int) (nl - text), text);
+  }
+
+  if (meta->nmodels) {
+    prnote("PDB contains %i models\n", meta->nmodels);
+  }
+
+  if (meta->mdltyp) {
+    prnote("PDB reports model type as\n");
+    print_lines("    ", meta->mdltyp);
+  }
+
+  if (meta->resolution >= 0.0) {
+    prnote("PDB resolution is %.2f\n", meta->resolution);
+  }
+
+  if (meta->version[0] != '\0') {
+    prnote("PDB version %s\n", meta->version);
+  }
+
+  if (meta->pH >= 0.0) {
+    prnote("PDB reports a pH of %.2f in REMARK 2nn\n", meta->pH);
+  }
+
+  if (meta->missing_res) {
+    prnote("PDB warns of missing residues\n");
+  }
+
+  if (meta->missing_atoms) {
+    prnote("PDB warns of missing atoms\n");
+  }
+
+  if (meta->zero_occ_res) {
+    prnote("PDB warns of residues with zero occupancy\n");
+  }
+
+  if (meta->zero_occ_atoms) {
+    prnote("PDB warns of non-hydrogens with zero occupancy\n");
+  }
+}
+
+
+/*
+ * pdb_metadata_destroy: free the texts of the metadata, the structure itself
+ *                       belongs to the caller
+ *
+ * in:  metadata
+ *
+ */
+
+void pdb_metadata_destroy(pdb_metadata *meta)
+{
+  free(meta->title);
+  free(meta->obsolete);
+  free(meta->split);
+  free(meta->caveat);
+  free(meta->expdta);
+  free(meta->mdltyp);
+}
+
+
+/*
+ * pdb_read: read and analyse ATOM/HETATM, SSBOND, TER, and CRYST1 records from
+ *           a file
+ *
+ * With model_no == PDB_ALL_MODELS every MODEL is read into its own root
+ * structure, linked through next_model.  Header and REMARK data are only
+ * collected if metadata is asked for, see pdb_metadata_print.
+ *
+ * in:  pdb structure, PDB file name, name for CYS residues in disulfide bond,
+ *      chosen model number, counter for S-S bonds, metadata to be filled or
+ *      NULL
+ * out: pdb root structure
+ *
+ */
+
+pdb_root *pdb_read(pdb_root *pdb, const char *filename, const char* ss_name,
+		   int model_no, int *nssb, pdb_metadata *meta)
+{
+  unsigned int i;
+  int line_cnt = 0;
+  int curr_model_no;
+  int serNum, seqNum1, seqNum2, nfields;
 
-	curr_residue = pdb_add_residue_node(old_residue);
+  bool model_found = false;
 
-	curr_residue->resSeq = resSeq;
-	curr_residue->iCode = iCode;
+  char chainID1, chainID2, icode1, icode2;
+  char *pos;
 
-	curr_residue->rectype = curr_rectype = buffer[0];
+  float Length;
 
-	strncpy(curr_residue->segID, segID, PDB_SEG_NAME_LEN-1);
-	curr_residue->segID[PDB_SEG_NAME_LEN-1] = '\0';
+  char SymOP1[PDB_SSBOND_SYMOP_LEN], SymOP2[PDB_SSBOND_SYMOP_LEN];
+  char buffer[PDB_LINE_LEN];
+  const char *line;
 
-	curr_residue->chain = curr_chain;
+  size_t len;
 
-	gap = resSeq - old_resSeq - 1;
+  pdb_atom_rec rec;
 
-	if (gap > 0 && !new_chain && buffer[0] == 'A') {
-	  prwarn("gap of %i residue%s prior to %s %d%c %c\n",
-		 gap, gap > 1 ? "s" : "", resName,  curr_residue->resSeq,
-		 curr_residue->iCode, curr_chain->chainID);
-	}
+  pdb_input input;
 
-	if (STRNEQ(resName, "CYS ", PDB_ATOM_NAME_LEN-1)) {
-	  (*nssb)++;
+  pdb_builder *builder;
 
-	  if (options.rssb && pdb->ssbonds) {
-	    for (ssbonds = pdb->ssbonds; *ssbonds; ssbonds++) {
-	      ssbond = *ssbonds;
+  pdb_ssbond ssbond;
 
-	      ss_found = false;
+  pdb_model_index *midx = NULL;
+  pdb_model_pos *target = NULL;
 
-	      if ( (resSeq == ssbond->ss1.seqNum &&
-		    chainID == ssbond->ss1.chainID) ||
-		   (resSeq == ssbond->ss2.seqNum  &&
-		    chainID == ssbond->ss2.chainID) ) {
-		ss_found = true;
-		break;
-	      }
-	    }
+  enum pdb_rec_type type;
 
-	    if (ss_found) {
-	      strncpy(resName, ss_name, PDB_RES_NAME_LEN-1);
-	      resName[PDB_RES_NAME_LEN-1] = '\0';
-	    }
-	  }
-	}
 
-	strncpy(curr_residue->resName, resName, PDB_RES_NAME_LEN-1);
-	curr_residue->resName[PDB_RES_NAME_LEN-1] = '\0';
 
-	new_residue = true;
-      }
+  if (meta) {
+    memset(meta, 0, sizeof(*meta));
+    meta->resolution = meta->pH = -1.0;
+  }
 
-      if (!STRNEQ(curr_residue->resName, resName, PDB_RES_NAME_LEN-1) &&
-	  iCode == curr_residue->iCode) {
-	prerror(1, "residue %s %d%c %c has also other name: %s, "
-		"check SEQADV/REMARK 999.\n",
-		curr_residue->resName, curr_residue->resSeq, curr_residue->iCode,
-		curr_chain->chainID, resName);
-      }
+  pdb_open_input(&input, filename, model_no);
 
-      if (buffer[0] != curr_rectype) {
-	prerror(1, "residue %s %d%c %c has both ATOM and HETATM records.\n",
-		curr_residue->resName, curr_residue->resSeq, curr_residue->iCode,
-		curr_chain->chainID);
+  if (options.midx && model_no >= 0 && model_no != PDB_ALL_MODELS &&
+      (midx = pdb_index_models(&input, filename)) ) {
+    for (i = 0; i < midx->nmodels; i++) {
+      if (midx->models[i].serial == model_no) {
+	target = &midx->models[i];
+	break;
       }
+    }
+  }
 
-      old_atom = curr_atom;
-      curr_atom = pdb_add_atom_node(old_atom);
-
-      curr_atom->altLoc = altLoc;
-      vecCreate(curr_atom->pos, x, y, z);
-      curr_atom->occupancy = occupancy;
-      curr_atom->tempFactor = tempFactor;
-
-      strncpy(curr_atom->serial, serial, PDB_SERIAL_LEN-1);
-      curr_atom->serial[PDB_SERIAL_LEN-1] = '\0';
+  builder = pdb_builder_create(ss_name);
+  pdb = pdb_builder_root(builder);
 
-      strncpy(curr_atom->name, name, PDB_ATOM_NAME_LEN-1);
-      curr_atom->name[PDB_ATOM_NAME_LEN-1] = '\0';
 
-      strncpy(curr_atom->element, element, PDB_ELEMENT_LEN-1);
-      curr_atom->element[PDB_ELEMENT_LEN-1] = '\0';
+  while ( (line = pdb_next_record(&input, &len)) ) {
+    line_cnt++;
+    type = record_type(line, len);
 
-      strncpy(curr_atom->charge, charge, PDB_CHARGE_LEN-1);
-      curr_atom->charge[PDB_CHARGE_LEN-1] = '\0';
+    if (type == PDB_REC_ATOM) {
+      if (model_found && model_no != PDB_ALL_MODELS &&
+	  curr_model_no != model_no) {
+	continue;
+      }
 
-      curr_atom->residue = curr_residue;
+      if (input.rec) {
+	rec = *input.rec;
+	nfields = input.nfields;
+      } else {
+	nfields = pdb_scan_atom(&rec, line, len);
+      }
 
-      if (options.warnocc && occupancy < FLT_EPSILON) {
-	stack_push_uniq(occ_warn, curr_atom->name, PDB_ATOM_NAME_LEN-1);
+      if (nfields < 10) {
+	prerror(2, "%s: only %d ATOM/HETATM fields read successfully in line %d"
+		"but expected at least 10.\n", filename, nfields, line_cnt);
       }
 
-      /* FIXME: check for "broken" chains! */
-      if (new_chain) {
-	curr_chain->first_residue = curr_residue;
+      pdb_builder_add_atom(builder, &rec);
 
-	chain_cnt++;
-	old_chainID = chainID;
+      continue;
+    }
+
+    /* without metadata wanted its records are passed over unread */
+    if (type == PDB_REC_OTHER || (type > PDB_REC_HEADER && !meta) ) {
+      continue;
+    }
 
-	ter_found = false;
-	new_chain = false;
+    /* nothing of interest follows the chosen model */
+    if (type == PDB_REC_ENDMDL) {
+      if (model_found && model_no != PDB_ALL_MODELS &&
+	  curr_model_no == model_no) {
+	break;
       }
 
-      if (new_residue) {
-	curr_residue->first_atom = curr_atom;
+      continue;
+    }
 
-	residue_cnt++;
-	old_resSeq = resSeq;
-	old_iCode = iCode;
+    /* all other records are rare enough to be copied */
+    if (len > PDB_LINE_LEN-1) {
+      len = PDB_LINE_LEN-1;
+    }
 
-	new_residue = false;
-      }
+    memcpy(buffer, line, len);
+    buffer[len] = '\0';
 
-      atom_cnt++;
-    } else if (STRNEQ(buffer, "MODEL", 5) ) {
+    switch (type) {
+    case PDB_REC_MODEL:
       model_found = true;
-	
-      nfields = sscanf(buffer, "%*10c%4i", &curr_model_no);
 
-      if (nfields != 1) {
+      if (!model_serial(buffer, len, &curr_model_no) ) {
 	prerror(2, "%s: MODEL record requires serial in line %d.\n",
 		filename, line_cnt);
       }
@@ -509,14 +2821,32 @@ pdb_root *pdb_read(pdb_root *pdb, const char *filename, const char* ss_name,
       if (model_no < 0) {
 	model_no = curr_model_no;
       }
-    } else if (STRNEQ(buffer, "TER", 3) ) {
-      ter_found = true;
-      nfields = sscanf(buffer, "%*21c%c", &ter_chainID);
 
-      if (nfields != 1) {
-	ter_chainID = ' ';
+      /* jump over preceding models */
+      if (target && curr_model_no != model_no &&
+	  target->offset > input.offset) {
+	if (!pdb_seek_input(&input, target->offset) ) {
+	  prerror(2, "%s: cannot seek to MODEL %d.\n", filename, model_no);
+	}
+
+	line_cnt = target->line - 1;
+	target = NULL;
+	continue;
+      }
+
+      if (model_no == PDB_ALL_MODELS) {
+	pdb_builder_new_model(builder, curr_model_no);
+      }
+      break;
+    case PDB_REC_TER:
+      nfields = sscanf(buffer, "%*21c%c", &chainID1);
+      pdb_builder_ter(builder, nfields == 1 ? chainID1 : ' ');
+      break;
+    case PDB_REC_SSBOND:
+      if (!options.rssb) {
+	break;
       }
-    } else if (options.rssb && STRNEQ(buffer, "SSBOND", 6) ) {
+
       SymOP1[0] = SymOP2[0] = '\0';
       Length = 0.0;
 
@@ -529,251 +2859,197 @@ pdb_root *pdb_read(pdb_root *pdb, const char *filename, const char* ss_name,
 	       "expected at least 10.\n", filename, nfields, line_cnt);
       }
 
-      nss++;
-      pdb->ssbonds = reallocate(pdb->ssbonds, (nss+1) * sizeof(*pdb->ssbonds));
-      ssbond = allocate(sizeof(*ssbond));
-
-      ssbond->serNum = serNum;
+      ssbond.serNum = serNum;
 
-      ssbond->ss1.chainID = chainID1;
-      ssbond->ss1.seqNum = seqNum1;
-      ssbond->ss1.icode = icode1;
+      ssbond.ss1.chainID = chainID1;
+      ssbond.ss1.seqNum = seqNum1;
+      ssbond.ss1.icode = icode1;
 
-      ssbond->ss2.chainID = chainID2;
-      ssbond->ss2.seqNum = seqNum2;
-      ssbond->ss2.icode = icode2;
+      ssbond.ss2.chainID = chainID2;
+      ssbond.ss2.seqNum = seqNum2;
+      ssbond.ss2.icode = icode2;
 
-      strncpy(ssbond->ss1.SymOP, SymOP1, PDB_SSBOND_SYMOP_LEN-1);
-      ssbond->ss1.SymOP[PDB_SSBOND_SYMOP_LEN-1] = '\0';
+      strncpy(ssbond.ss1.SymOP, SymOP1, PDB_SSBOND_SYMOP_LEN-1);
+      ssbond.ss1.SymOP[PDB_SSBOND_SYMOP_LEN-1] = '\0';
 
-      strncpy(ssbond->ss2.SymOP, SymOP2, PDB_SSBOND_SYMOP_LEN-1);
-      ssbond->ss2.SymOP[PDB_SSBOND_SYMOP_LEN-1] = '\0';
+      strncpy(ssbond.ss2.SymOP, SymOP2, PDB_SSBOND_SYMOP_LEN-1);
+      ssbond.ss2.SymOP[PDB_SSBOND_SYMOP_LEN-1] = '\0';
 
-      ssbond->Length = Length;
+      ssbond.Length = Length;
 
-      pdb->ssbonds[nss-1] = ssbond;
-      pdb->ssbonds[nss] = NULL;
-    } else if (STRNEQ(buffer, "CRYST1", 6) ) {
+      pdb_add_ssbond(pdb, &ssbond);
+      break;
+    case PDB_REC_CRYST1:
       strncpy(pdb->cryst1, buffer, PDB_LINE_LEN-1);
       pdb->cryst1[PDB_LINE_LEN-1] = '\0';
-    } else if (STRNEQ(buffer, "HEADER", 6) )  {
-      prnote("header and title of %s\n   %s\n", filename, extrdat(buffer + 6) );
+      break;
+    case PDB_REC_HEADER:
+      pos = extrdat(buffer + 6);
+
+      if (meta) {
+	strcpy(meta->header, pos);
+      }
 
+      /* the line is trimmed so the ID only counts if more follows */
       if (strlen(buffer) > 66) {
 	strncpy(pdb->ID, buffer + 62, PDB_ID_LEN-1);
 	pdb->ID[PDB_ID_LEN-1] = '\0';
       }
-    } else if (STRNEQ(buffer, "OBSLTE", 6) )  {
-      prwarn("this PDB has been obsoleted by %s\n", extrdat(buffer+31) );
-    } else if (STRNEQ(buffer, "TITLE", 5) )  {
-      fprintf(stdout, "   %s\n", extrdat(buffer+10) );
-    } else if (STRNEQ(buffer, "SPLIT", 5) )  {
-      prwarn("PDB has been split.  Required IDs to reconstitute: %s\n",
-	     extrdat(buffer+11) );
-    } else if (STRNEQ(buffer, "CAVEAT", 6) )  {
-      if (!caveat_found) {
-	prwarn("This PDB contains SEVERE ERRORS:\n");
-	caveat_found = true;
-      }
-
-      fprintf(stdout, "    %s\n", extrdat(buffer+10) );
-    } else if (STRNEQ(buffer, "EXPDTA", 6) )  {
-      prnote("PDB reports experiment type as %s\n", extrdat(buffer+6) );
-    } else if (STRNEQ(buffer, "NUMMDL", 6) )  {
+      break;
+    case PDB_REC_OBSLTE:
+      meta_append(&meta->obsolete, extrdat(buffer + 31) );
+      break;
+    case PDB_REC_TITLE:
+      meta_append(&meta->title, extrdat(buffer + 10) );
+      break;
+    case PDB_REC_SPLIT:
+      meta_append(&meta->split, extrdat(buffer + 11) );
+      break;
+    case PDB_REC_CAVEAT:
+      meta_append(&meta->caveat, extrdat(buffer + 10) );
+      break;
+    case PDB_REC_EXPDTA:
+      meta_append(&meta->expdta, extrdat(buffer + 6) );
+      break;
+    case PDB_REC_NUMMDL:
       pos = buffer + 10;
       pos[14] = '\0';
-      prnote("PDB contains %i models\n", atoi(pos));
-    } else if (STRNEQ(buffer, "MDLTYP", 5) )  {
-
-      if (!mdltyp_found) {
-	prnote("PDB reports model type as\n");
-	mdltyp_found = true;
-      }
+      meta->nmodels = atoi(pos);
+      break;
+    case PDB_REC_MDLTYP:
+      meta_append(&meta->mdltyp, extrdat(buffer + 10) );
+      break;
+    case PDB_REC_REMARK:
+      meta_remark(meta, buffer);
+      break;
+    default:
+      break;
+    }
+  }
 
-      fprintf(stdout, "    %s\n", extrdat(buffer+10) );
-    } else if (STRNEQ(buffer, "REMARK   2 RESOLUTION.", 22)) {
-      pos = buffer + 22;
-      errno = 0;
-      f = strtof(pos, &end);
+  pdb_close_input(&input);
 
-      if ( !(end == pos || errno == ERANGE) ) {
-	prnote("PDB resolution is %.2f\n", f);
-      }
-    } else if (STRNEQ(buffer, "REMARK   4 ", 11) ) {
-      if (STRNEQ(buffer + 30, "FORMAT", 6)) {
-	prnote("PDB version %s\n", extrdat(buffer+40));
-      }
-    } else if (STRNEQ(buffer, "REMARK 2", 8) && 
-	       (buffer[8] == '0' || buffer[8] == '1' || buffer[8] == '3' ||
-		buffer[8] == '4' || buffer[8] == '5' || buffer[8] == '6') &&
-	       STRNEQ(buffer + 11, " PH ", 4) ) {
-      pos = strchr(buffer, ':');
-
-      if (pos) {
-	pos++;
-	errno = 0;
-	f = strtof(pos, &end);
-
-	if ( !(end == pos || errno == ERANGE) ) {
-	  prnote("PDB reports a pH of %.2f in REMARK 2nn\n", f);
-	}
-      }
-    } else if (STRNEQ(buffer, "REMARK 465", 10) ) {
-      if (!fr465) {
-	prnote("PDB warns of missing residues\n");
-	fr465 = true;
-      }
-    } else if (STRNEQ(buffer, "REMARK 470", 10) ) {
-      if (!fr470) {
-	prnote("PDB warns of missing atoms\n");
-	fr470 = true;
-      }
-    } else if (STRNEQ(buffer, "REMARK 475", 10) ) {
-      if (!fr475) {
-	prnote("PDB warns of residues with zero occupancy\n");
-	fr475 = true;
-      }
-    } else if (STRNEQ(buffer, "REMARK 480", 10) ) {
-      if (!fr480) {
-	prnote("PDB warns of non-hydrogens with zero occupancy\n");
-	fr480 = true;
-      }
-    } 
+  if (midx) {
+    free(midx->models);
+    free(midx);
   }
 
-  fzclose(pdb_stream);
-
-  if (!pdb->first_chain) {
+  if (pdb->nchains == 0) {
     prerror(2, "\n%d lines read but no atoms extracted from %s.\n",
 	    line_cnt, filename);
   }
 
-  if (model_found) {
+  if (model_found && model_no != PDB_ALL_MODELS) {
     pdb->model_no = model_no;
   }
 
-  /* flush warning of last residue if it exists */
-  if (options.warnocc && !stack_is_empty(occ_warn) ) {
-    prwarn("very low occupancy for atoms in residue %s %d%c %c: ",
-	   curr_residue->resName, curr_residue->resSeq, curr_residue->iCode,
-	   curr_chain->chainID);
+  pdb = pdb_builder_finish(builder, nssb);
+  pdb_summary(pdb);
 
-    while ( (res_name = stack_pop(occ_warn)) ) {
-      fprintf(stdout, " %s", (char *)res_name);
-    }
+  return pdb;
+}
+
+
+#ifdef PDB_FIXED_COORDS
+/*
+ * format_scaled: format an integer in units of 10^-ndec like %width.ndecf
+ *
+ * in:  buffer of PDB_NUM_LEN chars, number, field width, number of decimals
+ *
+ */
+
+static void format_scaled(char *buf, long val, unsigned int width,
+			  unsigned int ndec)
+{
+  unsigned int i, n = 0, pad;
+  unsigned long u = val < 0 ? -(unsigned long) val : (unsigned long) val;
+
+  char tmp[PDB_NUM_LEN];
 
-    fprintf(stdout, "\n");
+
+  /* digits from the right */
+  for (i = 0; i < ndec; i++) {
+    tmp[n++] = '0' + u % 10;
+    u /= 10;
   }
 
-  stack_destroy(occ_warn);
+  tmp[n++] = '.';
+
+  do {
+    tmp[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
 
-  fprintf(stdout, "\n%d atoms, %d residues, %d chain%s read\n",
-	  atom_cnt, residue_cnt, chain_cnt, chain_cnt > 1 ? "s" : "");
+  if (val < 0) {
+    tmp[n++] = '-';
+  }
 
-  pdb->natoms = atom_cnt;
-  pdb->nres = residue_cnt;
-  pdb->nchains = chain_cnt;
+  pad = width > n ? width - n : 0;
+  memset(buf, ' ', pad);
 
+  for (i = 0; i < n; i++) {
+    buf[pad + i] = tmp[n - 1 - i];
+  }
 
-  return pdb;
+  buf[pad + n] = '\0';
 }
+#endif
 
 
 /*
- * pdb_write: write a PDB file in either standard or relaxed standard format
+ * pdb_write_model: write the MODEL/ENDMDL framed coordinate section of one
+ *                  model
  *
- * in:  pdb root structure, file name, chosen format, name of CYS residue in
- *      disulfide bond
+ * in:  output stream, model, chosen format, if S-S bonds exist, name of CYS
+ *      residue in disulfide bond, atom, residue and chain counters
  *
  */
 
-void pdb_write(pdb_root *pdb, const char *filename, const char *format,
-	       const char* ss_name, char altLoc)
+static void pdb_write_model(FILE *pdb_stream, pdb_root *model, int std_type,
+			    bool ssbonds, const char* ss_name,
+			    int *atom_cnt, int *residue_cnt, int *chain_cnt)
 {
-  int std_type= PDB_FMT_STD, resSeq = 0;
-  int serno = 0, atom_cnt = 0, residue_cnt = 0, chain_cnt = 0;
+  int serno = 0, resSeq = 0;
+  unsigned int a;
+  uint32_t ss_code = pdb_name_code(ss_name);
 
   char chainID = ' ', iCode = ' ';
   char *resName = NULL, *rectype = NULL;
   char serial[6];
   char atomrec[] = "ATOM  ", hetrec[] = "HETATM";
 
-  FILE *pdb_stream;
+#ifdef PDB_FIXED_COORDS
+  char x[PDB_NUM_LEN], y[PDB_NUM_LEN], z[PDB_NUM_LEN];
+  char occupancy[PDB_NUM_LEN], tempFactor[PDB_NUM_LEN];
+#else
+  float x, y, z, occupancy, tempFactor;
+#endif
 
-  pdb_atom *curr_atom;
+  const pdb_atoms *atoms = &model->atoms;
+  const pdb_atom *curr_atom;
   pdb_residue *curr_residue;
   pdb_chain *curr_chain;
 
-  pdb_ssbond *ssbond, **ssbonds;
-
-
-  if (*format == '\0' || STRNEQ(format, "std", 3) ) {
-    std_type = PDB_FMT_STD;
-    options.noter = 0;
-  } else if STRNEQ(format, "min", 3) {
-    std_type = PDB_FMT_MIN;
-  } else {
-    prerror(2, "Unknown format type: %s\n", format);
-  }
-
-  if (!(pdb_stream = fopen(filename, "w")) ) {
-    perror(filename);
-    exit(2);
-  }
-
-  if (pdb->ID[0] != '\0') {
-    fprintf(pdb_stream, "REMARK   this is a conversion of PDB ID %s\n",
-	    pdb->ID);
-  }
-
-  if (options.wrss && pdb->ssbonds) {
-    for (ssbonds = pdb->ssbonds; *ssbonds; ssbonds++) {
-	ssbond = *ssbonds;
-
-      fprintf(pdb_stream,
-	      "SSBOND %3i CYS %c %4i%c   CYS %c %4i%c                       "
-	      "%6s %6s",
-	      ssbond->serNum, ssbond->ss1.chainID, ssbond->ss1.seqNum,
-	      ssbond->ss1.icode, ssbond->ss2.chainID, ssbond->ss2.seqNum,
-	      ssbond->ss2.icode, ssbond->ss1.SymOP, ssbond->ss2.SymOP);
-
-      if (ssbond->Length > 0.0) {
-	fprintf(pdb_stream, " %5.2f\n", ssbond->Length);
-      } else {
-	fprintf(pdb_stream, "      \n");
-      }
-    }
-  }
-
-  if (pdb->cryst1[0] != '\0' && !options.nocryst) {
-    switch (std_type) {
-    case PDB_FMT_STD:
-      fprintf(pdb_stream, "%-80s\n", pdb->cryst1);
-      break;
-    case PDB_FMT_MIN:
-      fprintf(pdb_stream, "%s\n", pdb->cryst1);
-      break;
-    }
-  }
 
-  if (pdb->model_no > 0 && !options.nomodel) {
+  if (model->model_no > 0 && !options.nomodel) {
     switch (std_type) {
     case PDB_FMT_STD:
-      fprintf(pdb_stream, "MODEL     %4i%65s\n", pdb->model_no, " ");
+      fprintf(pdb_stream, "MODEL     %4i%65s\n", model->model_no, " ");
 	break;
     case PDB_FMT_MIN:
-      fprintf(pdb_stream, "MODEL     %4i\n", pdb->model_no);
+      fprintf(pdb_stream, "MODEL     %4i\n", model->model_no);
       break;
     }
   }
 
-  for (curr_chain = pdb->first_chain; curr_chain; curr_chain = curr_chain->next) {
-    chain_cnt++;		/* chain */
+  for (curr_chain = model->chains;
+       curr_chain < model->chains + model->nchains; curr_chain++) {
+    (*chain_cnt)++;		/* chain */
 
-    for (curr_residue = curr_chain->first_residue;
-	 curr_residue && curr_residue->chain == curr_chain;
-	 curr_residue = curr_residue->next) {  /* residue */
-      residue_cnt++;
+    for (curr_residue = model->residues + curr_chain->begin;
+	 curr_residue < model->residues + curr_chain->end;
+	 curr_residue++) {  /* residue */
+      (*residue_cnt)++;
 
       if (curr_residue->rectype == 'A') {
 	rectype = atomrec;
@@ -784,15 +3060,10 @@ void pdb_write(pdb_root *pdb, const char *filename, const char *format,
       }
 
 
-      for (curr_atom = curr_residue->first_atom;
-	   curr_atom && curr_atom->residue == curr_residue;
-	   curr_atom = curr_atom->next) {  /* atom */
-
-	if (curr_atom->altLoc != altLoc && curr_atom->altLoc != ' ') {
-	  continue;
-	}
+      for (a = curr_residue->begin; a < curr_residue->end; a++) {  /* atom */
+	curr_atom = &atoms->info[a];
 
-	atom_cnt++;
+	(*atom_cnt)++;
 
 	if (options.keepser) {
 	  strncpy(serial, curr_atom->serial, PDB_SERIAL_LEN-1);
@@ -808,20 +3079,31 @@ void pdb_write(pdb_root *pdb, const char *filename, const char *format,
 	  sprintf(serial, "%i", serno);
 	}
 
-	if (pdb->ssbonds && !options.keepssn &&
-	    STRNEQ(curr_residue->resName, ss_name, PDB_ATOM_NAME_LEN-1) ) {
-	  strcpy(curr_residue->resName, "CYS ");
-	  curr_residue->resName[PDB_ATOM_NAME_LEN-1] = '\0';
+	if (ssbonds && !options.keepssn && curr_residue->code == ss_code) {
+	  pdb_set_res_name(curr_residue, "CYS ");
 	}
 
+#ifdef PDB_FIXED_COORDS
+	format_scaled(x, atoms->x[a], 8, 3);
+	format_scaled(y, atoms->y[a], 8, 3);
+	format_scaled(z, atoms->z[a], 8, 3);
+	format_scaled(occupancy, atoms->occupancy[a], 6, 2);
+	format_scaled(tempFactor, atoms->tempFactor[a], 6, 2);
+#else
+	x = atoms->x[a];
+	y = atoms->y[a];
+	z = atoms->z[a];
+	occupancy = atoms->occupancy[a];
+	tempFactor = atoms->tempFactor[a];
+#endif
+
 	switch (std_type) {
 	case PDB_FMT_STD:
 	  fprintf(pdb_stream, PDB_STD_OUT_FORMAT, rectype,
 		  serial, curr_atom->name, curr_atom->altLoc,
 		  curr_residue->resName, curr_chain->chainID,
 		  curr_residue->resSeq, curr_residue->iCode,
-		  curr_atom->pos[0], curr_atom->pos[1], curr_atom->pos[2],
-		  curr_atom->occupancy, curr_atom->tempFactor,
+		  x, y, z, occupancy, tempFactor,
 		  curr_residue->segID, curr_atom->element,
 		  curr_atom->charge);
 	  break;
@@ -829,8 +3111,7 @@ void pdb_write(pdb_root *pdb, const char *filename, const char *format,
 	  fprintf(pdb_stream, PDB_MIN_OUT_FORMAT, rectype,
 		  serial, curr_atom->name,
 		  curr_residue->resName, curr_chain->chainID,
-		  curr_residue->resSeq,
-		  curr_atom->pos[0], curr_atom->pos[1], curr_atom->pos[2]);
+		  curr_residue->resSeq, x, y, z);
 	  break;
 	}
       }	/* atom */
@@ -858,7 +3139,7 @@ void pdb_write(pdb_root *pdb, const char *filename, const char *format,
     }
   } /* chain */
 
-  if (pdb->model_no > 0 && !options.nomodel) {
+  if (model->model_no > 0 && !options.nomodel) {
     switch (std_type) {
     case PDB_FMT_STD:
       fprintf(pdb_stream, "%-80s\n", "ENDMDL");
@@ -868,7 +3149,86 @@ void pdb_write(pdb_root *pdb, const char *filename, const char *format,
       break;
     }
   }
-	
+}
+
+
+/*
+ * pdb_write: write a PDB file in either standard or relaxed standard format
+ *
+ * in:  pdb root structure, file name, chosen format, name of CYS residue in
+ *      disulfide bond; all models linked to the root structure are written,
+ *      with the alternate locations left by pdb_select_altloc
+ *
+ */
+
+void pdb_write(pdb_root *pdb, const char *filename, const char *format,
+	       const char* ss_name)
+{
+  int std_type= PDB_FMT_STD;
+  int atom_cnt = 0, residue_cnt = 0, chain_cnt = 0, model_cnt = 0;
+
+  FILE *pdb_stream;
+
+  pdb_root *model;
+
+  pdb_ssbond *ssbond, **ssbonds;
+
+
+  if (*format == '\0' || STRNEQ(format, "std", 3) ) {
+    std_type = PDB_FMT_STD;
+    options.noter = 0;
+  } else if STRNEQ(format, "min", 3) {
+    std_type = PDB_FMT_MIN;
+  } else {
+    prerror(2, "Unknown format type: %s\n", format);
+  }
+
+  if (!(pdb_stream = fopen(filename, "w")) ) {
+    perror(filename);
+    exit(2);
+  }
+
+  if (pdb->ID[0] != '\0') {
+    fprintf(pdb_stream, "REMARK   this is a conversion of PDB ID %s\n",
+	    pdb->ID);
+  }
+
+  if (options.wrss && pdb->ssbonds) {
+    for (ssbonds = pdb->ssbonds; *ssbonds; ssbonds++) {
+	ssbond = *ssbonds;
+
+      fprintf(pdb_stream,
+	      "SSBOND %3i CYS %c %4i%c   CYS %c %4i%c                       "
+	      "%6s %6s",
+	      ssbond->serNum, ssbond->ss1.chainID, ssbond->ss1.seqNum,
+	      ssbond->ss1.icode, ssbond->ss2.chainID, ssbond->ss2.seqNum,
+	      ssbond->ss2.icode, ssbond->ss1.SymOP, ssbond->ss2.SymOP);
+
+      if (ssbond->Length > 0.0) {
+	fprintf(pdb_stream, " %5.2f\n", ssbond->Length);
+      } else {
+	fprintf(pdb_stream, "      \n");
+      }
+    }
+  }
+
+  if (pdb->cryst1[0] != '\0' && !options.nocryst) {
+    switch (std_type) {
+    case PDB_FMT_STD:
+      fprintf(pdb_stream, "%-80s\n", pdb->cryst1);
+      break;
+    case PDB_FMT_MIN:
+      fprintf(pdb_stream, "%s\n", pdb->cryst1);
+      break;
+    }
+  }
+
+  for (model = pdb; model; model = model->next_model) {
+    pdb_write_model(pdb_stream, model, std_type,
+		    pdb->ssbonds || model->ssbonds, ss_name,
+		    &atom_cnt, &residue_cnt, &chain_cnt);
+  }
+
   if (!options.noend) {
     switch (std_type) {
     case PDB_FMT_STD:
@@ -880,57 +3240,87 @@ void pdb_write(pdb_root *pdb, const char *filename, const char *format,
     }
   }
 
-  fprintf(stdout, "%d atoms, %d residues, %d chain%s written\n",
-	  atom_cnt, residue_cnt, chain_cnt, chain_cnt > 1 ? "s" : "");
+  fprintf(stdout, "%d atoms, %d residues, %d chain%s", atom_cnt, residue_cnt,
+	  chain_cnt, chain_cnt > 1 ? "s" : "");
+
+  if (pdb->next_model) {
+    for (model = pdb; model; model = model->next_model) {
+      model_cnt++;
+    }
+
+    fprintf(stdout, " in %d models", model_cnt);
+  }
+
+  fprintf(stdout, " written\n");
 
   fclose(pdb_stream);
 }
 
 
 /*
- * pdb_destroy: release allocated memory associated with pdb structures
+ * pdb_destroy_model: free all memory of a model and the models following it,
+ *                    tables within a cache mapping are left alone
  *
- * in:  pdb root structure
+ * in:  pdb root structure, cache mapping and its size
  *
  */
 
-void pdb_destroy(pdb_root *pdb)
-{
-  pdb_atom *curr_atom, *next_atom;
-  pdb_residue *curr_residue, *next_residue;
-  pdb_chain *curr_chain, *next_chain;
+#define PDB_FREE(ptr) do {						\
+    if (!cache || (uintptr_t) (ptr) - (uintptr_t) cache >= cache_size)	\
+      free(ptr);							\
+  } while (0)
 
+static void pdb_destroy_model(pdb_root *pdb, const void *cache,
+			      size_t cache_size)
+{
   pdb_ssbond **ssbonds;
 
 
+  if (pdb->next_model) {
+    pdb_destroy_model(pdb->next_model, cache, cache_size);
+  }
+
   if (pdb->ssbonds) {
     for (ssbonds = pdb->ssbonds; *ssbonds; ssbonds++) {
-      free(*ssbonds);
+      PDB_FREE(*ssbonds);
     }
   }
 
-  free(pdb->ssbonds);
+  PDB_FREE(pdb->ssbonds);
 
-  for (curr_chain = pdb->first_chain; curr_chain; curr_chain = next_chain) {
-    next_chain = curr_chain->next;
+  PDB_FREE(pdb->atoms.x);
+  PDB_FREE(pdb->atoms.y);
+  PDB_FREE(pdb->atoms.z);
+  PDB_FREE(pdb->atoms.occupancy);
+  PDB_FREE(pdb->atoms.tempFactor);
+  PDB_FREE(pdb->atoms.info);
+  PDB_FREE(pdb->shadows);
 
-    for (curr_residue = curr_chain->first_residue;
-	 curr_residue && curr_residue->chain == curr_chain;
-	 curr_residue = next_residue) {
-      next_residue = curr_residue->next;
+  PDB_FREE(pdb->residues);
+  PDB_FREE(pdb->chains);
 
-      for (curr_atom = curr_residue->first_atom;
-	   curr_atom && curr_atom->residue == curr_residue;
-	   curr_atom = next_atom) {
-	next_atom = curr_atom->next;
-	free(curr_atom);
-      }
+  PDB_FREE(pdb);
+}
 
-      free(curr_residue);
-    }
+#undef PDB_FREE
+
+
+/*
+ * pdb_destroy: free all memory of a structure
+ *
+ * in:  pdb root structure
+ *
+ */
+
+void pdb_destroy(pdb_root *pdb)
+{
+  void *cache = pdb->cache;
+  size_t cache_size = pdb->cache_size;
 
-    free(curr_chain);
-  }
 
-  free(pdb);
+  pdb_destroy_model(pdb, cache, cache_size);
+
+  if (cache) {
+    fzunmap(cache, cache_size);
+  }
 }
@@ -10,8 +10,18 @@
 #ifndef _PDB_H
 #define _PDB_H      1
 
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "config.h"
 #include "util/vec.h"
 
+#ifdef PDB_FIXED_COORDS
+#include <math.h>
+#endif
+
 #define PDB_LINE_LEN 82
 #define PDB_RES_NAME_LEN 5
 #define PDB_ATOM_NAME_LEN 5
@@ -22,6 +32,66 @@
 #define PDB_ID_LEN 5
 #define PDB_SSBOND_SYMOP_LEN 7
 
+#define PDB_ALL_MODELS INT_MAX	/* model_no to read every MODEL */
+/* altLoc of highest occupancy per residue, not printable so never a value
+   accepted from input */
+#define PDB_ALTLOC_OCC '\001'
+
+/* atom and residue names of up to four characters packed into an integer,
+   equal codes mean equal names; also usable as case label */
+#define PDB_NAME_CODE(a, b, c, d)					\
+  ( (uint32_t) (unsigned char) (a) |					\
+    (uint32_t) (unsigned char) (b) << 8 |				\
+    (uint32_t) (unsigned char) (c) << 16 |				\
+    (uint32_t) (unsigned char) (d) << 24 )
+
+/* coordinates, occupancies and B-factors as stored: either floats or, with
+   PDB_FIXED_COORDS, the integer decimals of the PDB columns (%8.3f, %6.2f)
+   which read and write back exactly; PDB_*_FLOAT converts for geometry,
+   PDB_MAKE_* converts a computed value for storage */
+#ifdef PDB_FIXED_COORDS
+typedef int32_t pdb_coord;	/* 1/1000 Angstrom */
+typedef int16_t pdb_occ;	/* 1/100, PDB occupancies are fractions */
+typedef int32_t pdb_bfac;	/* 1/100, may exceed the int16_t range */
+
+#define PDB_COORD_FLOAT(c) ( (float) ((c) / 1000.0) )
+#define PDB_OCC_FLOAT(o) ( (float) ((o) / 100.0) )
+#define PDB_BFAC_FLOAT(b) ( (float) ((b) / 100.0) )
+
+#define PDB_MAKE_COORD(f) ( (pdb_coord) lrint((f) * 1000.0) )
+#define PDB_MAKE_OCC(f)							\
+  ( (pdb_occ) ((f) >= INT16_MAX / 100.0 ? INT16_MAX :			\
+	       (f) <= INT16_MIN / 100.0 ? INT16_MIN : lrint((f) * 100.0)) )
+#define PDB_MAKE_BFAC(f) ( (pdb_bfac) lrint((f) * 100.0) )
+#else
+typedef float pdb_coord;
+typedef float pdb_occ;
+typedef float pdb_bfac;
+
+#define PDB_COORD_FLOAT(c) (c)
+#define PDB_OCC_FLOAT(o) (o)
+#define PDB_BFAC_FLOAT(b) (b)
+
+#define PDB_MAKE_COORD(f) ( (float) (f) )
+#define PDB_MAKE_OCC(f) ( (float) (f) )
+#define PDB_MAKE_BFAC(f) ( (float) (f) )
+#endif
+
+/* residue classes as bound from the topology, the protein ones in the order
+   protonate counts them */
+enum pdb_res_class {
+  PDB_RES_OTHER,
+  PDB_RES_ASP, PDB_RES_GLU, PDB_RES_ARG, PDB_RES_CYS, PDB_RES_HIS,
+  PDB_RES_LYS, PDB_RES_TYR,
+  PDB_RES_GLN, PDB_RES_ASN, PDB_RES_TRP, PDB_RES_SER, PDB_RES_THR,
+  PDB_RES_WATER,
+  PDB_RES_NUCLEIC
+};
+
+#define PDB_RES_TITRATABLE(c) ((c) >= PDB_RES_ASP && (c) <= PDB_RES_TYR)
+
+struct _topol;			/* top.h */
+
 
 struct _ssbond {
   char chainID;
@@ -37,34 +107,67 @@ typedef struct _pdb_ssbond {
   struct _ssbond ss2;
 } pdb_ssbond;
 
-typedef struct _pdb_atom {
+typedef struct _pdb_atom_rec {	/* decoded ATOM/HETATM record */
+  char rectype;
+  char serial[PDB_SERIAL_LEN];
+  char name[PDB_ATOM_NAME_LEN];
+  char altLoc;
+  char resName[PDB_RES_NAME_LEN];
+  char chainID;
+  int resSeq;
+  char iCode;
+  pdb_coord x, y, z;
+  pdb_occ occupancy;
+  pdb_bfac tempFactor;
+  char segID[PDB_SEG_NAME_LEN];
+  char element[PDB_ELEMENT_LEN];
+  char charge[PDB_CHARGE_LEN];
+} pdb_atom_rec;
+
+typedef struct _pdb_atom {	/* text fields of an atom */
+  uint32_t code;		/* of name, used for all comparisons */
   char serial[PDB_SERIAL_LEN];	/* actually int but unreliable */
   char name[PDB_ATOM_NAME_LEN];
   char altLoc;
-  fvec pos;
-  float occupancy;
-  float tempFactor;
-  char element[3];
-  char charge[3];
-  struct _pdb_residue *residue;
-  struct _pdb_atom *next;
+  char element[PDB_ELEMENT_LEN];
+  char charge[PDB_CHARGE_LEN];
 } pdb_atom;
 
+typedef struct _pdb_atoms {	/* atom store, one array per field */
+  unsigned int used;		/* slots up to the limit of the last residue */
+  unsigned int size;		/* allocated slots */
+  pdb_coord *x, *y, *z;
+  pdb_occ *occupancy;
+  pdb_bfac *tempFactor;
+  pdb_atom *info;
+} pdb_atoms;
+
+typedef struct _pdb_shadow {	/* heavy atom of a conformer not selected */
+  uint32_t code;		/* of name */
+  pdb_coord x, y, z;
+} pdb_shadow;
+
 typedef struct _pdb_residue {
   char iCode;
   int resSeq;
   char rectype;
+  uint32_t code;		/* of resName, used for all comparisons */
   char resName[PDB_RES_NAME_LEN];
   char segID[PDB_SEG_NAME_LEN];	/* old PDB v2.2, CHARMM still uses it */
-  pdb_atom *first_atom;
-  struct _pdb_chain *chain;
-  struct _pdb_residue *next;
+  unsigned int chain;		/* index into the chain table */
+  unsigned int begin, end;	/* atoms of the residue */
+  unsigned int limit;		/* end to limit are free for hydrogens */
+  const struct _topol *top;	/* topology entry of resName or NULL */
+  const struct _topol *entry;	/* entry for hbuild incl. terminal variant */
+  enum pdb_res_class res_class;
+  bool has_alt;			/* alternate locations were read */
+  unsigned int shadow_begin;	/* dropped atoms in the shadow table, see */
+  unsigned int shadow_end;	/* pdb_select_altloc */
 } pdb_residue;
 
 typedef struct _pdb_chain {
   char chainID;
-  pdb_residue *first_residue;
-  struct _pdb_chain *next;
+  unsigned int begin, end;	/* residues of the chain */
 } pdb_chain;
 
 typedef struct _pdb_root {
@@ -75,19 +178,90 @@ typedef struct _pdb_root {
   char ID[PDB_ID_LEN];
   char cryst1[PDB_LINE_LEN];
   pdb_ssbond **ssbonds;
-  pdb_chain *first_chain;
+  pdb_chain *chains;		/* nchains entries */
+  pdb_residue *residues;	/* nres entries in chain order */
+  pdb_atoms atoms;		/* in residue order */
+  pdb_shadow *shadows;		/* heavy atoms of dropped conformers */
+  unsigned int max_chains;	/* allocated table entries */
+  unsigned int max_res;
+  struct _pdb_root *next_model;	/* further models with PDB_ALL_MODELS */
+  void *cache;			/* mapping holding the tables if from cache */
+  size_t cache_size;
 } pdb_root;
 
+typedef struct _pdb_metadata {	/* header and REMARK data, see pdb_read */
+  char header[PDB_LINE_LEN];	/* classification, date and ID code */
+  char *title;			/* record texts, a line per record */
+  char *obsolete;		/* (OBSLTE), NULL if there is none */
+  char *split;
+  char *caveat;
+  char *expdta;
+  char *mdltyp;
+  char version[PDB_LINE_LEN];	/* format version of REMARK 4 */
+  int nmodels;			/* NUMMDL, 0 if not given */
+  float resolution;		/* REMARK 2, negative if not given */
+  float pH;			/* first of REMARK 200-265, negative if not
+				   given */
+  bool missing_res;		/* REMARK 465 */
+  bool missing_atoms;		/* REMARK 470 */
+  bool zero_occ_res;		/* REMARK 475 */
+  bool zero_occ_atoms;		/* REMARK 480 */
+} pdb_metadata;
+
+typedef struct _pdb_builder pdb_builder;  /* assembles chains from atoms */
+typedef struct _pdb_res_index pdb_res_index;  /* residues by chain/resSeq */
 
-pdb_atom *pdb_insert_atom_node(pdb_atom *old);
+
+/* check the element of an atom for hydrogen */
+#define ISHYD(e) ( ( (e)[0] ) == ' ' && ( (e)[1] ) == 'H' )
+
+/* copy the coordinates of atom i of a store into a vector */
+#define PDB_ATOM_POS(atoms, i, v)					\
+  vecCreate(v, PDB_COORD_FLOAT((atoms)->x[i]),				\
+	    PDB_COORD_FLOAT((atoms)->y[i]), PDB_COORD_FLOAT((atoms)->z[i]))
+
+
+uint32_t pdb_name_code(const char *name);
+void pdb_set_res_name(pdb_residue *residue, const char *name);
+void pdb_set_atom_name(pdb_atom *atom, const char *name);
+
+pdb_res_index *pdb_res_index_init(pdb_root *pdb);
+pdb_residue *pdb_res_index_find(const pdb_res_index *index, char chainID,
+				int resSeq, const pdb_residue *after);
+void pdb_res_index_destroy(pdb_res_index *index);
+
+void pdb_select_altloc(pdb_root *pdb, char altLoc);
+unsigned int pdb_altlocs(const pdb_root *pdb, char *locs);
+int pdb_copy_residue(pdb_atoms *atoms, pdb_residue *residue,
+		     const pdb_atoms *from, const pdb_residue *source);
+pdb_root *pdb_copy(const pdb_root *pdb);
+void pdb_reserve_atoms(pdb_root *pdb, const unsigned int *nfree);
+unsigned int pdb_insert_atoms(pdb_root *pdb, pdb_residue *residue,
+			      unsigned int pos, unsigned int n);
+unsigned int pdb_open_atoms(pdb_atoms *atoms, pdb_residue *residue,
+			    unsigned int pos, unsigned int n);
+
+int pdb_scan_atom(pdb_atom_rec *rec, const char *line, size_t len);
 
 int pdb_format_atom(char *restrict dest, const char *restrict src);
 char *pdb_format_residue(char *restrict dest, const char *restrict src);
 
+pdb_builder *pdb_builder_create(const char *ss_name);
+pdb_root *pdb_builder_root(pdb_builder *b);
+void pdb_builder_add_atom(pdb_builder *b, pdb_atom_rec *rec);
+void pdb_builder_new_model(pdb_builder *b, int model_no);
+void pdb_builder_ter(pdb_builder *b, char chainID);
+void pdb_builder_break_chain(pdb_builder *b);
+pdb_root *pdb_builder_finish(pdb_builder *b, int *nssb);
+void pdb_add_ssbond(pdb_root *pdb, const pdb_ssbond *ssbond);
+void pdb_summary(const pdb_root *pdb);
+
 pdb_root *pdb_read(pdb_root *pdb, const char *filename,  const char* ss_name,
-		   int model_no, int *nssb);
+		   int model_no, int *nssb, pdb_metadata *meta);
+void pdb_metadata_print(const pdb_metadata *meta, const char *filename);
+void pdb_metadata_destroy(pdb_metadata *meta);
 void pdb_write(pdb_root *pdb, const char *filename, const char *format,
-	       const char* ss_name, char altLoc);
+	       const char* ss_name);
 void pdb_destroy(pdb_root *pdb);
 
 #endif
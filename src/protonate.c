@@ -40,10 +40,6 @@
 #define TTB_LINE_LEN 82
 #define AR_TAB_SIZE 12	      // atoms per residue table
 #define TITR_TAB_SIZE 7	      // the number of titratable residues as below
-#define TITRATABLE(res) (STREQ(res, "ARG ") || STREQ(res, "ASP ") || \
-			 STREQ(res, "CYS ") || STREQ(res, "GLU ") || \
-			 STREQ(res, "HIS ") || STREQ(res, "LYS ") || \
-			 STREQ(res, "TYR ") )
 
 struct _titr_table {
   char name[PDB_ATOM_NAME_LEN];
@@ -54,16 +50,17 @@ struct _propka_table {
   char chainID;
   int resSeq;
   float pKa;
+  uint32_t code;
   char resName[PDB_RES_NAME_LEN];
   char *prot_name;
 };
 
 
 void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
-	       float pH, char altLoc)
+	       float pH)
 {
   int resSeq = 0, retc;
-  unsigned int i, maxar;
+  unsigned int i, a, maxar;
   unsigned int serno = 0;
   unsigned int atom_cnt = 0, residue_cnt = 0, titr_cnt = 0, line_cnt = 0;
   unsigned int nfields, nttb;
@@ -78,19 +75,21 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
   char tmp[PDB_ATOM_NAME_LEN];
   char buffer[TTB_LINE_LEN];
   char return_string[RETURN_STRING_SIZE];  // NOTE: do NOT allocate from heap!
-  char *key, *val, *bufp, **heavy;
+  char *key, *val, *bufp;
 
   float pKa = 0.0;
 
-  pdb_atom *curr_atom;
+  const pdb_atoms *atoms = &pdb->atoms;
+  const uint32_t *heavy;
+  const pdb_atom *curr_atom = NULL;
   pdb_residue *curr_residue;
   pdb_chain *curr_chain;
 
-  topol *top_entry;
+  const topol *top_entry;
 
-  Hashnode *curr_node;
+  struct _propka_table *propka_table, *tp, **sites;
 
-  struct _propka_table *propka_table, *tp;
+  pdb_res_index *index;
 
   // each atom of the following residues is stored individually:
   // ASP, GLU, ARG, CYS, HIS, LYS, TYR, GLN, ASN, TRP, SER, THR
@@ -110,19 +109,17 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
   }
 
 
-  for (curr_chain = pdb->first_chain; curr_chain; curr_chain = curr_chain->next) {
-    for (curr_residue = curr_chain->first_residue;
-	 curr_residue && curr_residue->chain == curr_chain;
-	 curr_residue = curr_residue->next) {  // residue
+  for (curr_chain = pdb->chains; curr_chain < pdb->chains + pdb->nchains;
+       curr_chain++) {
+    for (curr_residue = pdb->residues + curr_chain->begin;
+	 curr_residue < pdb->residues + curr_chain->end;
+	 curr_residue++) {  // residue
 
 
-      if ( !(curr_node = hash_search(top, curr_residue->resName,
-				     strlen(curr_residue->resName) ) ) ) {
+      if ( !(top_entry = curr_residue->top) ) {
 	continue;
       }
 
-      top_entry = hash_node_get_data(curr_node);
-
       // skip non-protein residues
       if (top_entry->mol_type != 'P' ||
 	  curr_residue->rectype != 'A') {
@@ -130,18 +127,13 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
       }
 
       // FIXME: C-terminus may need OXT
-      for (heavy = top_entry->heavy_atoms; *heavy; heavy++) {  // heavy
+      for (heavy = top_entry->heavy_codes; *heavy; heavy++) {  // heavy
 	found = false;
 
-	for (curr_atom = curr_residue->first_atom;
-	     curr_atom && curr_atom->residue == curr_residue;
-	     curr_atom = curr_atom->next) {
-
-	  if (curr_atom->altLoc != altLoc && curr_atom->altLoc != ' ') {
-	    continue;
-	  }
+	for (a = curr_residue->begin; a < curr_residue->end; a++) {
+	  curr_atom = &atoms->info[a];
 
-	  if (STRNEQ(*heavy, curr_atom->name, PDB_ATOM_NAME_LEN-1) ) {
+	  if (*heavy == curr_atom->code) {
 	    found = true;
 	    break;
 	  }
@@ -160,8 +152,9 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
 		  serial, curr_atom->name, curr_atom->altLoc,
 		  curr_residue->resName, curr_chain->chainID,
 		  curr_residue->resSeq, curr_residue->iCode,
-		  curr_atom->pos[0], curr_atom->pos[1], curr_atom->pos[2],
-		  curr_atom->occupancy, curr_atom->tempFactor);
+		  PDB_COORD_FLOAT(atoms->x[a]), PDB_COORD_FLOAT(atoms->y[a]),
+		  PDB_COORD_FLOAT(atoms->z[a]), PDB_OCC_FLOAT(atoms->occupancy[a]),
+		  PDB_BFAC_FLOAT(atoms->tempFactor[a]));
 	} else {
 	  prwarn("PROPKA cannot protonate: incomplete amino acid (%s %d%c %c)\n",
 		 curr_residue->resName, curr_residue->resSeq, curr_residue->iCode,
@@ -175,37 +168,13 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
       }	// heavy
 
       // number of atoms per residue stored individually
-      if (STREQ(curr_residue->resName, "ASP ") ) {
-	ar[0]++;
-	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "GLU ") ) {
-	ar[1]++;
-	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "ARG ") ) {
-	ar[2]++;
-	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "CYS ") ) {
-	ar[3]++;
-	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "HIS ") ) {
-	ar[4]++;
-	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "LYS ") ) {
-	ar[5]++;
-	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "TYR ") ) {
-	ar[6]++;
+      if (curr_residue->res_class >= PDB_RES_ASP &&
+	  curr_residue->res_class <= PDB_RES_THR) {
+	ar[curr_residue->res_class - PDB_RES_ASP]++;
+      }
+
+      if (PDB_RES_TITRATABLE(curr_residue->res_class) ) {
 	titr_cnt++;
-      } else if (STREQ(curr_residue->resName, "GLN ") ) {
-	ar[7]++;
-      } else if (STREQ(curr_residue->resName, "ASN ") ) {
-	ar[8]++;
-      } else if (STREQ(curr_residue->resName, "TRP ") ) {
-	ar[9]++;
-      } else if (STREQ(curr_residue->resName, "SER ") ) {
-	ar[10]++;
-      } else if (STREQ(curr_residue->resName, "THR ") ) {
-	ar[11]++;
       }
 
       residue_cnt++;
@@ -295,7 +264,7 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
 	       line_cnt);
     }
 
-    if (!TITRATABLE(tmp) ) {
+    if (!PDB_RES_TITRATABLE(top_name_class(pdb_name_code(tmp)) ) ) {
       prwarn ("%s: %s is not a titrable site in line %d.\n", ttb_filename, tmp,
 	      line_cnt);
       continue;
@@ -334,6 +303,7 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
 
     assert(i < titr_cnt);
 
+    propka_table[i].code = pdb_name_code(propka_table[i].resName);
     propka_table[i].resSeq = resSeq;
     propka_table[i].chainID = chainID;
     propka_table[i].pKa = pKa;
@@ -351,53 +321,73 @@ void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
 
   propka_table[i].resName[0] = '\0';
 
+  /* the first PROPKA site of a titratable residue applies; PROPKA reports no
+     insertion codes so all residues with the sequence number are candidates */
+  sites = allocate(pdb->nres * sizeof(*sites));
+  memset(sites, 0, pdb->nres * sizeof(*sites));
+
+  index = pdb_res_index_init(pdb);
 
-  for (curr_chain = pdb->first_chain; curr_chain; curr_chain = curr_chain->next) {
-    for (curr_residue = curr_chain->first_residue;
-	 curr_residue && curr_residue->chain == curr_chain;
-	 curr_residue = curr_residue->next) {  // residue
+  for (tp = propka_table; *(tp->resName); tp++) {
+    if (!tp->prot_name) {
+      continue;
+    }
+
+    for (curr_residue = pdb_res_index_find(index, tp->chainID, tp->resSeq,
+					   NULL);
+	 curr_residue;
+	 curr_residue = pdb_res_index_find(index, tp->chainID, tp->resSeq,
+					   curr_residue) ) {
+      if (!sites[curr_residue - pdb->residues] &&
+	  PDB_RES_TITRATABLE(curr_residue->res_class) &&
+	  curr_residue->code == tp->code) {
+	sites[curr_residue - pdb->residues] = tp;
+      }
+    }
+  }
 
-      if (!TITRATABLE(curr_residue->resName) )
+  pdb_res_index_destroy(index);
+
+
+  for (curr_chain = pdb->chains; curr_chain < pdb->chains + pdb->nchains;
+       curr_chain++) {
+    for (curr_residue = pdb->residues + curr_chain->begin;
+	 curr_residue < pdb->residues + curr_chain->end;
+	 curr_residue++) {  // residue
+
+      if ( !(tp = sites[curr_residue - pdb->residues]) )
 	continue;
 
-      for (tp = propka_table; *(tp->resName); tp++) {
-	if (tp->prot_name && STREQ(tp->resName, curr_residue->resName) &&
-	    tp->resSeq == curr_residue->resSeq &&
-	    tp->chainID == curr_chain->chainID) {
-
-	  // FIXME: how to deal with termini? "N+" and "C-" ignored at the moment
-	  if (pH < tp->pKa) {
-	    if (STREQ(curr_residue->resName, "HIS ") ||
-		STREQ(curr_residue->resName, "ASP ") ||
-		STREQ(curr_residue->resName, "GLU ") ) {
-
-	      prnote("protonating %s %i %c (pKa = %.2f)\n",
-		     curr_residue->resName, curr_residue->resSeq,
-		     curr_chain->chainID, tp->pKa);
-
-	      strncpy(curr_residue->resName, tp->prot_name, PDB_RES_NAME_LEN-1);
-	      curr_residue->resName[PDB_RES_NAME_LEN-1] = '\0';
-	    }
-	  } else {
-	    if (STREQ(curr_residue->resName, "LYS ") ||
-		STREQ(curr_residue->resName, "CYS ") || 
-		STREQ(curr_residue->resName, "ARG ") ||
-		STREQ(curr_residue->resName, "TYR ") ) {
-
-	      prnote("deprotonating %s %i %c (pKa = %.2f)\n",
-		     curr_residue->resName, curr_residue->resSeq,
-		     curr_chain->chainID, tp->pKa);
-
-	      strncpy(curr_residue->resName, tp->prot_name, PDB_RES_NAME_LEN-1);
-	      curr_residue->resName[PDB_RES_NAME_LEN-1] = '\0';
-	    }
-	  }
+      // FIXME: how to deal with termini? "N+" and "C-" ignored at the moment
+      if (pH < tp->pKa) {
+	if (curr_residue->res_class == PDB_RES_HIS ||
+	    curr_residue->res_class == PDB_RES_ASP ||
+	    curr_residue->res_class == PDB_RES_GLU) {
+
+	  prnote("protonating %s %i %c (pKa = %.2f)\n",
+		 curr_residue->resName, curr_residue->resSeq,
+		 curr_chain->chainID, tp->pKa);
 
-	  break;
+	  pdb_set_res_name(curr_residue, tp->prot_name);
+	  top_bind_residue(pdb, curr_residue - pdb->residues, top);
+	}
+      } else {
+	if (curr_residue->res_class == PDB_RES_LYS ||
+	    curr_residue->res_class == PDB_RES_CYS ||
+	    curr_residue->res_class == PDB_RES_ARG ||
+	    curr_residue->res_class == PDB_RES_TYR) {
+
+	  prnote("deprotonating %s %i %c (pKa = %.2f)\n",
+		 curr_residue->resName, curr_residue->resSeq,
+		 curr_chain->chainID, tp->pKa);
+
+	  pdb_set_res_name(curr_residue, tp->prot_name);
+	  top_bind_residue(pdb, curr_residue - pdb->residues, top);
 	}
       }
     } // residue
   } // chain
 
+  free(sites);
   free(propka_table);
 }
@@ -10,6 +10,6 @@
 #define _PROTONATE_H      1
 
 void protonate(pdb_root *pdb, const Hashtable *top, const char *ttb_filename,
-	       float pH, char altLoc);
+	       float pH);
 
 #endif
@@ -22,13 +22,12 @@
 
 
 #define MAX_SSDIST 9.0		/*  S-S bond distance */
-#define STD_CYS_NAME "CYS "
+#define STD_CYS_CODE PDB_NAME_CODE('C', 'Y', 'S', ' ')
 
 /* only accept CYS in ATOM records and assume sulfur's first letter is 'S' */
 #define NOT_CYS(res,at)							\
-  (res->rectype != 'A' ||						\
-   !STRNEQ(res->resName, STD_CYS_NAME, PDB_RES_NAME_LEN-1) ||		\
-   STRNEQ(res->resName, ss_name, PDB_RES_NAME_LEN-1) ||			\
+  (res->rectype != 'A' || res->code != STD_CYS_CODE ||			\
+   res->code == ss_code ||						\
    !(at->name[1] == 'S' && at->name[2] == 'G') )
 
 
@@ -44,11 +43,18 @@
 pdb_root *ssbuild(pdb_root *pdb, const char *ss_name)
 {
   int serNum = 0;
+  unsigned int a1, a2;
+
+  const uint32_t ss_code = pdb_name_code(ss_name);
 
   float dist;
 
-  pdb_atom *curr_atom1, *curr_atom2;
+  fvec pos1, pos2;
+
+  const pdb_atoms *atoms = &pdb->atoms;
+  const pdb_atom *curr_atom1, *curr_atom2;
   pdb_residue *curr_residue1, *curr_residue2;
+  pdb_residue *last = pdb->residues + pdb->nres;
 
   pdb_ssbond *ssbond;
 
@@ -56,56 +62,61 @@ pdb_root *ssbuild(pdb_root *pdb, const char *ss_name)
 
   pdb->ssbonds = NULL;
 
-  for (curr_atom1 = pdb->first_chain->first_residue->first_atom;
-       curr_atom1->residue->next;
-       curr_atom1 = curr_atom1->next) {
+  for (curr_residue1 = pdb->residues; curr_residue1 + 1 < last;
+       curr_residue1++) {
+    for (a1 = curr_residue1->begin; a1 < curr_residue1->end; a1++) {
+      curr_atom1 = &atoms->info[a1];
 
-    curr_residue1 = curr_atom1->residue;
+      if (NOT_CYS(curr_residue1, curr_atom1))
+	continue;
 
-    if (NOT_CYS(curr_residue1, curr_atom1))
-      continue;
+      PDB_ATOM_POS(atoms, a1, pos1);
 
-    for (curr_atom2 = curr_atom1->residue->next->first_atom;
-	 curr_atom2;
-	 curr_atom2 = curr_atom2->next) {
+      for (curr_residue2 = curr_residue1 + 1; curr_residue2 < last;
+	   curr_residue2++) {
+	for (a2 = curr_residue2->begin; a2 < curr_residue2->end; a2++) {
+	  curr_atom2 = &atoms->info[a2];
 
-      curr_residue2 = curr_atom2->residue;
+	  if (NOT_CYS(curr_residue2, curr_atom2))
+	    continue;
 
-      if (NOT_CYS(curr_residue2, curr_atom2))
-	continue;
+	  PDB_ATOM_POS(atoms, a2, pos2);
+	  dist = vecDist(pos1, pos2);
 
-      dist = vecDist(curr_atom1->pos, curr_atom2->pos);
+	  if (dist < MAX_SSDIST)
+	    break;
+	}
 
-      if (dist < MAX_SSDIST) {
-	strncpy(curr_residue1->resName, ss_name, PDB_RES_NAME_LEN-1);
-	curr_residue1->resName[PDB_RES_NAME_LEN-1] = '\0';
+	if (a2 < curr_residue2->end)
+	  break;
+      }
 
-	strncpy(curr_residue2->resName, ss_name, PDB_RES_NAME_LEN-1);
-	curr_residue2->resName[PDB_RES_NAME_LEN-1] = '\0';
+      if (curr_residue2 == last)
+	continue;
 
-	serNum++;
-	pdb->ssbonds = reallocate(pdb->ssbonds,
-				  (serNum+1) * sizeof(*pdb->ssbonds));
-	ssbond = allocate(sizeof(*ssbond));
+      pdb_set_res_name(curr_residue1, ss_name);
+      pdb_set_res_name(curr_residue2, ss_name);
 
-	ssbond->serNum = serNum;
+      serNum++;
+      pdb->ssbonds = reallocate(pdb->ssbonds,
+				(serNum+1) * sizeof(*pdb->ssbonds));
+      ssbond = allocate(sizeof(*ssbond));
 
-	ssbond->ss1.chainID = curr_residue1->chain->chainID;
-	ssbond->ss1.seqNum = curr_residue1->resSeq;
-	ssbond->ss1.icode = curr_residue1->iCode;
+      ssbond->serNum = serNum;
 
-	ssbond->ss2.chainID = curr_residue2->chain->chainID;
-	ssbond->ss2.seqNum = curr_residue2->resSeq;
-	ssbond->ss2.icode = curr_residue2->iCode;
+      ssbond->ss1.chainID = pdb->chains[curr_residue1->chain].chainID;
+      ssbond->ss1.seqNum = curr_residue1->resSeq;
+      ssbond->ss1.icode = curr_residue1->iCode;
 
-	ssbond->ss1.SymOP[0] = ssbond->ss2.SymOP[0] = '\0';
+      ssbond->ss2.chainID = pdb->chains[curr_residue2->chain].chainID;
+      ssbond->ss2.seqNum = curr_residue2->resSeq;
+      ssbond->ss2.icode = curr_residue2->iCode;
 
-	ssbond->Length = (float) sqrt(dist);
+      ssbond->ss1.SymOP[0] = ssbond->ss2.SymOP[0] = '\0';
 
-	pdb->ssbonds[serNum-1] = ssbond;
+      ssbond->Length = (float) sqrt(dist);
 
-	break;
-      }
+      pdb->ssbonds[serNum-1] = ssbond;
     }
   }
 
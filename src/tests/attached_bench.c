@@ -0,0 +1,183 @@
+/*
+ * time of counting the hydrogens already attached to the atoms of a residue,
+ * count_attached against the pairwise scan hbuild did before, for residues
+ * of growing size; hbuild.c is included as the function is static
+ *
+ *
+ * compile like (from a build directory):
+ *
+ * gcc -std=c99 -O2 -DNDEBUG -I. -I../src -o attached_bench \
+ *     ../src/tests/attached_bench.c ../src/pdb.c \
+ *     ../src/hplace.c ../src/top.c src/util/libmolprep_util.a \
+ *     -lz -lpthread -lm
+ *
+ * (add the libraries of further configured codecs), then
+ *
+ * ./attached_bench [atoms per test]
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../pdb.h"
+#include "../hbuild.c"
+#include "../util/arena.h"
+#include "../util/util.h"
+
+
+struct opt_flags options;
+
+
+static double now(void)
+{
+  struct timespec ts;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+/* the count as it was in hbuild, for every heavy atom */
+static void reference(const pdb_atoms *atoms, const pdb_residue *residue,
+		      unsigned int *nH)
+{
+  fvec pos1, pos2;
+
+
+  for (unsigned int a1 = residue->begin; a1 < residue->end; a1++) {
+    nH[a1 - residue->begin] = 0;
+
+    if (ISHYD(atoms->info[a1].element) ) {
+      continue;
+    }
+
+    PDB_ATOM_POS(atoms, a1, pos1);
+
+    for (unsigned int a2 = a1 + 1; a2 < residue->end; a2++) {
+      PDB_ATOM_POS(atoms, a2, pos2);
+
+      if (vecDist(pos1, pos2) < MAX_XHDIST &&
+	  ISHYD(atoms->info[a2].element)) {
+	nH[a1 - residue->begin]++;
+      }
+    }
+  }
+}
+
+
+/* a coiled chain of carbons, each with two hydrogens */
+static void make_residue(pdb_atoms *atoms, unsigned int n)
+{
+  unsigned int a, c = 0;
+
+  float x = 0.0f, y = 0.0f, z = 0.0f;
+
+
+  for (a = 0; a < n; a++) {
+    memset(&atoms->info[a], 0, sizeof(pdb_atom));
+
+    if (a % 3 == 0) {
+      x = 4.0f * cosf(c * 0.35f);
+      y = 4.0f * sinf(c * 0.35f);
+      z = c * 0.25f;
+      strcpy(atoms->info[a].element, " C");
+      c++;
+    } else {
+      x += a % 3 == 1 ? 0.63f : -1.26f;
+      y += 0.63f;
+      z += 0.63f;
+      strcpy(atoms->info[a].element, " H");
+    }
+
+    atoms->x[a] = PDB_MAKE_COORD(x);
+    atoms->y[a] = PDB_MAKE_COORD(y);
+    atoms->z[a] = PDB_MAKE_COORD(z);
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  static const unsigned int sizes[] = {24, 48, 96, 192, 768, 3072, 12288};
+
+  unsigned int total = 3000000, n, r, nres, ndiff, *nH, *ref;
+
+  double start, t_ref, t_new;
+
+  Arena *scratch;
+
+  pdb_atoms atoms;
+  pdb_residue residue;
+
+
+  if (argc > 1) {
+    total = atoi(argv[1]);
+  }
+
+  scratch = arena_init(4096);
+
+  fprintf(stdout, "atoms      scan/s   attached/s   speed-up  mismatches\n");
+
+  for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    n = sizes[s];
+    nres = total / n > 0 ? total / n : 1;
+
+    atoms.x = allocate(n * sizeof(*atoms.x));
+    atoms.y = allocate(n * sizeof(*atoms.y));
+    atoms.z = allocate(n * sizeof(*atoms.z));
+    atoms.info = allocate(n * sizeof(*atoms.info));
+    nH = allocate(n * sizeof(*nH));
+    ref = allocate(n * sizeof(*ref));
+
+    make_residue(&atoms, n);
+    residue.begin = 0;
+    residue.end = n;
+
+    /* warm up */
+    reference(&atoms, &residue, ref);
+    count_attached(&atoms, &residue, nH, scratch);
+
+    start = now();
+
+    for (r = 0; r < nres; r++) {
+      reference(&atoms, &residue, ref);
+    }
+
+    t_ref = now() - start;
+    start = now();
+
+    for (r = 0; r < nres; r++) {
+      arena_reset(scratch);
+      count_attached(&atoms, &residue, nH, scratch);
+    }
+
+    t_new = now() - start;
+
+    for (r = 0, ndiff = 0; r < n; r++) {
+      ndiff += nH[r] != ref[r];
+    }
+
+    fprintf(stdout, "%5u %11.3g %12.3g %10.1f %11u\n", n, nres / t_ref,
+	    nres / t_new, t_ref / t_new, ndiff);
+
+    free(atoms.x);
+    free(atoms.y);
+    free(atoms.z);
+    free(atoms.info);
+    free(nH);
+    free(ref);
+  }
+
+  arena_destroy(scratch);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+/*
+ * load time of a structure from its binary cache against parsing the PDB file
+ *
+ *
+ * compile like (from a build directory):
+ *
+ * gcc -std=c99 -O2 -DNDEBUG -I. -I../src -o cache_bench \
+ *     ../src/tests/cache_bench.c ../src/pdb.c ../src/cache.c \
+ *     src/util/libmolprep_util.a -lz -lpthread -lm
+ *
+ * (add the libraries of further configured codecs), then
+ *
+ * ./cache_bench file.pdb [repeats] > /dev/null
+ *
+ * The program messages go to stdout, the timings to stderr.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../pdb.h"
+#include "../cache.h"
+
+#define SS_NAME "CYS2"
+
+struct opt_flags options;
+
+
+static double now(void)
+{
+  struct timespec ts;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+int main(int argc, char **argv)
+{
+  int i, repeats = 10, nssb;
+  unsigned int natoms = 0;
+
+  double start, t_read = 0.0, t_cache = 0.0;
+
+  pdb_root *pdb;
+
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s file.pdb [repeats]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (argc > 2) {
+    repeats = atoi(argv[2]);
+  }
+
+  options.remh = true;
+
+  for (i = 0; i < repeats; i++) {
+    start = now();
+    pdb = pdb_read(NULL, argv[1], SS_NAME, -1, &nssb, NULL);
+    t_read += now() - start;
+
+    natoms = pdb->natoms;
+
+    if (i == 0) {
+      cache_write(pdb, argv[1], SS_NAME, -1, nssb, "");
+    }
+
+    pdb_destroy(pdb);
+  }
+
+  for (i = 0; i < repeats; i++) {
+    start = now();
+    pdb = cache_read(argv[1], SS_NAME, -1, &nssb);
+    t_cache += now() - start;
+
+    if (!pdb) {
+      fprintf(stderr, "%s: cache could not be written or read\n", argv[1]);
+      exit(EXIT_FAILURE);
+    }
+
+    if (pdb->natoms != natoms) {
+      fprintf(stderr, "%s: cache holds %u atoms but %u were read\n", argv[1],
+	      pdb->natoms, natoms);
+      exit(EXIT_FAILURE);
+    }
+
+    pdb_destroy(pdb);
+  }
+
+  fprintf(stderr, "%u atoms\npdb_read:   %8.4f s\ncache_read: %8.4f s\n"
+	  "speed-up:   %8.1f\n", natoms, t_read / repeats, t_cache / repeats,
+	  t_read / t_cache);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/*
+ * throughput of the hydrogen placement kernels per bonding type and their
+ * deviation from the one-by-one calculation hbuild did before
+ *
+ *
+ * compile like (from a build directory):
+ *
+ * gcc -std=c99 -O2 -DNDEBUG -I. -I../src -o hplace_bench \
+ *     ../src/tests/hplace_bench.c ../src/hplace.c \
+ *     src/util/libmolprep_util.a -lz -lpthread -lm
+ *
+ * (add -mavx for the AVX kernels), then
+ *
+ * ./hplace_bench [placements] [repeats]
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../hplace.h"
+#include "../util/util.h"
+
+#define SIN_tetra 0.9428090415820634
+#define COS_tetra -0.3333333333333333
+#define SIN_tetra_h 0.8164965809277260
+#define COS_tetra_h 0.5773502691896257
+#define SIN_tetra_05 0.4714045207910317
+#define SIN_120 0.8660254037844387
+#define COS_120 -0.5
+
+#define SIN_theta1 0.76604444311897803520
+#define SIN_theta2 0.43019600888661864331
+#define COS_phi 0.34202014332566873305
+#define SIN_phi 0.93969262078590838405
+#define COS_theta1 0.64278760968653932632
+#define COS_theta2 0.90273550608028281612
+
+struct opt_flags options;
+
+
+static double now(void)
+{
+  struct timespec ts;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+static void vec_helper(fvec v1, fvec v2, fvec v3,
+		       const fvec atom0, const fvec ctrl0, const fvec ctrl1)
+{
+  vecSub(v1, atom0, ctrl0);
+  vecSub(v3, ctrl0, ctrl1);
+  vecCrossProd(v2, v1, v3);
+
+  vecScalarDiv(v1, v1, vecLen(v1));
+  vecScalarDiv(v2, v2, vecLen(v2));
+  vecCrossProd(v3, v2, v1);
+}
+
+
+/* the calculation as it was in add_hydrogens */
+static void reference(unsigned int type, float d, const fvec pos0,
+		      fvec *ctrl_atom, fvec *rH)
+{
+  float vlen;
+
+  fvec v1, v2, v3, rcent;
+
+
+  switch (type) {
+  case 1:
+    vecSub(v1, pos0, ctrl_atom[0]);
+    vecSub(v3, pos0, ctrl_atom[1]);
+    vecAdd(v2, v1, v3);
+    vecScalarDiv(v2, v2, vecLen(v2));
+
+    for (unsigned int i = 0; i < 3; i++)
+      rH[0][i] = pos0[i] + d * v2[i];
+
+    break;
+
+  case 2:
+    vec_helper(v1, v2, v3, pos0, ctrl_atom[0], ctrl_atom[1]);
+
+    for (unsigned int i = 0; i < 3; i++)
+      rH[0][i] = pos0[i] + d * SIN_tetra * v3[i] - d * COS_tetra * v1[i];
+
+    break;
+
+  case 3:
+    vec_helper(v1, v2, v3, pos0, ctrl_atom[0], ctrl_atom[1]);
+
+    for (unsigned int i = 0; i < 3; i++) {
+      rH[0][i] = pos0[i] - d * SIN_120 * v3[i] - d * COS_120 * v1[i];
+      rH[1][i] = pos0[i] + d * SIN_120 * v3[i] - d * COS_120 * v1[i];
+    }
+
+    break;
+
+  case 4:
+    vec_helper(v1, v2, v3, pos0, ctrl_atom[0], ctrl_atom[1]);
+
+    for (unsigned int i = 0; i < 3; i++) {
+      rH[0][i] = pos0[i] + d * SIN_tetra * v3[i]  - d * COS_tetra * v1[i];
+      rH[1][i] = pos0[i] - d * SIN_tetra_05 * v3[i] +
+	d * SIN_tetra_h * v2[i] - d * COS_tetra * v1[i];
+      rH[2][i] = pos0[i] - d * SIN_tetra_05 * v3[i] -
+	d * SIN_tetra_h * v2[i] - d * COS_tetra * v1[i];
+    }
+
+    break;
+
+  case 5:
+    for (unsigned int i = 0; i < 3; i++)
+      rcent[i] = pos0[i] -
+	(ctrl_atom[0][i] + ctrl_atom[1][i] + ctrl_atom[2][i]) / 3.0;
+
+    vlen = vecLen(rcent);
+
+    if (vlen < 0.2) {
+      vecSub(v1, ctrl_atom[1], ctrl_atom[0]);
+      vecSub(v2, ctrl_atom[2], ctrl_atom[0]);
+      vecCrossProd(v3, v1, v2);
+      vecScalarDiv(rcent, v3, vecLen(v3));
+    } else {
+      vecScalarDiv(rcent, rcent, vlen);
+    }
+
+    for (unsigned int i = 0; i < 3; i++)
+      rH[0][i] = pos0[i] + d * rcent[i];
+
+    break;
+
+  case 6:
+    for (unsigned int i = 0; i < 3; i++)
+      rcent[i] = pos0[i] - (ctrl_atom[0][i] + ctrl_atom[1][i]) / 2.0;
+
+    vecSub(v1, pos0, ctrl_atom[0]);
+    vecSub(v2, pos0, ctrl_atom[1]);
+    vecCrossProd(v3, v1, v2);
+    vecScalarDiv(rcent, rcent, vecLen(rcent));
+    vecScalarDiv(v3, v3, vecLen(v3));
+
+    for (unsigned int i = 0; i < 3; i++) {
+      rH[0][i] = pos0[i] + d * (COS_tetra_h * rcent[i] + SIN_tetra_h * v3[i]);
+      rH[1][i] = pos0[i] + d * (COS_tetra_h * rcent[i] - SIN_tetra_h * v3[i]);
+    }
+
+    break;
+
+  case 10:
+    rH[0][0] = pos0[0] + d * SIN_theta1 * COS_phi;
+    rH[0][1] = pos0[1] + d * SIN_theta1 * SIN_phi;
+    rH[0][2] = pos0[2] + d * COS_theta1;
+    rH[1][0] = pos0[0] + d * SIN_theta2 * COS_phi;
+    rH[1][1] = pos0[1] + d * SIN_theta2 * SIN_phi;
+    rH[1][2] = pos0[2] - d * COS_theta2;
+
+    break;
+  }
+}
+
+
+static float coord(void)
+{
+  return (float) (rand() % 200000) / 1000.0f - 100.0f;
+}
+
+
+int main(int argc, char **argv)
+{
+  unsigned int n = 1000000, repeats = 10;
+  unsigned int type, i, r, k, c, nhyd;
+
+  double start, t, dev, maxdev;
+
+  fvec pos0, ctrl[HPLACE_MAX_CTRL], rH[HPLACE_MAX_HYD];
+
+  hplace_batch batch;
+
+
+  if (argc > 1) {
+    n = atoi(argv[1]);
+  }
+
+  if (argc > 2) {
+    repeats = atoi(argv[2]);
+  }
+
+  fprintf(stdout, "%u placements, %u repeats, %s kernels\n"
+	  "type     Mplace/s    max deviation\n", n, repeats, hplace_isa());
+
+  for (type = 0; type < HPLACE_NTYPES; type++) {
+    if (!(nhyd = hplace_nhyd(type)) ) {
+      continue;
+    }
+
+    srand(type);
+    hplace_init(&batch, type);
+
+    /* a heavy atom with controls at bond distance in random directions */
+    for (i = 0; i < n; i++) {
+      vecCreate(pos0, coord(), coord(), coord());
+
+      for (k = 0; k < HPLACE_MAX_CTRL; k++) {
+	for (c = 0; c < 3; c++) {
+	  ctrl[k][c] = pos0[c] + (float) (rand() % 3000) / 1000.0f - 1.5f;
+	}
+      }
+
+      hplace_push(&batch, i, nhyd, pos0, ctrl, HPLACE_MAX_CTRL, 1.0f);
+    }
+
+    start = now();
+
+    for (r = 0; r < repeats; r++) {
+      hplace_run(&batch);
+    }
+
+    t = (now() - start) / repeats;
+
+    maxdev = 0.0;
+
+    for (i = 0; i < n; i++) {
+      for (c = 0; c < 3; c++) {
+	pos0[c] = batch.in[c][i];
+
+	for (k = 0; k < HPLACE_MAX_CTRL; k++) {
+	  ctrl[k][c] = batch.in[3*(k+1) + c][i];
+	}
+      }
+
+      reference(type, batch.in[HPLACE_DIST][i], pos0, ctrl, rH);
+
+      for (k = 0; k < nhyd; k++) {
+	for (c = 0; c < 3; c++) {
+	  dev = fabs(batch.out[3*k + c][i] - rH[k][c]);
+
+	  if (dev > maxdev) {
+	    maxdev = dev;
+	  }
+	}
+      }
+    }
+
+    fprintf(stdout, "%4u %12.1f %16.3g\n", type, n / t * 1.0e-6, maxdev);
+
+    hplace_destroy(&batch);
+  }
+
+  return EXIT_SUCCESS;
+}
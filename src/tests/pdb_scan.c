@@ -0,0 +1,154 @@
+/*
+ * parse throughput of the ATOM/HETATM decoder pdb_scan_atom against the
+ * former sscanf(3) based decoding
+ *
+ *
+ * compile like (from a build directory):
+ *
+ * gcc -std=c99 -O2 -DNDEBUG -I. -I../src -o pdb_scan ../src/tests/pdb_scan.c \
+ *     ../src/pdb.c src/util/libmolprep_util.a -lz -lm
+ *
+ * ./pdb_scan file.pdb [repeats]
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../pdb.h"
+
+#define PDB_STD_IN_FORMAT "%*6c%5c%*c%4c%c%4c%c%4i%c%*3c%8f%8f%8f%6f%6f%*6c%4c%2c%2c"
+#define MAX_LINES 1000000
+
+struct opt_flags options;
+
+
+static int sscanf_atom(pdb_atom_rec *rec, const char *line)
+{
+  int n;
+
+  float x = 0.0, y = 0.0, z = 0.0, occupancy = 0.0, tempFactor = 0.0;
+
+
+  rec->serial[0] = rec->name[0] = rec->resName[0] = rec->segID[0] =
+    rec->element[0] = rec->charge[0] = '\0';
+  rec->altLoc = rec->chainID = rec->iCode = ' ';
+  rec->resSeq = 0;
+
+  n = sscanf(line, PDB_STD_IN_FORMAT,
+	     rec->serial, rec->name, &rec->altLoc, rec->resName,
+	     &rec->chainID, &rec->resSeq, &rec->iCode, &x, &y, &z,
+	     &occupancy, &tempFactor, rec->segID, rec->element, rec->charge);
+
+  /* as stored by the build, see PDB_FIXED_COORDS */
+  rec->x = PDB_MAKE_COORD(x);
+  rec->y = PDB_MAKE_COORD(y);
+  rec->z = PDB_MAKE_COORD(z);
+  rec->occupancy = PDB_MAKE_OCC(occupancy);
+  rec->tempFactor = PDB_MAKE_BFAC(tempFactor);
+
+  return n;
+}
+
+
+int main(int argc, char **argv)
+{
+  unsigned int nlines = 0, repeats = 100, nbad = 0;
+
+  char buffer[PDB_LINE_LEN];
+  char **lines;
+  size_t *lens;
+
+  double t_sscanf, t_scan, sum1 = 0.0, sum2 = 0.0;
+
+  clock_t start;
+
+  FILE *pdb_stream;
+
+  pdb_atom_rec rec1, rec2;
+
+
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s pdb_file [repeats]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (argc > 2) {
+    repeats = atoi(argv[2]);
+  }
+
+  if (!(pdb_stream = fopen(argv[1], "r")) ) {
+    perror(argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  lines = malloc(MAX_LINES * sizeof(*lines));
+  lens = malloc(MAX_LINES * sizeof(*lens));
+
+  while (nlines < MAX_LINES && fgets(buffer, PDB_LINE_LEN, pdb_stream) ) {
+    if (STRNEQ(buffer, "ATOM", 4) || STRNEQ(buffer, "HETATM", 6)) {
+      buffer[strcspn(buffer, "\n")] = '\0';
+      lens[nlines] = strlen(buffer);
+      lines[nlines] = malloc(lens[nlines] + 1);
+      memcpy(lines[nlines], buffer, lens[nlines] + 1);
+      nlines++;
+    }
+  }
+
+  fclose(pdb_stream);
+
+  /* both decoders must agree before timing means anything */
+  for (unsigned int i = 0; i < nlines; i++) {
+    if (sscanf_atom(&rec1, lines[i]) != pdb_scan_atom(&rec2, lines[i],
+						       lens[i]) ||
+	rec1.x != rec2.x || rec1.y != rec2.y || rec1.z != rec2.z ||
+	rec1.occupancy != rec2.occupancy ||
+	rec1.tempFactor != rec2.tempFactor || rec1.resSeq != rec2.resSeq ||
+	!STRNEQ(rec1.name, rec2.name, PDB_ATOM_NAME_LEN-1) ) {
+      fprintf(stderr, "mismatch: %s\n", lines[i]);
+      nbad++;
+    }
+  }
+
+  start = clock();
+
+  for (unsigned int n = 0; n < repeats; n++) {
+    for (unsigned int i = 0; i < nlines; i++) {
+      sscanf_atom(&rec1, lines[i]);
+      sum1 += PDB_COORD_FLOAT(rec1.x);
+    }
+  }
+
+  t_sscanf = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+
+  for (unsigned int n = 0; n < repeats; n++) {
+    for (unsigned int i = 0; i < nlines; i++) {
+      pdb_scan_atom(&rec2, lines[i], lens[i]);
+      sum2 += PDB_COORD_FLOAT(rec2.x);
+    }
+  }
+
+  t_scan = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+  printf("%u records x %u, %u mismatches (checksums %g %g)\n", nlines,
+	 repeats, nbad, sum1, sum2);
+  printf("sscanf:        %8.3f s  %10.0f records/s\n", t_sscanf,
+	 nlines * (double) repeats / t_sscanf);
+  printf("pdb_scan_atom: %8.3f s  %10.0f records/s\n", t_scan,
+	 nlines * (double) repeats / t_scan);
+
+  for (unsigned int i = 0; i < nlines; i++) {
+    free(lines[i]);
+  }
+
+  free(lines);
+  free(lens);
+
+  return nbad > 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * time reading, hydrogen building, a coordinate sweep and writing of a large
+ * structure held in the atom store
+ *
+ *
+ * compile like (from a build directory):
+ *
+ * gcc -std=c99 -O2 -DNDEBUG -I. -I../src -o store_bench \
+ *     ../src/tests/store_bench.c ../src/pdb.c ../src/hbuild.c ../src/hplace.c \
+ *     ../src/top.c src/util/libmolprep_util.a -lz -lpthread -lm
+ *
+ * (add the libraries of further configured codecs), then e.g. for a box of
+ * 1666667 waters which becomes 5000001 atoms with hydrogens
+ *
+ * awk 'BEGIN {for (i = 0; i < 1666667; i++)
+ *   printf "HETATM%5d  O   HOH W%4d    %8.3f%8.3f%8.3f  1.00 10.00      "
+ *          "WAT  O  \n", (i+1) % 100000, (i+1) % 10000, (i % 120) * 3.1,
+ *          int(i / 120) % 120 * 3.1, int(i / 14400) * 3.1}' > water.pdb
+ * ./store_bench water.pdb ../data/top.dat > /dev/null
+ *
+ * The program messages go to stdout, the timings to stderr.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../pdb.h"
+#include "../top.h"
+#include "../hbuild.h"
+
+#define SS_NAME "CYS2"
+
+#define X(a, b, c) c,
+struct opt_flags options = {
+#include "../options.def"
+};
+#undef X
+
+
+static double now(void)
+{
+  struct timespec ts;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+int main(int argc, char **argv)
+{
+  int nssb;
+  unsigned int r, a;
+
+  double start, t_read, t_hbuild, t_sweep, t_write;
+  double sum = 0.0;
+
+  const pdb_residue *residue;
+
+  pdb_root *pdb;
+  topol_hash *top = NULL;
+
+  Arena_stats stats;
+
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s file.pdb top.dat\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  top = top_read(top, argv[2]);
+  arena_stats(top->arena, &stats);
+
+  start = now();
+  pdb = pdb_read(NULL, argv[1], SS_NAME, -1, &nssb, NULL);
+  t_read = now() - start;
+
+  start = now();
+  pdb_select_altloc(pdb, 'A');
+  top_bind(pdb, top->hash_table);
+  hbuild_models(pdb, NULL);
+  t_hbuild = now() - start;
+
+  /* the kind of loop analyses run: all coordinates residue by residue */
+  start = now();
+
+  for (r = 0; r < pdb->nres; r++) {
+    residue = &pdb->residues[r];
+
+    for (a = residue->begin; a < residue->end; a++) {
+      sum += PDB_COORD_FLOAT(pdb->atoms.x[a]) +
+	PDB_COORD_FLOAT(pdb->atoms.y[a]) + PDB_COORD_FLOAT(pdb->atoms.z[a]);
+    }
+  }
+
+  t_sweep = now() - start;
+
+  start = now();
+  pdb_write(pdb, "/dev/null", "std", SS_NAME);
+  t_write = now() - start;
+
+  fprintf(stderr, "%u atoms (coordinate sum %g)\nread:   %8.4f s\n"
+	  "hbuild: %8.4f s\nsweep:  %8.4f s\nwrite:  %8.4f s\n", pdb->natoms,
+	  sum, t_read, t_hbuild, t_sweep, t_write);
+  fprintf(stderr, "topology: %lu records, %zu of %zu bytes in %u blocks\n",
+	  stats.nalloc, stats.used, stats.reserved, stats.nblocks);
+
+  pdb_destroy(pdb);
+  top_destroy(top);
+
+  return EXIT_SUCCESS;
+}
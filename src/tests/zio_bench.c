@@ -0,0 +1,107 @@
+/*
+ * line reading throughput of fzgets for differently compressed copies of the
+ * same file
+ *
+ *
+ * compile like (from a build directory):
+ *
+ * gcc -std=c99 -O2 -DNDEBUG -I. -I../src -o zio_bench \
+ *     ../src/tests/zio_bench.c src/util/libmolprep_util.a -lz -lbz2 -llzma \
+ *     -lzstd -lpthread -lm
+ *
+ * (drop the libraries of codecs not configured), then e.g.
+ *
+ * for c in gzip bzip2 xz zstd; do $c -k file.pdb; done
+ * ./zio_bench file.pdb file.pdb.gz file.pdb.bz2 file.pdb.xz file.pdb.zst
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../util/zio.h"
+#include "../util/parallel.h"
+
+#define LINE_LEN 1024
+
+
+static double now(void)
+{
+  struct timespec ts;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+int main(int argc, char **argv)
+{
+  int i, first, status = EXIT_SUCCESS;
+
+  unsigned long nlines, ref_lines = 0, sum, ref_sum = 0;
+  size_t nbytes, ref_bytes = 0;
+
+  char line[LINE_LEN];
+
+  double start, elapsed;
+
+  void *file;
+
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [-t threads] file...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  i = 1;
+
+  if (argc > 3 && !strcmp(argv[1], "-t")) {
+    par_set_threads(atoi(argv[2]) );
+    i = 3;
+  }
+
+  first = i;
+
+  for (; i < argc; i++) {
+    start = now();
+
+    if (!(file = fzopen(argv[i], "r")) ) {
+      perror(argv[i]);
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    nlines = sum = 0;
+    nbytes = 0;
+
+    while (fzgets(file, line, LINE_LEN) ) {
+      nbytes += strlen(line);
+      sum += (unsigned char) line[0];
+      nlines++;
+    }
+
+    fzclose(file);
+    elapsed = now() - start;
+
+    /* all files must decompress to the same content */
+    if (i == first) {
+      ref_lines = nlines;
+      ref_sum = sum;
+      ref_bytes = nbytes;
+    } else if (nlines != ref_lines || sum != ref_sum || nbytes != ref_bytes) {
+      fprintf(stderr, "%s: content differs from %s\n", argv[i], argv[first]);
+      status = EXIT_FAILURE;
+    }
+
+    printf("%-30s %10lu lines %8.3f s %8.1f MB/s\n", argv[i], nlines, elapsed,
+	   nbytes / elapsed / 1.0e6);
+  }
+
+  return status;
+}
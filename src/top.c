@@ -10,6 +10,9 @@
  * type (see add_hydrogens in hbuild.c), 4) distance heavy-hydrogen atom,
  * 5-8) reference atoms for position calculations.  HEAVY entries list the
  * heavy atoms of a residue.  The residue record is terminated with END.
+ * The HYDRO entries are then compiled into a build plan for hbuild which
+ * refers to atoms by slot instead of by name.  All records of a residue are
+ * allocated from an arena owned by the database and are released in one go.
  *
  *
  * $Id: top.c 165 2012-06-29 14:41:27Z hhl $
@@ -28,11 +31,14 @@
 #include "top.h"
 #include "util/hashtab.h"
 #include "util/hashfuncs.h"
+#include "util/arena.h"
 #include "util/util.h"
+#include "util/zio.h"
 
 
 #define TOP_DELIMITER " \t\n"
 #define TOP_LINE_LEN 132
+#define TOP_ARENA_BLOCK (64 * 1024)
 
 
 
@@ -58,6 +64,207 @@ static void tospac(char *str)
 }
 
 
+/*
+ * prev_name_code: code of a control atom name, a '-' marking an atom of the
+ *                 previous residue is removed first
+ *
+ * in:  atom name
+ * out: name code
+ *
+ */
+
+static uint32_t prev_name_code(const char *atom)
+{
+  char name[PDB_ATOM_NAME_LEN];
+
+
+  strncpy(name, atom, PDB_ATOM_NAME_LEN-1);
+  name[PDB_ATOM_NAME_LEN-1] = '\0';
+
+  if (name[0] == '-') {
+    name[0] = ' ';
+  } else if (name[1] == '-') {
+    name[1] = name[2];
+    name[2] = name[3];
+    name[3] = ' ';
+  }
+
+  return pdb_name_code(name);
+}
+
+
+/*
+ * format_atom_name: append number to PDB atom name
+ *
+ * in:  name from top (assumed to be PDB_ATOM_NAME_LEN chars long),
+ *      character (number) to be added to name
+ * out: formatted name
+ *
+ */
+
+static char *format_atom_name(char *name, char c)
+{
+
+  if (name[3] != ' ') {
+    for (unsigned int i = 0; i < 3; i++) {
+      name[i] = name[i+1];
+    }
+
+    name[3] = ' ';
+  }
+
+  if (name[2] == ' ') {
+    name[2] = c;
+  } else if (name[3] == ' ') {
+    name[3] = c;
+  }
+
+  return name;
+}
+
+
+/*
+ * plan_slot: slot of an atom name code, a new one is added if needed
+ *
+ * in:  slot codes, number of slots, code
+ * out: slot
+ *
+ */
+
+static unsigned int plan_slot(uint32_t *codes, unsigned int *nslots,
+			      uint32_t code)
+{
+  unsigned int s;
+
+
+  for (s = 0; s < *nslots && codes[s] != code; s++)
+    ;
+
+  if (s == *nslots) {
+    codes[(*nslots)++] = code;
+  }
+
+  return s;
+}
+
+
+/*
+ * compile_plan: turn the hydrogen entries of a residue into a build plan,
+ *               heavy and control atoms of the residue come first in the slot
+ *               table, control atoms of the previous residue last
+ *
+ * in:  arena, NULL terminated hydrogen entries, file name and line number
+ * out: build plan
+ *
+ */
+
+static topol_plan *compile_plan(Arena *arena, topol_hydro **hydrogens,
+				const char *filename, unsigned int line_cnt)
+{
+  unsigned int i, k, n, nent = 0, nslots = 0, nprev = 0;
+
+  uint32_t *codes, *prev;
+
+  const topol_hydro *entry;
+  topol_step *step;
+  topol_plan *plan;
+
+
+  while (hydrogens[nent]) {
+    nent++;
+  }
+
+  plan = arena_alloc(arena, sizeof(*plan));
+  plan->steps = arena_alloc(arena, nent * sizeof(*plan->steps));
+
+  /* at most one heavy and three control atoms per entry */
+  codes = allocate(4 * nent * sizeof(*codes));
+  prev = allocate(3 * nent * sizeof(*prev));
+
+  for (n = 0; n < nent; n++) {
+    plan_slot(codes, &nslots, hydrogens[n]->codes[1]);
+  }
+
+  for (n = 0; n < nent; n++) {
+    entry = hydrogens[n];
+    step = &plan->steps[n];
+
+    if (entry->nhyd > TOP_MAX_HYD) {
+      prerror(1, "%s: more than %d hydrogens on atom %s (line %d).\n",
+	      filename, TOP_MAX_HYD, entry->atoms[1], line_cnt);
+    }
+
+    step->hydro = entry;
+
+    /* number of control atoms by bonding type as in add_hydrogens */
+    switch (entry->type) {
+    case 5:
+      step->nctrl = 3;
+      break;
+    case 10:
+      step->nctrl = 0;
+      break;
+    default:
+      step->nctrl = 2;
+    }
+
+    for (i = 0; i < step->nctrl; i++) {
+      if (!(entry->prev & 1U << (i + 2)) ) {
+	step->ctrl[i] = plan_slot(codes, &nslots, entry->codes[i + 2]);
+      }
+    }
+
+    /* hydrogens are inserted in reverse, the first one is numbered 1 */
+    for (k = 0; k < entry->nhyd; k++) {
+      strncpy(step->names[k], entry->atoms[0], PDB_ATOM_NAME_LEN-1);
+      step->names[k][PDB_ATOM_NAME_LEN-1] = '\0';
+
+      if (entry->nhyd > 1) {
+	format_atom_name(step->names[k], '1' + k);
+      }
+
+      step->codes[k] = pdb_name_code(step->names[k]);
+    }
+  }
+
+  /* atoms of the previous residue follow those of the residue itself */
+  for (n = 0; n < nent; n++) {
+    entry = hydrogens[n];
+    step = &plan->steps[n];
+
+    for (i = 0; i < step->nctrl; i++) {
+      if (entry->prev & 1U << (i + 2)) {
+	step->ctrl[i] = nslots + plan_slot(prev, &nprev, entry->codes[i + 2]);
+      }
+    }
+  }
+
+  plan->nslots = nslots;
+  plan->nprev = nprev;
+
+  /* only the first entry of a heavy atom is used */
+  plan->slot_step = arena_alloc(arena, nslots * sizeof(*plan->slot_step));
+
+  for (i = 0; i < nslots; i++) {
+    plan->slot_step[i] = -1;
+  }
+
+  for (n = nent; n-- > 0; ) {
+    plan->slot_step[plan_slot(codes, &nslots, hydrogens[n]->codes[1])] = n;
+  }
+
+  plan->slot_codes = arena_alloc(arena, (nslots + nprev) *
+				 sizeof(*plan->slot_codes));
+  memcpy(plan->slot_codes, codes, nslots * sizeof(*codes));
+  memcpy(plan->slot_codes + nslots, prev, nprev * sizeof(*prev));
+
+  free(codes);
+  free(prev);
+
+  return plan;
+}
+
+
 /*
  * top_read: read a topology database file and convert to internal structure
  *
@@ -71,6 +278,7 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
   unsigned int line_cnt = 0, nrec = 0, nheavy = 0;
   unsigned int in_res = 0;
   unsigned int nname = 0, nent = 0, nfields;
+  unsigned int max_heavy = 0, max_ent = 0;
   unsigned int table_size = 0;
 
   bool first;
@@ -79,13 +287,18 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
   char first_term[PDB_ATOM_NAME_LEN], last_term[PDB_ATOM_NAME_LEN];
   char atoms[5][PDB_ATOM_NAME_LEN];
   char *bufp, *resn;
-  char *heavy_atom, **heavy_atoms = NULL;
+  char *heavy_atom, **heavy_atoms = NULL, **heavy_buf = NULL;
+
+  uint32_t *heavy_codes = NULL;
 
   Hashtable *res_table;
   Hashnode *curr_node;
 
   topol *top, *top_entry;
-  topol_hydro *hydrogen, **hydrogens = NULL;
+  topol_hydro *hydrogen, **hydrogens = NULL, **hydro_buf = NULL;
+  topol_plan *plan;
+
+  Arena *arena;
 
   struct {
     char resName[PDB_RES_NAME_LEN];
@@ -93,19 +306,20 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
     char last[PDB_ATOM_NAME_LEN];
   } *term_map, *term;
 
-  FILE *topol_stream;
+  void *topol_stream;
 
 
 
-  if (!(topol_stream = fopen(filename, "r")) ) {
+  if (!(topol_stream = fzopen(filename, "r")) ) {
     perror(filename);
     exit(EXIT_FAILURE);
   }
 
   top = NULL;
   term_map = NULL;
+  arena = arena_init(TOP_ARENA_BLOCK);
 
-  while (fgets(buffer, TOP_LINE_LEN, topol_stream) ) {  /* read lines */
+  while (fzgets(topol_stream, buffer, TOP_LINE_LEN) ) {  /* read lines */
     line_cnt++;
 
     if (!(bufp = normln(buffer)) )
@@ -140,10 +354,7 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
       bufp += 7;
 
       nent = 0;
-      hydrogens = NULL;
-
       nheavy = 0;
-      heavy_atoms = NULL;
 
       *first_term = '\0';
       *last_term = '\0';
@@ -164,6 +375,7 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
 	if (!pdb_format_residue(top[nrec-1].resName, bufp) )
 	  prerror (2, "%s: atom name %s too long.\n", filename, bufp);
 
+	top[nrec-1].code = pdb_name_code(top[nrec-1].resName);
 	top[nrec-1].res_type = res_type;
 	top[nrec-1].mol_type = mol_type;
 	top[nrec-1].first_term = NULL;
@@ -229,8 +441,12 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
       bufp += 5;
       nent++;
 
-      hydrogens = reallocate(hydrogens, (nent+1) * sizeof(*hydrogens));
-      hydrogen = allocate(sizeof(*hydrogen));
+      if (nent > max_ent) {
+	max_ent = 2 * nent;
+	hydro_buf = reallocate(hydro_buf, max_ent * sizeof(*hydro_buf));
+      }
+
+      hydrogen = arena_alloc(arena, sizeof(*hydrogen));
 
       *atoms[4] = '\0';
 
@@ -255,7 +471,17 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
 	}
       }
 
-      hydrogens[nent-1] = hydrogen;
+      hydrogen->prev = 0;
+
+      for (unsigned int i = 0; i < 5; i++) {
+	hydrogen->codes[i] = prev_name_code(hydrogen->atoms[i]);
+
+	if (strchr(hydrogen->atoms[i], '-') ) {
+	  hydrogen->prev |= 1U << i;
+	}
+      }
+
+      hydro_buf[nent-1] = hydrogen;
     } else if (STRNEQ(bufp, "HEAVY", 5) )  {
       if (!in_res) {
 	prerror(1, "%s: not inside residue record in line %d.\n", filename, line_cnt);
@@ -270,8 +496,12 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
       while (bufp) {
 	nheavy++;
 
-	heavy_atoms = reallocate(heavy_atoms, (nheavy+1) * sizeof(*heavy_atoms) );
-	heavy_atom = allocate(PDB_RES_NAME_LEN);
+	if (nheavy > max_heavy) {
+	  max_heavy = 2 * nheavy;
+	  heavy_buf = reallocate(heavy_buf, max_heavy * sizeof(*heavy_buf));
+	}
+
+	heavy_atom = arena_alloc(arena, PDB_RES_NAME_LEN);
 
 	if (*bufp == '<') {
 	  strncpy(heavy_atom, bufp + 1, PDB_ATOM_NAME_LEN-1);
@@ -284,7 +514,7 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
 	  }
 	}
 
-	heavy_atoms[nheavy-1] = heavy_atom;
+	heavy_buf[nheavy-1] = heavy_atom;
 
 	bufp = strtok(NULL, TOP_DELIMITER);
       }
@@ -293,20 +523,37 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
 	prerror(1, "%s: not inside residue record in line %d.\n", filename, line_cnt);
       }
 
-      if (!hydrogens) {
+      if (nent == 0) {
 	prerror(1, "%s: no hydrogen entries found in residue %s (line %d).\n",
 		filename, top[nrec-1].resName, line_cnt);
       }
 
-      if (!heavy_atoms) {
+      if (nheavy == 0) {
 	prerror(1, "%s: no heavy atom entries found in residue %s (line %d).\n",
 		filename, top[nrec-1].resName, line_cnt);
       }
 
       top[nrec-1].res_type = res_type;
+
+      /* the lists are shared by all names of the residue */
+      heavy_atoms = arena_alloc(arena, (nheavy+1) * sizeof(*heavy_atoms));
+      memcpy(heavy_atoms, heavy_buf, nheavy * sizeof(*heavy_atoms));
       heavy_atoms[nheavy] = NULL;
+
+      heavy_codes = arena_alloc(arena, (nheavy+1) * sizeof(*heavy_codes));
+
+      for (unsigned int i = 0; i < nheavy; i++) {
+	heavy_codes[i] = pdb_name_code(heavy_atoms[i]);
+      }
+
+      heavy_codes[nheavy] = 0;
+
+      hydrogens = arena_alloc(arena, (nent+1) * sizeof(*hydrogens));
+      memcpy(hydrogens, hydro_buf, nent * sizeof(*hydrogens));
       hydrogens[nent] = NULL;
 
+      plan = compile_plan(arena, hydrogens, filename, line_cnt);
+
       for (unsigned int i = nrec - nname; i < nrec; i++) {
 	strncpy(term_map[i].first, first_term, PDB_ATOM_NAME_LEN-1);
 	term_map[i].first[PDB_ATOM_NAME_LEN-1] = '\0';
@@ -315,7 +562,9 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
 	term_map[i].last[PDB_ATOM_NAME_LEN-1] = '\0';
 
 	top[i].heavy_atoms = heavy_atoms;
+	top[i].heavy_codes = heavy_codes;
 	top[i].hydrogens = hydrogens;
+	top[i].plan = plan;
       }
 
       in_res = 0;
@@ -324,7 +573,10 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
     }
   }
 
-  fclose(topol_stream);
+  fzclose(topol_stream);
+
+  free(heavy_buf);
+  free(hydro_buf);
 
   if (in_res)
     prerror(1, "%s: last END missing.\n", filename);
@@ -383,11 +635,157 @@ topol_hash *top_read(topol_hash* top_hash, const char *filename)
   top_hash = allocate(sizeof(*top_hash) );
   top_hash->data = top;
   top_hash->hash_table = res_table;
+  top_hash->arena = arena;
 
   return top_hash;
 }
 
 
+/*
+ * top_name_class: class of a residue by its name alone
+ *
+ * in:  residue name code
+ * out: protein class or PDB_RES_OTHER
+ *
+ */
+
+enum pdb_res_class top_name_class(uint32_t code)
+{
+  switch (code) {
+  case PDB_NAME_CODE('A', 'S', 'P', ' '): return PDB_RES_ASP;
+  case PDB_NAME_CODE('G', 'L', 'U', ' '): return PDB_RES_GLU;
+  case PDB_NAME_CODE('A', 'R', 'G', ' '): return PDB_RES_ARG;
+  case PDB_NAME_CODE('C', 'Y', 'S', ' '): return PDB_RES_CYS;
+  case PDB_NAME_CODE('H', 'I', 'S', ' '): return PDB_RES_HIS;
+  case PDB_NAME_CODE('L', 'Y', 'S', ' '): return PDB_RES_LYS;
+  case PDB_NAME_CODE('T', 'Y', 'R', ' '): return PDB_RES_TYR;
+  case PDB_NAME_CODE('G', 'L', 'N', ' '): return PDB_RES_GLN;
+  case PDB_NAME_CODE('A', 'S', 'N', ' '): return PDB_RES_ASN;
+  case PDB_NAME_CODE('T', 'R', 'P', ' '): return PDB_RES_TRP;
+  case PDB_NAME_CODE('S', 'E', 'R', ' '): return PDB_RES_SER;
+  case PDB_NAME_CODE('T', 'H', 'R', ' '): return PDB_RES_THR;
+  default: return PDB_RES_OTHER;
+  }
+}
+
+
+/*
+ * top_lookup: look up the topology entry of a residue name
+ *
+ * in:  top hash table, residue name
+ * out: entry or NULL
+ *
+ */
+
+static const topol *top_lookup(const Hashtable *top, const char *name)
+{
+  Hashnode *node;
+
+
+  if ( (node = hash_search(top, name, strlen(name) ) ) ) {
+    return hash_node_get_data(node);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * bind_entry: store the topology entry of a residue together with the entry
+ *             hbuild works from (the terminal variant if requested) and the
+ *             residue class
+ *
+ * in:  pdb root structure, residue index, entry of the residue name or NULL
+ *
+ */
+
+static void bind_entry(pdb_root *pdb, unsigned int r, const topol *entry)
+{
+  pdb_residue *residue = &pdb->residues[r];
+  const pdb_chain *chain = &pdb->chains[residue->chain];
+
+
+  residue->top = entry;
+  residue->res_class = top_name_class(residue->code);
+
+  if (entry) {
+    if (entry->mol_type == 'D' || entry->mol_type == 'R') {
+      residue->res_class = PDB_RES_NUCLEIC;
+    } else if (entry->hydrogens[0] && entry->hydrogens[0]->type == 10) {
+      residue->res_class = PDB_RES_WATER;
+    }
+  }
+
+  /* check only according to defined residue type in top.dat as residues
+     may have names colliding with force field conventions, e.g.
+     TYM = TRYPTOPHANYL-5'AMP, HID = (5-HYDROXY-1H-INDOL-3-YL)ACETIC ACID,
+     DGN = D-GLUTAMINE, etc. */
+  if (entry && entry->res_type != '@' && residue->rectype != entry->res_type) {
+    entry = NULL;
+  }
+
+  if (entry && r == chain->begin && entry->first_term &&
+      ( (entry->mol_type == 'P' && options.nterm) ||
+	(entry->mol_type == 'D' && options.dna5term) ||
+	(entry->mol_type == 'R' && options.rna5term) ) ) {
+
+    entry = entry->first_term;
+  } else if (entry && r + 1 == chain->end && entry->last_term &&
+	     ( (entry->mol_type == 'P' && options.cterm) ||
+	       (entry->mol_type == 'D' && options.dna3term) ||
+	       (entry->mol_type == 'R' && options.rna3term) ) ) {
+
+    entry = entry->last_term;
+  }
+
+  residue->entry = entry;
+}
+
+
+/*
+ * top_bind_residue: look up the topology entry of a residue and bind it;
+ *                   must be called again when the residue is renamed
+ *
+ * in:  pdb root structure, residue index, top hash table
+ *
+ */
+
+void top_bind_residue(pdb_root *pdb, unsigned int r, const Hashtable *top)
+{
+  bind_entry(pdb, r, top_lookup(top, pdb->residues[r].resName) );
+}
+
+
+/*
+ * top_bind: bind all residues of a model to the topology, later stages use
+ *           the stored entries instead of looking up residue names.  Runs of
+ *           residues with the same name, as in solvent, are looked up once.
+ *
+ * in:  pdb root structure, top hash table
+ *
+ */
+
+void top_bind(pdb_root *pdb, const Hashtable *top)
+{
+  const topol *entry;
+
+  const pdb_residue *residue;
+
+
+  for (unsigned int r = 0; r < pdb->nres; r++) {
+    residue = &pdb->residues[r];
+
+    if (r > 0 && !strcmp(residue->resName, residue[-1].resName) ) {
+      entry = residue[-1].top;
+    } else {
+      entry = top_lookup(top, residue->resName);
+    }
+
+    bind_entry(pdb, r, entry);
+  }
+}
+
+
 /*
  * top_print: print a topology database to stdout (simpler format, for debugging)
  *
@@ -443,49 +841,8 @@ void top_print(topol* top)
 
 void top_destroy(topol_hash *top)
 {
-  unsigned int j, n;
-
-  bool found;
-
-  topol *p;
-  topol_hydro **es, ***m;
-
-
-  for (n = 0, p = top->data; p->mol_type; n++, p++);
-
-  m = allocate(n * sizeof(***m) );
-  memset(m, 0, n * sizeof(***m) );
-  
-  for (j = 0, p = top->data; p->mol_type; p++) {
-
-    found = false;
-
-    for (unsigned int i = 0; i < j; i++) {
-      if (p->hydrogens == m[i]) {
-	found = true;
-	break;
-      }
-    }
-
-    if (!found) {
-      for (es = p->hydrogens; *es; es++) {
-	free(*es);
-      }
-
-      free(p->hydrogens);
-      m[j] = p->hydrogens;
-      j++;
-
-      for (char **h = p->heavy_atoms; *h; h++) {
-	free(*h);
-      }
-
-      free(p->heavy_atoms);
-    }
-  }
-
+  arena_destroy(top->arena);
   free(top->data);
-  free(m);
 
   hash_destroy(top->hash_table);
 
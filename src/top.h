@@ -11,6 +11,7 @@
 
 #include "pdb.h"
 #include "util/hashtab.h"
+#include "util/arena.h"
 
 
 typedef struct _topol_hydro {
@@ -18,27 +19,55 @@ typedef struct _topol_hydro {
   unsigned int type;
   float xhdist;
   char atoms[5][PDB_ATOM_NAME_LEN];
+  uint32_t codes[5];		/* of atoms, without the '-' marker */
+  unsigned int prev;		/* bit i: atoms[i] is in previous residue */
 } topol_hydro;
 
+#define TOP_MAX_HYD 3		/* hydrogens per heavy atom */
+
+typedef struct _topol_step {	/* hydrogens of one heavy atom */
+  const topol_hydro *hydro;	/* count, bonding type and distance */
+  unsigned int nctrl;
+  unsigned int ctrl[3];		/* slots of the control atoms */
+  char names[TOP_MAX_HYD][PDB_ATOM_NAME_LEN];  /* in the order inserted */
+  uint32_t codes[TOP_MAX_HYD];	/* of names */
+} topol_step;
+
+typedef struct _topol_plan {	/* hydrogen build over heavy atom slots */
+  unsigned int nslots;		/* slots of the residue itself, */
+  unsigned int nprev;		/* followed by those of the previous one */
+  uint32_t *slot_codes;		/* atom name codes of all slots */
+  int *slot_step;		/* step building on the slot atom or -1 */
+  topol_step *steps;
+} topol_plan;
+
 typedef struct _topol {
   char res_type;
   char mol_type;
   char resName[PDB_RES_NAME_LEN];
+  uint32_t code;		/* of resName */
   struct _topol *first_term;
   struct _topol *last_term;
   char **heavy_atoms;
+  uint32_t *heavy_codes;	/* of heavy_atoms, 0 terminated */
   topol_hydro **hydrogens;
+  const topol_plan *plan;	/* compiled from hydrogens */
 } topol;
 
 typedef struct _topol_hash {
   topol *data;
   Hashtable *hash_table;
+  Arena *arena;			/* records of all residues */
 } topol_hash;
 
 int topcmp(const void *p1, const void *p2);
 topol_hash *top_read(topol_hash* top_hash, const char *filename);
 void top_destroy(topol_hash *top);
 
+enum pdb_res_class top_name_class(uint32_t code);
+void top_bind_residue(pdb_root *pdb, unsigned int r, const Hashtable *top);
+void top_bind(pdb_root *pdb, const Hashtable *top);
+
 #ifndef NDEBUG
 void top_print(topol *top);
 #endif
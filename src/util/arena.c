@@ -0,0 +1,144 @@
+/*
+ * A minimal region allocator: memory is handed out from large blocks and
+ * only ever released all at once.  arena_reset() keeps the blocks so that an
+ * arena used as scratch space for e.g. one residue at a time stops calling
+ * malloc after the first few rounds.
+ *
+ */
+
+
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "arena.h"
+#include "util.h"
+
+
+#define ARENA_ALIGN 16		// enough for any of our types
+#define ARENA_ROUND(n) ( ((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1) )
+
+
+typedef struct _Arena_block {
+  struct _Arena_block *next;
+  size_t size;			// usable bytes
+  size_t used;
+} Arena_block;
+
+struct _Arena {
+  Arena_block *first;
+  Arena_block *curr;		// block allocations are taken from
+  size_t block_size;
+  Arena_stats stats;
+};
+
+/* the data of a block follows its (aligned) header */
+#define BLOCK_DATA(b) ( (char *) (b) + ARENA_ROUND(sizeof(Arena_block)) )
+
+
+
+static Arena_block *new_block(size_t size)
+{
+  Arena_block *block;
+
+
+  block = allocate(ARENA_ROUND(sizeof(Arena_block)) + size);
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+
+  return block;
+}
+
+
+Arena *arena_init(size_t block_size)
+{
+  Arena *arena;
+
+
+  arena = allocate(sizeof *arena);
+
+  arena->block_size = ARENA_ROUND(block_size);
+  arena->first = arena->curr = new_block(arena->block_size);
+
+  arena->stats.nalloc = 0;
+  arena->stats.used = arena->stats.peak = 0;
+  arena->stats.reserved = arena->block_size;
+  arena->stats.nblocks = 1;
+
+  return arena;
+}
+
+
+// memory is uninitialized and aligned to ARENA_ALIGN
+void *arena_alloc(Arena *arena, size_t size)
+{
+  void *ptr;
+  Arena_block *block;
+
+
+  size = ARENA_ROUND(size);
+
+  // blocks kept over a reset are used in turn, a new one is put after them
+  while (arena->curr->used + size > arena->curr->size) {
+    if (arena->curr->next) {
+      arena->curr = arena->curr->next;
+      continue;
+    }
+
+    block = new_block(size > arena->block_size ? size : arena->block_size);
+    arena->curr->next = block;
+    arena->curr = block;
+
+    arena->stats.reserved += block->size;
+    arena->stats.nblocks++;
+  }
+
+  ptr = BLOCK_DATA(arena->curr) + arena->curr->used;
+  arena->curr->used += size;
+
+  arena->stats.nalloc++;
+  arena->stats.used += size;
+
+  if (arena->stats.used > arena->stats.peak)
+    arena->stats.peak = arena->stats.used;
+
+  return ptr;
+}
+
+
+// all memory handed out so far becomes invalid, blocks are kept for reuse
+void arena_reset(Arena *arena)
+{
+  Arena_block *block;
+
+
+  for (block = arena->first; block; block = block->next)
+    block->used = 0;
+
+  arena->curr = arena->first;
+  arena->stats.used = 0;
+}
+
+
+void arena_stats(const Arena *arena, Arena_stats *stats)
+{
+  *stats = arena->stats;
+}
+
+
+void arena_destroy(Arena *arena)
+{
+  Arena_block *block, *next;
+
+
+  if (!arena)
+    return;
+
+  for (block = arena->first; block; block = next) {
+    next = block->next;
+    free(block);
+  }
+
+  free(arena);
+}
@@ -0,0 +1,31 @@
+/*
+ * A minimal region allocator: memory is handed out from large blocks and
+ * only ever released all at once.
+ *
+ */
+
+
+
+#ifndef _ARENA_H
+#define _ARENA_H      1
+
+#include <stddef.h>
+
+
+typedef struct _Arena Arena;
+
+typedef struct _Arena_stats {
+  unsigned long nalloc;		// number of allocations
+  size_t used;			// bytes handed out since the last reset
+  size_t peak;			// largest used over all resets
+  size_t reserved;		// bytes held in blocks
+  unsigned int nblocks;
+} Arena_stats;
+
+Arena *arena_init(size_t block_size);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+void arena_stats(const Arena *arena, Arena_stats *stats);
+void arena_destroy(Arena *arena);
+
+#endif
@@ -52,7 +52,7 @@ static List *add_node(List *restrict list, void *restrict data)
   Listnode *new;
 
 
-  new = allocate(sizeof new);
+  new = allocate(sizeof *new);
   new->data = data;
   list->nel++;
 
@@ -0,0 +1,303 @@
+/*
+ * A minimal parallel loop on top of POSIX threads.  The iterations of par_for
+ * are handed out one by one to the worker threads.  Messages printed through
+ * prwarn/prnote/prout by an iteration are collected in memory, each thread
+ * writes into its own stream and takes the text of an iteration out when it
+ * is done.  The texts are replayed in iteration order once all threads have
+ * finished, so output looks exactly as if the loop had run serially; if the
+ * streams cannot be set up the loop does run serially.  The messages are
+ * replayed to the stream of the calling thread, so loops may be nested.  If
+ * an iteration exits through a fatal prerror the messages of all earlier
+ * iterations and of the failing one are replayed first, as a serial run
+ * would have printed them before the error.
+ *
+ */
+
+
+
+#define _POSIX_C_SOURCE 200809L	/* open_memstream */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "parallel.h"
+#include "util.h"
+
+
+
+static unsigned int num_threads = 0;   /* 0: use all online processors */
+
+struct _par_loop {
+  unsigned int n;
+  unsigned int next;		/* next iteration to be handed out */
+  par_func func;
+  void *arg;
+  char **text;			/* captured messages per iteration */
+  size_t *len;
+  FILE *dest;			/* where the messages are replayed */
+  bool *done;			/* finished iterations */
+  pr_hook *outer;		/* fatal error hooks of the calling thread */
+  pthread_mutex_t lock;
+  pthread_cond_t finished;	/* signalled when an iteration is done */
+};
+
+struct _par_thread {
+  pr_hook hook;			/* must be first */
+  struct _par_loop *loop;
+  unsigned int idx;		/* current iteration */
+  FILE *capture;		/* memory stream of the thread */
+  char *buf;
+  size_t size;
+  size_t mark;			/* start of the current iteration */
+};
+
+
+
+void par_set_threads(unsigned int nthreads)
+{
+  num_threads = nthreads;
+}
+
+unsigned int par_get_threads(void)
+{
+  long n;
+
+
+  if (num_threads > 0) {
+    return num_threads;
+  }
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (unsigned int) n : 1;
+}
+
+
+/*
+ * par_take: take the messages of the current iteration out of the memory
+ *           stream of a thread
+ *
+ * in:  thread
+ *
+ */
+
+static void par_take(struct _par_thread *th)
+{
+  size_t len;
+
+
+  fflush(th->capture);
+  len = th->size - th->mark;
+
+  if (len > 0) {
+    th->loop->text[th->idx] = allocate(len);
+    memcpy(th->loop->text[th->idx], th->buf + th->mark, len);
+    th->loop->len[th->idx] = len;
+  }
+
+  th->mark = th->size;
+}
+
+
+/*
+ * par_fatal: fatal error hook of an iteration, waits for all earlier
+ *            iterations and replays their messages and those of the failing
+ *            iteration; the loop is never left again so the lock is kept
+ *
+ * in:  hook of the thread running the failing iteration
+ *
+ */
+
+static void par_fatal(pr_hook *hook)
+{
+  struct _par_thread *th = (struct _par_thread *) hook;
+  struct _par_loop *loop = th->loop;
+
+
+  par_take(th);
+
+  pthread_mutex_lock(&loop->lock);
+  loop->next = loop->n;
+
+  for (unsigned int i = 0; i < th->idx; i++) {
+    while (!loop->done[i]) {
+      pthread_cond_wait(&loop->finished, &loop->lock);
+    }
+  }
+
+  for (unsigned int i = 0; i <= th->idx; i++) {
+    if (loop->len[i] > 0) {
+      fwrite(loop->text[i], 1, loop->len[i], loop->dest);
+    }
+  }
+
+  fflush(loop->dest);
+}
+
+
+/*
+ * par_worker: run iterations until none are left
+ *
+ * in:  thread
+ * out: always NULL
+ *
+ */
+
+static void *par_worker(void *data)
+{
+  FILE *own = prout();
+
+  pr_hook *own_hook = prgethook();
+
+  struct _par_thread *th = data;
+  struct _par_loop *loop = th->loop;
+
+
+  for (;;) {
+    pthread_mutex_lock(&loop->lock);
+    th->idx = loop->next++;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (th->idx >= loop->n) {
+      break;
+    }
+
+    prsetout(th->capture);
+    prsethook(&th->hook);
+    loop->func(th->idx, loop->arg);
+    prsethook(own_hook);
+    prsetout(own);
+
+    par_take(th);
+
+    pthread_mutex_lock(&loop->lock);
+    loop->done[th->idx] = true;
+    pthread_cond_broadcast(&loop->finished);
+    pthread_mutex_unlock(&loop->lock);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * par_for: call func(idx, arg) for idx = 0..n-1 on the configured number of
+ *          threads
+ *
+ * in:  number of iterations, loop body, argument passed to the loop body
+ *
+ */
+
+void par_for(unsigned int n, par_func func, void *arg)
+{
+  unsigned int i, nthreads, nstarted = 0;
+
+  pthread_t *threads;
+
+  struct _par_thread *th;
+  struct _par_loop loop;
+
+
+  nthreads = par_get_threads();
+
+  if (nthreads > n) {
+    nthreads = n;
+  }
+
+  th = nthreads < 2 ? NULL : allocate(nthreads * sizeof(*th));
+
+  /* without a capture stream for every thread messages would come out
+     unordered */
+  for (i = 0; th && i < nthreads; i++) {
+    th[i].buf = NULL;
+    th[i].size = th[i].mark = 0;
+
+    if (!(th[i].capture = open_memstream(&th[i].buf, &th[i].size)) ) {
+      while (i-- > 0) {
+	fclose(th[i].capture);
+	free(th[i].buf);
+      }
+
+      free(th);
+      th = NULL;
+    }
+  }
+
+  if (!th) {
+    for (i = 0; i < n; i++) {
+      func(i, arg);
+    }
+
+    return;
+  }
+
+  loop.dest = prout();
+  fflush(loop.dest);
+
+  loop.n = n;
+  loop.next = 0;
+  loop.func = func;
+  loop.arg = arg;
+  loop.text = allocate(n * sizeof(*loop.text));
+  loop.len = allocate(n * sizeof(*loop.len));
+  loop.done = allocate(n * sizeof(*loop.done));
+  loop.outer = prgethook();
+
+  for (i = 0; i < n; i++) {
+    loop.text[i] = NULL;
+    loop.len[i] = 0;
+    loop.done[i] = false;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    th[i].hook.func = par_fatal;
+    th[i].hook.next = loop.outer;
+    th[i].loop = &loop;
+  }
+
+  pthread_mutex_init(&loop.lock, NULL);
+  pthread_cond_init(&loop.finished, NULL);
+
+  threads = allocate(nthreads * sizeof(*threads));
+
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, par_worker, &th[i]) ) {
+      break;
+    }
+
+    nstarted++;
+  }
+
+  par_worker(&th[0]);
+
+  for (i = 1; i <= nstarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&loop.lock);
+  pthread_cond_destroy(&loop.finished);
+
+  for (i = 0; i < n; i++) {
+    if (loop.len[i] > 0) {
+      fwrite(loop.text[i], 1, loop.len[i], loop.dest);
+    }
+
+    free(loop.text[i]);
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    fclose(th[i].capture);
+    free(th[i].buf);
+  }
+
+  free(threads);
+  free(th);
+  free(loop.text);
+  free(loop.len);
+  free(loop.done);
+}
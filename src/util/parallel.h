@@ -0,0 +1,17 @@
+/*
+ * Header file for the minimal parallel loop support.
+ *
+ */
+
+
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H      1
+
+typedef void (*par_func)(unsigned int idx, void *arg);
+
+void par_set_threads(unsigned int nthreads);
+unsigned int par_get_threads(void);
+void par_for(unsigned int n, par_func func, void *arg);
+
+#endif
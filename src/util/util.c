@@ -7,15 +7,19 @@
 
 
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "vec.h"
+#include "util.h"
 
 
 #define COMMENT_CHAR '#'
@@ -23,6 +27,55 @@
 
 
 
+static pthread_key_t out_key, hook_key;
+static pthread_once_t out_once = PTHREAD_ONCE_INIT;
+
+
+
+/*
+ * message output stream: stdout unless a thread has redirected its messages;
+ * a thread redirecting them may also set hooks to be run by a fatal prerror
+ * so that messages held back are not lost
+ *
+ */
+
+static void out_key_create(void)
+{
+  pthread_key_create(&out_key, NULL);
+  pthread_key_create(&hook_key, NULL);
+}
+
+FILE *prout(void)
+{
+  FILE *stream;
+
+
+  pthread_once(&out_once, out_key_create);
+  stream = pthread_getspecific(out_key);
+
+  return stream ? stream : stdout;
+}
+
+void prsetout(FILE *stream)
+{
+  pthread_once(&out_once, out_key_create);
+  pthread_setspecific(out_key, stream);
+}
+
+pr_hook *prgethook(void)
+{
+  pthread_once(&out_once, out_key_create);
+
+  return pthread_getspecific(hook_key);
+}
+
+void prsethook(pr_hook *hook)
+{
+  pthread_once(&out_once, out_key_create);
+  pthread_setspecific(hook_key, hook);
+}
+
+
 /*
  * simple fprintf(3) wrappers for error, warning and note message printing
  *
@@ -33,6 +86,12 @@ void prerror(int status, const char* format, ... )
   va_list args;
 
 
+  if (status) {
+    for (pr_hook *hook = prgethook(); hook; hook = hook->next) {
+      hook->func(hook);
+    }
+  }
+
   fprintf(stderr, "E> ");
 
   va_start(args, format);
@@ -44,7 +103,7 @@ void prerror(int status, const char* format, ... )
   }
 }
 
-#define OUT stdout
+#define OUT prout()
 
 void prwarn(const char* format, ... )
 {
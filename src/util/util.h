@@ -9,8 +9,16 @@
 #ifndef _UTIL_H
 #define _UTIL_H      1
 
+#include <stdio.h>
+
 #include "vec.h"
 
+/* run by a fatal prerror before exiting, then the next one */
+typedef struct _pr_hook {
+  void (*func)(struct _pr_hook *hook);
+  struct _pr_hook *next;
+} pr_hook;
+
 char *normln (char *string);
 int ishydrogen(const char *element, const char *name);
 void delnl(char *string);
@@ -31,6 +39,10 @@ void vecCrossProd(fvec r, const fvec v, const fvec w);
 void *allocate(size_t size);
 void *reallocate(void *ptr, size_t size);
 
+FILE *prout(void);
+void prsetout(FILE *stream);
+pr_hook *prgethook(void);
+void prsethook(pr_hook *hook);
 void prerror(int status, const char* format, ... );
 void prwarn(const char* format, ... );
 void prnote(const char* format, ... );
@@ -2,7 +2,22 @@
  * Copyright (C) 2011 Hannes Loeffler, STFC Daresbury, UK
  *
  *
- * Zlib I/O support via wrapper functions.
+ * Zlib I/O support via wrapper functions.  Uncompressed files can also be
+ * memory mapped.
+ *
+ * Files are read through an own buffered reader.  The format is detected from
+ * the magic bytes and decompression is dispatched through a small table of
+ * codecs: gzip (also multi-member), bzip2, xz/lzma and zstd, each optional at
+ * configure time, and plain files.  For gzip input access points can be recorded
+ * while reading in the manner of zlib's examples/zran.c: at a deflate block
+ * boundary the compressed offset, the bit position and the last 32 KiB of
+ * uncompressed data are stored so that decompression can later restart close
+ * to any uncompressed offset.
+ *
+ * When more than one thread is available compressed input is decompressed ahead of
+ * the reader on a background thread into a pair of buffers.  BGZF input (as
+ * written by bgzip) consists of independent gzip blocks of at most 64 KiB
+ * which are then decompressed in batches on several threads.
  *
  *
  * $Id: zio.c 161 2012-06-25 12:51:40Z hhl $
@@ -11,43 +26,1582 @@
 
 
 
-#include "config.h"
+#define _POSIX_C_SOURCE 200112L
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "zio.h"
+#include "util.h"
+#include "parallel.h"
+
+
+#define GZIP_MAGIC1 0x1f
+#define GZIP_MAGIC2 0x8b
+
+#define ZIO_BUF_LEN (256 * 1024)	/* uncompressed data incl. history */
+#define ZIO_IN_LEN (64 * 1024)		/* compressed data */
+#define ZIO_WIN_LEN 32768		/* deflate window */
+#define GZIP_TRAILER_LEN 8
+
+#define ZIO_MAGIC_LEN 6
+#define ZIO_NBLOCKS 2			/* buffers of the background reader */
+#define BGZF_HEADER_LEN 18
+#define BGZF_BLOCK_LEN 65536		/* max. compressed/uncompressed block */
+#define BGZF_BATCH 64			/* blocks decompressed per batch */
+
+
+typedef struct _zpoint {
+  long long out;		/* uncompressed offset */
+  long long in;			/* compressed offset of first full byte */
+  int bits;			/* bits of the byte before in, 0 if none */
+  unsigned int wlen;
+  unsigned char *window;	/* uncompressed data preceding out */
+} zpoint;
+
+typedef struct _zfile zfile;
+
+/* decompressor: read returns the number of bytes produced, 0 at the end */
+typedef struct _zcodec {
+  const char *name;
+  int (*init)(zfile *zf);
+  size_t (*read)(zfile *zf, unsigned char *out, size_t space);
+  void (*end)(zfile *zf);
+} zcodec;
+
+typedef struct _zblock {
+  unsigned char *data;
+  size_t len;
+} zblock;
+
+/* background decompression, the producer owns everything in zfile except
+   the consumer's buffer (buf, have, next, pos) while it runs */
+typedef struct _zpipe {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  zblock blocks[ZIO_NBLOCKS];
+  unsigned int head;		/* next full block to be consumed */
+  unsigned int count;		/* number of full blocks */
+  bool done;			/* producer has finished */
+  bool stop;			/* consumer asks producer to finish */
+  unsigned char *cdata;		/* BGZF: compressed blocks of a batch */
+  unsigned int nthreads;
+} zpipe;
+
+struct _zfile {
+  int fd;
+  const zcodec *codec;
+  bool eof;			/* no more data can be produced */
+  bool stale;			/* decompressor is not at pos + have */
+  unsigned char *buf;		/* up to ZIO_WIN_LEN history + new data */
+  size_t have;
+  size_t next;			/* next unread byte in buf */
+  long long pos;		/* uncompressed offset of buf[0] */
+  long long in_end;		/* compressed offset just after the input read */
+  unsigned char in[ZIO_IN_LEN];
+  zpipe *pipe;			/* background decompression or NULL */
+#ifdef HAVE_BZIP2
+  bz_stream bz;
+#endif
+#ifdef HAVE_LZMA
+  lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zstd;
+  ZSTD_inBuffer zin;
+#endif
+#ifdef HAVE_ZLIB
+  z_stream strm;
+  bool gzip;
+  bool raw;			/* restarted from an access point */
+  zpoint *points;
+  unsigned int npoints;
+  unsigned int max_points;
+  long long span;		/* distance of access points, 0 if off */
+  long long last;		/* offset of last access point */
+  bool bgzf;
+#endif
+};
+
+#ifdef HAVE_ZLIB
+/* one BGZF batch shared by the decompression threads */
+struct _bgzf_batch {
+  unsigned int nblocks;
+  unsigned int nthreads;
+  unsigned char *cdata[BGZF_BATCH];	/* raw deflate data */
+  size_t clen[BGZF_BATCH];
+  unsigned char *out[BGZF_BATCH];
+  size_t olen[BGZF_BATCH];
+  bool failed;
+};
+
+struct _bgzf_worker {
+  struct _bgzf_batch *batch;
+  unsigned int first;
+};
+#endif
+
+
+
+/*
+ * read_full: read exactly len bytes unless the file ends
+ *
+ * in:  file descriptor, buffer, number of bytes
+ * out: number of bytes read
+ *
+ */
+
+static size_t read_full(int fd, unsigned char *buf, size_t len)
+{
+  size_t done = 0;
+
+  ssize_t n;
+
+
+  while (done < len && (n = read(fd, buf + done, len - done)) > 0) {
+    done += n;
+  }
+
+  return done;
+}
+
+
+/*
+ * zio_read_in: refill the compressed input buffer
+ *
+ * in:  file handle
+ * out: number of bytes read
+ *
+ */
+
+static size_t zio_read_in(zfile *zf)
+{
+  ssize_t n;
+
+
+  n = read(zf->fd, zf->in, ZIO_IN_LEN);
+
+  if (n < 0) {
+    n = 0;
+  }
+
+  zf->in_end += n;
+
+  return n;
+}
+
+
+/*
+ * plain_read: codec for uncompressed files
+ *
+ * in:  file handle, output buffer, size of output buffer
+ * out: number of bytes read, 0 at end of file
+ *
+ */
+
+static size_t plain_read(zfile *zf, unsigned char *out, size_t space)
+{
+  size_t n;
+
+
+  n = read_full(zf->fd, out, space);
+
+  if (n < space) {
+    zf->eof = true;
+  }
+
+  return n;
+}
+
+static int plain_init(zfile *zf)
+{
+  (void) zf;
+
+  return 0;
+}
+
+static void plain_end(zfile *zf)
+{
+  (void) zf;
+}
+
+
+#ifdef HAVE_ZLIB
+/*
+ * gz_read_in: refill the input of the inflate stream
+ *
+ * in:  file handle
+ * out: number of bytes read
+ *
+ */
+
+static size_t gz_read_in(zfile *zf)
+{
+  size_t n;
+
+
+  n = zio_read_in(zf);
+
+  zf->strm.next_in = zf->in;
+  zf->strm.avail_in = n;
+
+  return n;
+}
+
+
+/*
+ * zio_add_point: record an access point at the current deflate block
+ *                boundary
+ *
+ * in:  file handle, end of uncompressed data (preceded by at least a window
+ *      of history), uncompressed offset
+ *
+ */
+
+static void zio_add_point(zfile *zf, const unsigned char *end, long long out)
+{
+  zpoint *pt;
+
+
+  if (zf->npoints >= zf->max_points) {
+    zf->max_points = zf->max_points ? 2 * zf->max_points : 16;
+    zf->points = reallocate(zf->points, zf->max_points * sizeof(*zf->points));
+  }
+
+  pt = &zf->points[zf->npoints++];
+
+  pt->out = out;
+  pt->in = zf->in_end - zf->strm.avail_in;
+  pt->bits = zf->strm.data_type & 7;
+  pt->wlen = out < ZIO_WIN_LEN ? (unsigned int) out : ZIO_WIN_LEN;
+  pt->window = allocate(pt->wlen ? pt->wlen : 1);
+  memcpy(pt->window, end - pt->wlen, pt->wlen);
+
+  zf->last = out;
+}
+
+
+/*
+ * zio_inflate: decompress gzip data
+ *
+ * in:  file handle, output buffer, size of output buffer
+ * out: number of bytes produced, 0 at end of input
+ *
+ */
+
+static size_t zio_inflate(zfile *zf, unsigned char *out, size_t space)
+{
+  int ret, skip;
+
+  size_t produced = 0;
+
+  long long out_pos;
+
+
+  while (produced < space && !zf->eof) {
+    if (zf->strm.avail_in == 0 && gz_read_in(zf) == 0) {
+      zf->eof = true;		/* end of file or truncated stream */
+      break;
+    }
+
+    zf->strm.next_out = out + produced;
+    zf->strm.avail_out = space - produced;
+
+    ret = inflate(&zf->strm, zf->span ? Z_BLOCK : Z_NO_FLUSH);
+    produced = space - zf->strm.avail_out;
+
+    if (ret == Z_STREAM_END) {
+      if (zf->raw) {		/* the trailer is left to us */
+	for (skip = GZIP_TRAILER_LEN; skip > 0; ) {
+	  if (zf->strm.avail_in == 0 && gz_read_in(zf) == 0) {
+	    break;
+	  }
+
+	  if ( (unsigned int) skip <= zf->strm.avail_in) {
+	    zf->strm.next_in += skip;
+	    zf->strm.avail_in -= skip;
+	    skip = 0;
+	  } else {
+	    skip -= zf->strm.avail_in;
+	    zf->strm.avail_in = 0;
+	  }
+	}
+      }
+
+      /* another gzip member may follow */
+      if (zf->strm.avail_in == 0 && gz_read_in(zf) == 0) {
+	zf->eof = true;
+	break;
+      }
+
+      inflateReset2(&zf->strm, 15 + 32);
+      zf->raw = false;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      zf->eof = true;		/* corrupt data or trailing garbage */
+      break;
+    }
+
+    /* access points are only recorded while reading synchronously into buf */
+    if (zf->span && (zf->strm.data_type & 128) &&
+	!(zf->strm.data_type & 64)) {
+      out_pos = zf->pos + (long long) (zf->have + produced);
+
+      if (out_pos == 0 || out_pos - zf->last > zf->span) {
+	zio_add_point(zf, out + produced, out_pos);
+      }
+    }
+  }
+
+  return produced;
+}
+
+
+/*
+ * gz_init, gz_end: set up and release the inflate stream; gzip and zlib
+ *                  headers are detected automatically
+ *
+ * in:  file handle
+ * out: 0 on success
+ *
+ */
+
+static int gz_init(zfile *zf)
+{
+  zf->strm.zalloc = Z_NULL;
+  zf->strm.zfree = Z_NULL;
+  zf->strm.opaque = Z_NULL;
+  zf->strm.next_in = Z_NULL;
+  zf->strm.avail_in = 0;
+  zf->raw = false;
+
+  return inflateInit2(&zf->strm, 15 + 32) == Z_OK ? 0 : -1;
+}
+
+static void gz_end(zfile *zf)
+{
+  inflateEnd(&zf->strm);
+}
+
+
+/*
+ * is_bgzf: check for the BGZF extra field in a gzip header
+ *
+ * in:  first BGZF_HEADER_LEN bytes of a member
+ * out: block size - 1 or -1 if this is not a BGZF block
+ *
+ */
+
+static long is_bgzf(const unsigned char *hdr)
+{
+  if (hdr[0] != GZIP_MAGIC1 || hdr[1] != GZIP_MAGIC2 || hdr[2] != 8 ||
+      !(hdr[3] & 4) || hdr[10] != 6 || hdr[11] != 0 ||
+      hdr[12] != 'B' || hdr[13] != 'C' || hdr[14] != 2 || hdr[15] != 0) {
+    return -1;
+  }
+
+  return hdr[16] | (hdr[17] << 8);
+}
+
+
+/*
+ * bgzf_inflate_blocks: thread body, decompress every nthreads-th block of a
+ *                      batch
+ *
+ * in:  worker description
+ * out: always NULL
+ *
+ */
+
+static void *bgzf_inflate_blocks(void *data)
+{
+  unsigned int i;
+
+  struct _bgzf_worker *worker = data;
+  struct _bgzf_batch *batch = worker->batch;
+
+  z_stream strm;
+
+
+  strm.zalloc = Z_NULL;
+  strm.zfree = Z_NULL;
+  strm.opaque = Z_NULL;
+  strm.next_in = Z_NULL;
+  strm.avail_in = 0;
+
+  if (inflateInit2(&strm, -15) != Z_OK) {
+    batch->failed = true;
+    return NULL;
+  }
+
+  for (i = worker->first; i < batch->nblocks; i += batch->nthreads) {
+    inflateReset(&strm);
+
+    strm.next_in = batch->cdata[i];
+    strm.avail_in = batch->clen[i];
+    strm.next_out = batch->out[i];
+    strm.avail_out = batch->olen[i];
+
+    if (inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.avail_out != 0) {
+      batch->failed = true;
+    }
+  }
+
+  inflateEnd(&strm);
+
+  return NULL;
+}
+
+
+/*
+ * bgzf_read_batch: read up to BGZF_BATCH blocks and decompress them in
+ *                  parallel
+ *
+ * in:  file handle, output buffer (at least BGZF_BATCH * BGZF_BLOCK_LEN)
+ * out: number of bytes produced, 0 at end of input
+ *
+ */
+
+static size_t bgzf_read_batch(zfile *zf, unsigned char *out)
+{
+  unsigned int i, nthreads;
+
+  unsigned char *cdata = zf->pipe->cdata, *hdr;
+
+  size_t produced = 0, bsize;
+
+  long bs;
+
+  pthread_t threads[BGZF_BATCH];
+
+  struct _bgzf_batch batch;
+  struct _bgzf_worker workers[BGZF_BATCH];
+
+
+  batch.nblocks = 0;
+  batch.failed = false;
+
+  while (batch.nblocks < BGZF_BATCH && !zf->eof) {
+    hdr = cdata + batch.nblocks * BGZF_BLOCK_LEN;
+
+    if (read_full(zf->fd, hdr, BGZF_HEADER_LEN) != BGZF_HEADER_LEN ||
+	(bs = is_bgzf(hdr)) < BGZF_HEADER_LEN + GZIP_TRAILER_LEN) {
+      zf->eof = true;		/* end of file or not BGZF any more */
+      break;
+    }
+
+    bsize = bs + 1;
+
+    if (read_full(zf->fd, hdr + BGZF_HEADER_LEN, bsize - BGZF_HEADER_LEN) !=
+	bsize - BGZF_HEADER_LEN) {
+      zf->eof = true;
+      break;
+    }
+
+    i = batch.nblocks++;
+    batch.cdata[i] = hdr + BGZF_HEADER_LEN;
+    batch.clen[i] = bsize - BGZF_HEADER_LEN - GZIP_TRAILER_LEN;
+    batch.olen[i] = hdr[bsize-4] | (hdr[bsize-3] << 8) |
+      ((size_t) hdr[bsize-2] << 16) | ((size_t) hdr[bsize-1] << 24);
+
+    if (batch.olen[i] > BGZF_BLOCK_LEN) {
+      zf->eof = true;
+      batch.nblocks--;
+      break;
+    }
+
+    batch.out[i] = out + produced;
+    produced += batch.olen[i];
+  }
+
+  if (batch.nblocks == 0) {
+    return 0;
+  }
+
+  nthreads = zf->pipe->nthreads;
+
+  if (nthreads > batch.nblocks) {
+    nthreads = batch.nblocks;
+  }
+
+  batch.nthreads = nthreads;
+
+  for (i = 0; i < nthreads; i++) {
+    workers[i].batch = &batch;
+    workers[i].first = i;
+  }
+
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, bgzf_inflate_blocks, &workers[i])) {
+      prerror(2, "cannot create decompression thread.\n");
+    }
+  }
+
+  bgzf_inflate_blocks(&workers[0]);
+
+  for (i = 1; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  if (batch.failed) {
+    zf->eof = true;		/* corrupt data: stop like the serial reader */
+    return 0;
+  }
+
+  return produced;
+}
+
+
+#endif
+
+
+#ifdef HAVE_BZIP2
+/*
+ * bz2_read: codec for bzip2, concatenated streams as written by pbzip2 are
+ *           read in turn
+ *
+ * in:  file handle, output buffer, size of output buffer
+ * out: number of bytes produced, 0 at end of input
+ *
+ */
+
+static size_t bz2_read(zfile *zf, unsigned char *out, size_t space)
+{
+  int ret;
+
+  char *pending;
+
+  size_t produced = 0, n;
+
+
+  while (produced < space && !zf->eof) {
+    if (zf->bz.avail_in == 0) {
+      if ( (n = zio_read_in(zf)) == 0) {
+	zf->eof = true;
+	break;
+      }
+
+      zf->bz.next_in = (char *) zf->in;
+      zf->bz.avail_in = n;
+    }
+
+    zf->bz.next_out = (char *) out + produced;
+    zf->bz.avail_out = space - produced;
+
+    ret = BZ2_bzDecompress(&zf->bz);
+    produced = space - zf->bz.avail_out;
+
+    if (ret == BZ_STREAM_END) {
+      if (zf->bz.avail_in == 0 && (n = zio_read_in(zf)) > 0) {
+	zf->bz.next_in = (char *) zf->in;
+	zf->bz.avail_in = n;
+      }
+
+      if (zf->bz.avail_in == 0) {
+	zf->eof = true;
+	break;
+      }
+
+      /* next stream, keeping the pending input */
+      pending = zf->bz.next_in;
+      n = zf->bz.avail_in;
+      BZ2_bzDecompressEnd(&zf->bz);
+      memset(&zf->bz, 0, sizeof(zf->bz));
+
+      if (BZ2_bzDecompressInit(&zf->bz, 0, 0) != BZ_OK) {
+	zf->eof = true;
+	break;
+      }
+
+      zf->bz.next_in = pending;
+      zf->bz.avail_in = n;
+    } else if (ret != BZ_OK) {
+      zf->eof = true;
+      break;
+    }
+  }
+
+  return produced;
+}
+
+static int bz2_init(zfile *zf)
+{
+  memset(&zf->bz, 0, sizeof(zf->bz));
+
+  return BZ2_bzDecompressInit(&zf->bz, 0, 0) == BZ_OK ? 0 : -1;
+}
+
+static void bz2_end(zfile *zf)
+{
+  BZ2_bzDecompressEnd(&zf->bz);
+}
+#endif
+
+
+#ifdef HAVE_LZMA
+/*
+ * xz_read: codec for xz and legacy lzma files, concatenated xz streams are
+ *          handled by liblzma
+ *
+ * in:  file handle, output buffer, size of output buffer
+ * out: number of bytes produced, 0 at end of input
+ *
+ */
+
+static size_t xz_read(zfile *zf, unsigned char *out, size_t space)
+{
+  lzma_ret ret;
+  lzma_action action = LZMA_RUN;
+
+  size_t produced = 0, n;
+
+
+  while (produced < space && !zf->eof) {
+    if (zf->xz.avail_in == 0) {
+      n = zio_read_in(zf);
+      zf->xz.next_in = zf->in;
+      zf->xz.avail_in = n;
+
+      if (n == 0) {
+	action = LZMA_FINISH;
+      }
+    }
+
+    zf->xz.next_out = out + produced;
+    zf->xz.avail_out = space - produced;
+
+    ret = lzma_code(&zf->xz, action);
+    produced = space - zf->xz.avail_out;
+
+    if (ret != LZMA_OK) {
+      zf->eof = true;		/* LZMA_STREAM_END or an error */
+      break;
+    }
+  }
+
+  return produced;
+}
+
+static int xz_init(zfile *zf)
+{
+  lzma_stream init = LZMA_STREAM_INIT;
+
+
+  zf->xz = init;
+
+  return lzma_auto_decoder(&zf->xz, UINT64_MAX, LZMA_CONCATENATED) ==
+    LZMA_OK ? 0 : -1;
+}
+
+static void xz_end(zfile *zf)
+{
+  lzma_end(&zf->xz);
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+/*
+ * zstd_read: codec for zstd, concatenated frames are decoded in turn
+ *
+ * in:  file handle, output buffer, size of output buffer
+ * out: number of bytes produced, 0 at end of input
+ *
+ */
+
+static size_t zstd_read(zfile *zf, unsigned char *out, size_t space)
+{
+  size_t ret;
+
+  ZSTD_outBuffer zout;
+
+
+  zout.dst = out;
+  zout.size = space;
+  zout.pos = 0;
+
+  while (zout.pos < space && !zf->eof) {
+    if (zf->zin.pos >= zf->zin.size) {
+      zf->zin.src = zf->in;
+      zf->zin.size = zio_read_in(zf);
+      zf->zin.pos = 0;
+
+      if (zf->zin.size == 0) {
+	zf->eof = true;
+	break;
+      }
+    }
+
+    ret = ZSTD_decompressStream(zf->zstd, &zout, &zf->zin);
+
+    if (ZSTD_isError(ret) ) {
+      zf->eof = true;
+      break;
+    }
+  }
+
+  return zout.pos;
+}
+
+static int zstd_init(zfile *zf)
+{
+  zf->zin.src = zf->in;
+  zf->zin.size = zf->zin.pos = 0;
+
+  if (!(zf->zstd = ZSTD_createDStream()) ) {
+    return -1;
+  }
+
+  return ZSTD_isError(ZSTD_initDStream(zf->zstd)) ? -1 : 0;
+}
+
+static void zstd_end(zfile *zf)
+{
+  ZSTD_freeDStream(zf->zstd);
+}
+#endif
+
+
+static const zcodec plain_codec = {"plain", plain_init, plain_read, plain_end};
+
+#ifdef HAVE_ZLIB
+static const zcodec gzip_codec = {"gzip", gz_init, zio_inflate, gz_end};
+#define GZIP_CODEC &gzip_codec
+#else
+#define GZIP_CODEC NULL
+#endif
+
+#ifdef HAVE_BZIP2
+static const zcodec bzip2_codec = {"bzip2", bz2_init, bz2_read, bz2_end};
+#define BZIP2_CODEC &bzip2_codec
+#else
+#define BZIP2_CODEC NULL
+#endif
+
+#ifdef HAVE_LZMA
+static const zcodec xz_codec = {"xz", xz_init, xz_read, xz_end};
+#define XZ_CODEC &xz_codec
+#else
+#define XZ_CODEC NULL
+#endif
+
+#ifdef HAVE_ZSTD
+static const zcodec zstd_codec = {"zstd", zstd_init, zstd_read, zstd_end};
+#define ZSTD_CODEC &zstd_codec
+#else
+#define ZSTD_CODEC NULL
+#endif
+
+/* compressed formats are recognised even if they cannot be decompressed */
+static const struct _zmagic {
+  unsigned int len;
+  unsigned char bytes[ZIO_MAGIC_LEN];
+  const zcodec *codec;
+} zmagics[] = {
+  {2, {GZIP_MAGIC1, GZIP_MAGIC2}, GZIP_CODEC},
+  {3, {'B', 'Z', 'h'}, BZIP2_CODEC},
+  {6, {0xfd, '7', 'z', 'X', 'Z', 0x00}, XZ_CODEC},
+  {3, {0x5d, 0x00, 0x00}, XZ_CODEC},		/* legacy .lzma */
+  {4, {0x28, 0xb5, 0x2f, 0xfd}, ZSTD_CODEC},
+  {0, {0}, NULL}
+};
+
+
+/*
+ * zio_detect: find the format of a file from its first bytes
+ *
+ * in:  first bytes of a file, number of bytes
+ * out: magic table entry or NULL if the file is not compressed
+ *
+ */
+
+static const struct _zmagic *zio_detect(const unsigned char *magic,
+					size_t len)
+{
+  const struct _zmagic *zm;
+
+
+  for (zm = zmagics; zm->len; zm++) {
+    if (len >= zm->len && !memcmp(magic, zm->bytes, zm->len)) {
+      return zm;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * zio_producer: background thread filling the free buffers of the pipe
+ *
+ * in:  file handle
+ * out: always NULL
+ *
+ */
+
+static void *zio_producer(void *data)
+{
+  unsigned int slot;
+
+  size_t len;
+
+  zfile *zf = data;
+  zpipe *pipe = zf->pipe;
+
+
+  for (;;) {
+    pthread_mutex_lock(&pipe->lock);
+
+    while (pipe->count == ZIO_NBLOCKS && !pipe->stop) {
+      pthread_cond_wait(&pipe->cond, &pipe->lock);
+    }
+
+    if (pipe->stop) {
+      pthread_mutex_unlock(&pipe->lock);
+      break;
+    }
+
+    slot = (pipe->head + pipe->count) % ZIO_NBLOCKS;
+    pthread_mutex_unlock(&pipe->lock);
+
+#ifdef HAVE_ZLIB
+    if (zf->bgzf) {
+      do {			/* skip empty blocks like the EOF marker */
+	len = bgzf_read_batch(zf, pipe->blocks[slot].data);
+      } while (len == 0 && !zf->eof);
+    } else
+#endif
+    {
+      len = zf->codec->read(zf, pipe->blocks[slot].data, ZIO_BUF_LEN);
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+
+    if (len > 0) {
+      pipe->blocks[slot].len = len;
+      pipe->count++;
+    } else {
+      pipe->done = true;
+    }
+
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+
+    if (len == 0) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * zio_start_pipe: start background decompression if threads are available;
+ *                 only done before anything has been read
+ *
+ * in:  file handle
+ *
+ */
+
+static void zio_start_pipe(zfile *zf)
+{
+  unsigned int i, nthreads;
+
+  bool bgzf = false;
+
+  size_t size = ZIO_BUF_LEN;
+
+  zpipe *pipe;
+
+
+  nthreads = par_get_threads();
+
+  if (nthreads < 2 || zf->codec == &plain_codec || zf->stale) {
+    return;
+  }
+
+#ifdef HAVE_ZLIB
+  if (zf->span) {
+    return;
+  }
+
+  if ( (bgzf = zf->bgzf) ) {
+    size = BGZF_BATCH * BGZF_BLOCK_LEN;
+  }
+#endif
+
+  pipe = allocate(sizeof(*pipe));
+  memset(pipe, 0, sizeof(*pipe));
+
+  pipe->nthreads = nthreads > BGZF_BATCH ? BGZF_BATCH : nthreads;
+
+  for (i = 0; i < ZIO_NBLOCKS; i++) {
+    pipe->blocks[i].data = allocate(size);
+  }
+
+  if (bgzf) {
+    pipe->cdata = allocate(BGZF_BATCH * BGZF_BLOCK_LEN);
+  }
+
+  /* consumer and producer swap buffers so they must be of the same size */
+  zf->buf = reallocate(zf->buf, size);
+
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_cond_init(&pipe->cond, NULL);
+
+  zf->pipe = pipe;
+
+  if (pthread_create(&pipe->thread, NULL, zio_producer, zf) ) {
+    prerror(2, "cannot create decompression thread.\n");
+  }
+}
+
+
+/*
+ * zio_stop_pipe: finish background decompression; the decompressor state is
+ *                then ahead of the reader
+ *
+ * in:  file handle
+ *
+ */
+
+static void zio_stop_pipe(zfile *zf)
+{
+  unsigned int i;
+
+  zpipe *pipe = zf->pipe;
+
 
-#include <stdio.h>
+  if (!pipe) {
+    return;
+  }
 
-#ifdef HAVE_ZLIB
-#include <zlib.h>
-#endif
+  pthread_mutex_lock(&pipe->lock);
+  pipe->stop = true;
+  pthread_cond_broadcast(&pipe->cond);
+  pthread_mutex_unlock(&pipe->lock);
+
+  pthread_join(pipe->thread, NULL);
+
+  pthread_mutex_destroy(&pipe->lock);
+  pthread_cond_destroy(&pipe->cond);
+
+  for (i = 0; i < ZIO_NBLOCKS; i++) {
+    free(pipe->blocks[i].data);
+  }
+
+  free(pipe->cdata);
+  free(pipe);
+
+  zf->pipe = NULL;
+  zf->stale = true;
+}
+
+
+/*
+ * zio_pipe_fill: take the next buffer from the background decompression
+ *
+ * in:  file handle
+ * out: false if no more data is available
+ *
+ */
+
+static bool zio_pipe_fill(zfile *zf)
+{
+  unsigned char *tmp;
+
+  zpipe *pipe = zf->pipe;
+  zblock *block;
+
+
+  pthread_mutex_lock(&pipe->lock);
+
+  while (pipe->count == 0 && !pipe->done) {
+    pthread_cond_wait(&pipe->cond, &pipe->lock);
+  }
+
+  if (pipe->count == 0) {
+    pthread_mutex_unlock(&pipe->lock);
+    return false;
+  }
+
+  block = &pipe->blocks[pipe->head];
+
+  tmp = zf->buf;
+  zf->buf = block->data;
+  block->data = tmp;
+
+  zf->pos += zf->have;
+  zf->have = block->len;
+  zf->next = 0;
+
+  pipe->head = (pipe->head + 1) % ZIO_NBLOCKS;
+  pipe->count--;
+
+  pthread_cond_broadcast(&pipe->cond);
+  pthread_mutex_unlock(&pipe->lock);
+
+  return true;
+}
+
+/*
+ * zio_fill: make new data available in the buffer, keeping up to a window's
+ *           worth of already consumed data as history
+ *
+ * in:  file handle
+ * out: false if no more data is available
+ *
+ */
+
+static bool zio_fill(zfile *zf)
+{
+  size_t keep;
+
+
+  if (!zf->pipe && zf->pos + zf->have == 0) {
+    zio_start_pipe(zf);
+  }
+
+  if (zf->pipe) {
+    return zio_pipe_fill(zf);
+  }
+
+  keep = zf->have < ZIO_WIN_LEN ? zf->have : ZIO_WIN_LEN;
+  memmove(zf->buf, zf->buf + zf->have - keep, keep);
+  zf->pos += zf->have - keep;
+  zf->have = zf->next = keep;
+
+  zf->have += zf->codec->read(zf, zf->buf + zf->have, ZIO_BUF_LEN - zf->have);
+
+  return zf->have > zf->next;
+}
+
+
+/*
+ * zio_restart: start reading from the beginning of the file again
+ *
+ * in:  file handle
+ * out: 0 on success, -1 on error
+ *
+ */
+
+static int zio_restart(zfile *zf)
+{
+  if (lseek(zf->fd, 0, SEEK_SET) < 0) {
+    return -1;
+  }
+
+  zf->codec->end(zf);
 
+  zf->in_end = 0;
+  zf->pos = 0;
+  zf->have = zf->next = 0;
+  zf->eof = false;
+  zf->stale = false;
 
+  return zf->codec->init(zf);
+}
+
+
+/*
+ * fzopen: open a plain or compressed file for reading, the format is
+ *         detected from the magic bytes
+ *
+ * in:  file name, mode (only reading is supported)
+ * out: file handle or NULL (errno is ENOTSUP if the compression format is
+ *      not supported by this build)
+ *
+ */
 
 void *fzopen(const char *path, const char *mode)
 {
-  if (!path) return NULL;
+  int fd;
+
+  unsigned char magic[BGZF_HEADER_LEN];
+
+  size_t len;
+
+  const struct _zmagic *zm;
+
+  zfile *zf;
+
+
+  if (!path || !mode || *mode != 'r') return NULL;
+
+  if ( (fd = open(path, O_RDONLY)) < 0) {
+    return NULL;
+  }
+
+  memset(magic, 0, sizeof(magic));
+  len = read_full(fd, magic, BGZF_HEADER_LEN);
+
+  if ( (zm = zio_detect(magic, len)) && !zm->codec) {
+    close(fd);
+    errno = ENOTSUP;
+
+    return NULL;
+  }
+
+  lseek(fd, 0, SEEK_SET);
+
+  zf = allocate(sizeof(*zf));
+  memset(zf, 0, sizeof(*zf));
+
+  zf->fd = fd;
+  zf->buf = allocate(ZIO_BUF_LEN);
+  zf->codec = zm ? zm->codec : &plain_codec;
 
 #ifdef HAVE_ZLIB
-  return gzopen(path, mode);
-#else
-  return fopen(path, mode);
+  zf->gzip = zf->codec == &gzip_codec;
+  zf->bgzf = zf->gzip && len == BGZF_HEADER_LEN && is_bgzf(magic) >= 0;
 #endif
+
+  if (zf->codec->init(zf) ) {
+    close(fd);
+    free(zf->buf);
+    free(zf);
+
+    return NULL;
+  }
+
+  return zf;
 }
 
 char *fzgets(void *file, char *s, int size)
 {
+  size_t len = 0, n;
+
+  unsigned char *start, *nl;
+
+  zfile *zf = file;
+
+
   if (!file || !s || size < 3) return NULL;
 
+  while (len < (size_t) size - 1) {
+    if (zf->next >= zf->have && !zio_fill(zf) ) {
+      break;
+    }
+
+    start = zf->buf + zf->next;
+    n = zf->have - zf->next;
+
+    if (n > size - 1 - len) {
+      n = size - 1 - len;
+    }
+
+    if ( (nl = memchr(start, '\n', n)) ) {
+      n = nl - start + 1;
+    }
+
+    memcpy(s + len, start, n);
+    len += n;
+    zf->next += n;
+
+    if (nl) {
+      break;
+    }
+  }
+
+  if (len == 0) {
+    return NULL;
+  }
+
+  s[len] = '\0';
+
+  return s;
+}
+
+int fzclose(void *file)
+{
+  int ret;
+
+#ifdef HAVE_ZLIB
+  unsigned int i;
+#endif
+
+  zfile *zf = file;
+
+
+  if (!file) return -1;
+
+  zio_stop_pipe(zf);
+  zf->codec->end(zf);
+
+#ifdef HAVE_ZLIB
+  for (i = 0; i < zf->npoints; i++) {
+    free(zf->points[i].window);
+  }
+
+  free(zf->points);
+#endif
+
+  ret = close(zf->fd);
+  free(zf->buf);
+  free(zf);
+
+  return ret;
+}
+
+
+/*
+ * fztell: uncompressed offset of the next byte to be read
+ *
+ * in:  file handle
+ * out: offset
+ *
+ */
+
+long long fztell(void *file)
+{
+  zfile *zf = file;
+
+
+  return zf->pos + zf->next;
+}
+
+
+/*
+ * fzseek: position the file at an uncompressed offset; for gzip input the
+ *         closest preceding access point is used, otherwise decompression
+ *         starts over from the beginning if needed
+ *
+ * in:  file handle, uncompressed offset
+ * out: 0 on success, -1 if the offset cannot be reached
+ *
+ */
+
+int fzseek(void *file, long long offset)
+{
+  long long here;
+
+  bool restored = false;
+
+#ifdef HAVE_ZLIB
+  unsigned int lo, hi, mid;
+
+  unsigned char byte;
+
+  zpoint *pt = NULL;
+#endif
+
+  zfile *zf = file;
+
+
+  if (!file || offset < 0) return -1;
+
+  here = zf->pos + zf->next;
+
+  if (offset >= zf->pos && offset <= zf->pos + (long long) zf->have) {
+    zf->next = offset - zf->pos;
+
+    return 0;
+  }
+
+  if (zf->codec == &plain_codec) {
+    if (lseek(zf->fd, offset, SEEK_SET) < 0) {
+      return -1;
+    }
+
+    zf->pos = offset;
+    zf->have = zf->next = 0;
+    zf->eof = false;
+
+    return 0;
+  }
+
+  zio_stop_pipe(zf);
+
+#ifdef HAVE_ZLIB
+  /* binary search for the last access point not beyond offset */
+  for (lo = 0, hi = zf->npoints; lo < hi; ) {
+    mid = (lo + hi) / 2;
+
+    if (zf->points[mid].out <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo > 0) {
+    pt = &zf->points[lo - 1];
+  }
+
+  if (pt && (pt->out > here || offset < here || zf->stale) ) {
+    if (lseek(zf->fd, pt->in - (pt->bits ? 1 : 0), SEEK_SET) < 0) {
+      return -1;
+    }
+
+    zf->in_end = pt->in;
+    zf->strm.avail_in = 0;
+    inflateReset2(&zf->strm, -15);
+
+    if (pt->bits) {
+      if (read(zf->fd, &byte, 1) != 1) {
+	return -1;
+      }
+
+      inflatePrime(&zf->strm, pt->bits, byte >> (8 - pt->bits));
+    }
+
+    if (pt->wlen) {
+      inflateSetDictionary(&zf->strm, pt->window, pt->wlen);
+    }
+
+    /* the window doubles as history for later access points */
+    memcpy(zf->buf, pt->window, pt->wlen);
+    zf->pos = pt->out - pt->wlen;
+    zf->have = zf->next = pt->wlen;
+    zf->raw = true;
+    zf->eof = false;
+    zf->stale = false;
+    restored = true;
+  }
+#endif
+
+  if (!restored && (offset < here || zf->stale) && zio_restart(zf) ) {
+    return -1;
+  }
+
+  /* decompress forward to the requested offset */
+  while (zf->pos + (long long) zf->have < offset) {
+    zf->next = zf->have;
+
+    if (!zio_fill(zf) ) {
+      return -1;
+    }
+  }
+
+  zf->next = offset - zf->pos;
+
+  return 0;
+}
+
+
+/*
+ * fzindex: record access points every span uncompressed bytes while the file
+ *          is read; must be called before any data has been read
+ *
+ * in:  file handle, distance of access points
+ *
+ */
+
+void fzindex(void *file, long long span)
+{
 #ifdef HAVE_ZLIB
-  return gzgets(file, s, size);
+  zfile *zf = file;
+
+
+  if (zf && zf->gzip && zf->pos + zf->have == 0) {
+    zf->span = span;
+  }
 #else
-  return fgets(s, size, file);
+  (void) file;
+  (void) span;
 #endif
 }
 
-int fzclose(void *file)
+
+/*
+ * fzindex_write: save the access points of a file
+ *
+ * in:  file handle, output stream
+ * out: 0 on success, -1 on error
+ *
+ */
+
+int fzindex_write(void *file, FILE *stream)
+{
+  unsigned int npoints = 0;
+
+#ifdef HAVE_ZLIB
+  unsigned int i;
+
+  zpoint *pt;
+#endif
+
+  zfile *zf = file;
+
+
+#ifdef HAVE_ZLIB
+  npoints = zf->npoints;
+
+  if (fwrite(&npoints, sizeof(npoints), 1, stream) != 1) {
+    return -1;
+  }
+
+  for (i = 0; i < zf->npoints; i++) {
+    pt = &zf->points[i];
+
+    if (fwrite(&pt->out, sizeof(pt->out), 1, stream) != 1 ||
+	fwrite(&pt->in, sizeof(pt->in), 1, stream) != 1 ||
+	fwrite(&pt->bits, sizeof(pt->bits), 1, stream) != 1 ||
+	fwrite(&pt->wlen, sizeof(pt->wlen), 1, stream) != 1 ||
+	fwrite(pt->window, 1, pt->wlen, stream) != pt->wlen) {
+      return -1;
+    }
+  }
+
+  return 0;
+#else
+  (void) zf;
+
+  return fwrite(&npoints, sizeof(npoints), 1, stream) == 1 ? 0 : -1;
+#endif
+}
+
+
+/*
+ * fzindex_read: load access points saved by fzindex_write; the file must not
+ *               have any yet
+ *
+ * in:  file handle, input stream
+ * out: 0 on success, -1 on error
+ *
+ */
+
+int fzindex_read(void *file, FILE *stream)
 {
+  unsigned int npoints;
+
 #ifdef HAVE_ZLIB
-  return gzclose(file);
+  unsigned int i;
+
+  zpoint *pt;
+#endif
+
+  zfile *zf = file;
+
+
+  if (fread(&npoints, sizeof(npoints), 1, stream) != 1) {
+    return -1;
+  }
+
+#ifdef HAVE_ZLIB
+  if (npoints == 0) {
+    return 0;
+  }
+
+  if (!zf->gzip || zf->npoints > 0) {
+    return -1;
+  }
+
+  zf->points = allocate(npoints * sizeof(*zf->points));
+  zf->max_points = npoints;
+
+  for (i = 0; i < npoints; i++) {
+    pt = &zf->points[i];
+
+    if (fread(&pt->out, sizeof(pt->out), 1, stream) != 1 ||
+	fread(&pt->in, sizeof(pt->in), 1, stream) != 1 ||
+	fread(&pt->bits, sizeof(pt->bits), 1, stream) != 1 ||
+	fread(&pt->wlen, sizeof(pt->wlen), 1, stream) != 1 ||
+	pt->wlen > ZIO_WIN_LEN || pt->bits < 0 || pt->bits > 7) {
+      break;
+    }
+
+    pt->window = allocate(pt->wlen ? pt->wlen : 1);
+    zf->npoints++;
+
+    if (fread(pt->window, 1, pt->wlen, stream) != pt->wlen) {
+      break;
+    }
+  }
+
+  if (zf->npoints == npoints) {
+    return 0;
+  }
+
+  for (i = 0; i < zf->npoints; i++) {
+    free(zf->points[i].window);
+  }
+
+  free(zf->points);
+  zf->points = NULL;
+  zf->npoints = zf->max_points = 0;
+
+  return -1;
 #else
-  return fclose(file);
+  (void) zf;
+
+  return npoints == 0 ? 0 : -1;
 #endif
 }
+
+
+/*
+ * fzmap: map an uncompressed file read-only into memory
+ *
+ * in:  file name, pointer to file size
+ * out: start of the read-only mapping or NULL if the file is compressed, empty or
+ *      cannot be mapped (the caller should then use fzopen)
+ *
+ */
+
+char *fzmap(const char *path, size_t *size)
+{
+  int fd;
+
+  unsigned char magic[ZIO_MAGIC_LEN];
+
+  void *addr;
+
+  struct stat st;
+
+
+  if (!path || (fd = open(path, O_RDONLY)) < 0) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < 2 ||
+      zio_detect(magic, read_full(fd, magic, ZIO_MAGIC_LEN)) ) {
+    close(fd);
+    return NULL;
+  }
+
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  posix_madvise(addr, st.st_size, POSIX_MADV_SEQUENTIAL);
+  *size = st.st_size;
+
+  return addr;
+}
+
+void fzunmap(char *addr, size_t size)
+{
+  if (addr) {
+    munmap(addr, size);
+  }
+}
@@ -11,6 +11,18 @@
 
 
 
+#include <stdio.h>
+#include <stddef.h>
+
 void *fzopen(const char *path, const char *mode);
 char *fzgets(void *file, char *s, int size);	 /* parameter order as gzgets */
 int fzclose(void *file);
+long long fztell(void *file);
+int fzseek(void *file, long long offset);
+
+void fzindex(void *file, long long span);
+int fzindex_write(void *file, FILE *stream);
+int fzindex_read(void *file, FILE *stream);
+
+char *fzmap(const char *path, size_t *size);
+void fzunmap(char *addr, size_t size);